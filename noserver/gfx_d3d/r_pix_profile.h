@@ -18,26 +18,54 @@
 #define R_PIX_PROFILE_H
 
 #include <qcommon/threads.h>
+#include <qcommon/threads_profile.h>
 #include <d3d9.h>
 
+#include <cstdarg>
+#include <cstdio>
+
+// The markers always land in the zone profiler, so they can be captured on
+// any thread and without GPU tooling; the render thread also forwards them to
+// D3DPERF for PIX.
 extern "C" {
     void PIXBeginNamedEvent(int Color, const char* Name, ...) {
+        char name[256];
         wchar_t w[256]; // [esp+0h] [ebp-204h] BYREF
+        va_list ap;
 
+        va_start(ap, Name);
+        vsnprintf(name, sizeof(name), Name, ap);
+        va_end(ap);
+        Sys_BeginProfileZone(name);
         if (Sys_IsRenderThread())
         {
-            MultiByteToWideChar(0, 0, Name, -1, w, 256);
+            MultiByteToWideChar(0, 0, name, -1, w, 256);
             D3DPERF_BeginEvent(Color, w);
         }
     }
 
+    void PIXEndNamedEvent(void)
+    {
+        Sys_EndProfileZone();
+        if (Sys_IsRenderThread())
+        {
+            D3DPERF_EndEvent();
+        }
+    }
+
     void PIXSetMarker(int Color, const char* Name, ...)
     {
+        char name[256];
         wchar_t w[256]; // [esp+0h] [ebp-204h] BYREF
+        va_list ap;
 
+        va_start(ap, Name);
+        vsnprintf(name, sizeof(name), Name, ap);
+        va_end(ap);
+        Sys_ProfileMarker(name);
         if (Sys_IsRenderThread())
         {
-            MultiByteToWideChar(0, 0, Name, -1, w, 256);
+            MultiByteToWideChar(0, 0, name, -1, w, 256);
             D3DPERF_SetMarker(Color, w);
         }
     }
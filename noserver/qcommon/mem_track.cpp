@@ -18,213 +18,374 @@
 
 #include <universal/q_shared.h>
 #include <universal/win_common.h>
+#include <qcommon/common.h>
+#include <qcommon/threads.h>
+#include <qcommon/threads_registry.h>
+
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <thread>
 
-int g_userhunk_track_count;
 const char* g_mem_track_filename;
-mem_track_t g_staticsMemTrack[2048];
-int g_hunk_track_count;
-int g_staticsMemTrackCount;
-int g_hunklow_track_count;
-int g_mallocMemInfoCount;
-int g_tempMemInfoCount;
-int g_tempHighMemInfoCount;
-int g_physicalMemInfoCount;
 int g_malloc_mem_size;
 int g_malloc_mem_high;
 
 meminfo_t g_info;
-TempMemInfo g_mallocMemInfoArray[1500];
-mem_track_node_s* g_ZMallocMemTrackList;
 meminfo_t g_virtualMemInfo;
-TempMemInfo g_physicalMemInfoArray[1500];
-TempMemInfo g_tempMemInfoArray[1500];
-mem_track_t g_userhunk_track[256];
-mem_track_t g_hunklow_track[65536];
-TempMemInfo g_combinedMemInfoArray[1500];
-mem_track_t g_hunk_track[524288];
-TempMemInfo g_tempHighMemInfoArray[1500];
+bool inited_0;
+
+// The fixed tables these replaced, kept only for track_Footprint_f.
+#define LEGACY_HUNK_TRACK 524288
+#define LEGACY_HUNKLOW_TRACK 65536
+#define LEGACY_STATICS_TRACK 2048
+#define LEGACY_USERHUNK_TRACK 256
+#define LEGACY_TEMP_MEM_INFO_ARRAYS 5
+#define LEGACY_TEMP_MEM_INFO_COUNT 1500
 
-#define MAX_MEM_TRACK 2048
-#define TEMP_MEM_INFO_COUNT 1500
-#define MAX_USERHUNK_TRACK 256
+static_assert(TRACK_MAX_NAMES < 0xFFFF, "name ids must fit track_entry_t");
 
-TempMemInfo* GetTempMemInfo(int permanent, const char* name, int type, int usageType, TempMemInfo* tempMemInfoArray, int* tempMemInfoCount, bool add_if_missing)
+typedef struct track_shard_chunk_t
 {
-    TempMemInfo foundTempMemInfo;
-    int i;
-    TempMemInfo* tempMemInfo;
+    std::atomic<int> size[TRACK_SHARD_CHUNK_SIZE][2];
+    std::atomic<int> count[TRACK_SHARD_CHUNK_SIZE];
+} track_shard_chunk_t;
+
+// Only the owning thread writes a shard, but the counters are atomic so
+// track_aggregate can read every shard while they change. Chunks of records
+// are added the first time the shard counts one of them.
+typedef struct track_shard_t
+{
+    std::atomic<track_shard_chunk_t*> chunks[TRACK_MAX_RECORDS / TRACK_SHARD_CHUNK_SIZE];
+    std::atomic<int> overhead;
+} track_shard_t;
+
+typedef struct track_cache_entry_t
+{
+    const char* name;
+    int type;
+    int usageType;
+    int record;
+} track_cache_entry_t;
+
+// Hunk records, pushed and popped in step with one end of the hunk. Chunks
+// are kept once allocated so the next level reuses them.
+typedef struct track_store_t
+{
+    track_entry_t* chunks[TRACK_STORE_MAX_CHUNKS];
+    int chunkCount;
     int count;
+    int high;
+} track_store_t;
 
-    count = *tempMemInfoCount;
-    tempMemInfo = tempMemInfoArray;
-    for (i = 0; i < count; ++i, ++tempMemInfo)
-    {
-        tempMemInfo = &tempMemInfoArray[i];
-        if ((!name || !_stricmp(tempMemInfo->data.name, name))
-            && tempMemInfo->permanent == permanent
-            && (unsigned char)tempMemInfo->data.usageType == usageType)
-        {
-            if (!i)
-            {
-                return tempMemInfo;
-            }
+// taken only to intern a new name, add a new record or grow a shard;
+// lookups are lock-free
+static std::mutex s_trackLock;
+static char* s_trackNameChunks[TRACK_NAME_POOL_SIZE / TRACK_NAME_CHUNK_SIZE];
+static int s_trackNameChunkCount;
+static int s_trackNameChunkUsed;
+static const char* s_trackNames[TRACK_MAX_NAMES];
+static std::atomic<int> s_trackNameCount;
+static std::atomic<int> s_trackNameIndex[TRACK_MAX_NAMES * 2];
+static track_record_t s_trackRecords[TRACK_MAX_RECORDS];
+static std::atomic<int> s_trackRecordCount;
+static std::atomic<int> s_trackRecordIndex[TRACK_MAX_RECORDS * 2];
 
-            memcpy(&foundTempMemInfo, tempMemInfo, sizeof(foundTempMemInfo));
-            while (i > 0)
-            {
-                memcpy(&tempMemInfoArray[i], &tempMemInfoArray[i - 1], sizeof(TempMemInfo));
-                --i;
-            }
+// one shard per registry block, plus one shared by threads that never registered
+static std::atomic<track_shard_t*> s_trackShards[SYS_THREAD_CHUNK_SIZE * SYS_THREAD_CHUNK_COUNT];
+static track_shard_t s_trackSharedShard;
+static std::atomic<int> s_trackShardChunkCount;
+static thread_local track_shard_t* s_trackShard;
+static thread_local SysThreadBlock* s_trackShardBlock;
+static thread_local track_cache_entry_t s_trackCache[TRACK_CACHE_SIZE];
 
-            memcpy(tempMemInfoArray, &foundTempMemInfo, sizeof(TempMemInfo));
-            return tempMemInfoArray;
-        }
+// under CRITSECT_MEMTRACK
+static track_info_t* s_trackInfo;
+static int s_trackInfoCapacity;
+// records the last track_aggregate covered; newer ones have no high or low yet
+static int s_trackInfoCount;
+static track_store_t s_trackHunkHigh;
+static track_store_t s_trackHunkLow;
+
+void track_init()
+{
+
+}
+
+static unsigned int track_hash_name(const char* name)
+{
+    unsigned int hash;
+
+    hash = 2166136261u;
+    for (; *name; ++name)
+        hash = (hash ^ (unsigned char)tolower((unsigned char)*name)) * 16777619u;
+    return hash;
+}
+
+// Names compare without case, as they always have.
+int track_intern_name(const char* name)
+{
+    unsigned int slot;
+    int id;
+    int len;
+
+    for (slot = track_hash_name(name) & (TRACK_MAX_NAMES * 2 - 1); (id = s_trackNameIndex[slot].load(std::memory_order_acquire)); slot = (slot + 1) & (TRACK_MAX_NAMES * 2 - 1))
+    {
+        if (!_stricmp(s_trackNames[id - 1], name))
+            return id - 1;
+    }
+
+    std::lock_guard<std::mutex> lock(s_trackLock);
+    // slots are only ever filled, so the probe carries on where it stopped
+    for (; (id = s_trackNameIndex[slot].load(std::memory_order_relaxed)); slot = (slot + 1) & (TRACK_MAX_NAMES * 2 - 1))
+    {
+        if (!_stricmp(s_trackNames[id - 1], name))
+            return id - 1;
     }
-    if (!add_if_missing)
+    id = s_trackNameCount.load(std::memory_order_relaxed);
+    len = (int)strlen(name) + 1;
+    if (!s_trackNameChunkCount || s_trackNameChunkUsed + len > TRACK_NAME_CHUNK_SIZE)
     {
-        return 0;
+        if (s_trackNameChunkCount == TRACK_NAME_POOL_SIZE / TRACK_NAME_CHUNK_SIZE || len > TRACK_NAME_CHUNK_SIZE)
+            Com_Error(ERR_FATAL, "track_intern_name: no room for '%s' after %i names", name, id);
+        s_trackNameChunks[s_trackNameChunkCount++] = new char[TRACK_NAME_CHUNK_SIZE];
+        s_trackNameChunkUsed = 0;
     }
+    if (id == TRACK_MAX_NAMES)
+        Com_Error(ERR_FATAL, "track_intern_name: no room for '%s' after %i names", name, id);
+    s_trackNames[id] = &s_trackNameChunks[s_trackNameChunkCount - 1][s_trackNameChunkUsed];
+    memcpy((char*)s_trackNames[id], name, len);
+    s_trackNameChunkUsed += len;
+    s_trackNameCount.store(id + 1, std::memory_order_relaxed);
+    s_trackNameIndex[slot].store(id + 1, std::memory_order_release);
+    return id;
+}
+
+const char* track_get_name(int nameId)
+{
+    return s_trackNames[nameId];
+}
+
+static int track_lookup_record(int nameId, int type, int usageType)
+{
+    track_record_t* record;
+    unsigned int slot;
+    int index;
 
-    ++* tempMemInfoCount;
-    tempMemInfo->permanent = permanent;
-    strcpy(tempMemInfo->data.name, name);
-    tempMemInfo->data.type = type;
-    tempMemInfo->data.usageType = usageType;
-    tempMemInfo->data.size[0] = 0;
-    tempMemInfo->data.size[1] = 0;
-    tempMemInfo->data.filename = "";
-    tempMemInfo->data.count = 0;
-    tempMemInfo->high = 0;
-    tempMemInfo->low = 0;
-    tempMemInfo->hunkSize = 0;
-    tempMemInfo->highExtra = 0;
-
-    memcpy(&foundTempMemInfo, tempMemInfo, sizeof(foundTempMemInfo));
-    for (; i > 0; --i)
+    slot = ((unsigned int)nameId * 2654435761u ^ (type << 8) ^ usageType) & (TRACK_MAX_RECORDS * 2 - 1);
+    for (; (index = s_trackRecordIndex[slot].load(std::memory_order_acquire)); slot = (slot + 1) & (TRACK_MAX_RECORDS * 2 - 1))
     {
-        memcpy(&tempMemInfoArray[i], &tempMemInfoArray[i - 1], sizeof(TempMemInfo));
+        record = &s_trackRecords[index - 1];
+        if (record->nameId == nameId && record->type == type && record->usageType == usageType)
+            return index - 1;
     }
 
-    memcpy(tempMemInfoArray, &foundTempMemInfo, sizeof(TempMemInfo));
-    return tempMemInfoArray;
+    std::lock_guard<std::mutex> lock(s_trackLock);
+    for (; (index = s_trackRecordIndex[slot].load(std::memory_order_relaxed)); slot = (slot + 1) & (TRACK_MAX_RECORDS * 2 - 1))
+    {
+        record = &s_trackRecords[index - 1];
+        if (record->nameId == nameId && record->type == type && record->usageType == usageType)
+            return index - 1;
+    }
+    index = s_trackRecordCount.load(std::memory_order_relaxed);
+    if (index == TRACK_MAX_RECORDS)
+        Com_Error(ERR_FATAL, "track_lookup_record: more than %i tracked names", TRACK_MAX_RECORDS);
+    record = &s_trackRecords[index];
+    record->nameId = nameId;
+    record->type = type;
+    record->usageType = usageType;
+    s_trackRecordCount.store(index + 1, std::memory_order_release);
+    s_trackRecordIndex[slot].store(index + 1, std::memory_order_release);
+    return index;
 }
 
-void track_init()
+// Callers nearly always pass the same literal for the same thing, so the
+// pointer is cached per thread; the string is still compared in case a
+// buffer was reused for another name.
+static int track_find_record(const char* name, int type, int usageType)
 {
+    track_cache_entry_t* entry;
 
+    entry = &s_trackCache[((((uintptr_t)name ^ type << 3 ^ usageType) * 0x9E3779B97F4A7C15ull) >> 32) & (TRACK_CACHE_SIZE - 1)];
+    if (entry->name == name && entry->type == type && entry->usageType == usageType
+        && !strcmp(s_trackNames[s_trackRecords[entry->record].nameId], name))
+    {
+        return entry->record;
+    }
+    entry->record = track_lookup_record(track_intern_name(name), type, usageType);
+    entry->name = name;
+    entry->type = type;
+    entry->usageType = usageType;
+    return entry->record;
 }
 
-void track_physical_alloc(int size, const char* name, int type, int location)
+static track_shard_t* track_get_shard()
 {
-    TempMemInfo* memInfo;
-    int dataSize;
+    SysThreadBlock* block;
+    track_shard_t* shard;
 
-    track_init();
-    if (size)
+    block = g_threadBlock;
+    if (s_trackShard && s_trackShardBlock == block)
+        return s_trackShard;
+    if (!block)
+        return &s_trackSharedShard;
+    shard = s_trackShards[block->index].load(std::memory_order_acquire);
+    if (!shard)
     {
-        Sys_EnterCriticalSection(CRITSECT_MEMTRACK);
-        if (size <= 0)
-        {
-            memInfo = GetTempMemInfo(0, name, type, 7, g_physicalMemInfoArray, &g_physicalMemInfoCount, 0);
-            if (memInfo)
-            {
-                memInfo->data.size[location] += size;
-                --memInfo->data.count;
-                dataSize = memInfo->data.size[location];
-                if (memInfo->low > dataSize)
-                    memInfo->low = dataSize;
-            }
-        }
-        else
-        {
-            memInfo = GetTempMemInfo(0, name, type, 7, g_physicalMemInfoArray, &g_physicalMemInfoCount, 1);
-            memInfo->data.size[location] += size;
-            ++memInfo->data.count;
-            dataSize = memInfo->data.size[location];
-            if (memInfo->high < dataSize)
-                memInfo->high = dataSize;
-            if (memInfo->hunkSize < 0)
-            {
-                memInfo->hunkSize = 0;
-                memInfo->highExtra = dataSize;
-            }
-        }
-        g_info.typeTotal[type][location] += size;
-        g_info.total[location] += size;
-        switch (type)
-        {
-            case 0:
-            case 1:
-            case 3:
-            case 39:
-            case 55:
-                break;
-            default:
-                g_info.nonSwapTotal += size;
-                break;
-        }
-        switch (type)
-        {
-            case 0:
-            case 1:
-            case 3:
-            case 17:
-            case 19:
-            case 39:
-            case 55:
-                break;
-            default:
-                g_info.nonSwapMinSpecTotal += size;
-                break;
-        }
-        Sys_LeaveCriticalSection(CRITSECT_MEMTRACK);
+        shard = new track_shard_t();
+        s_trackShards[block->index].store(shard, std::memory_order_release);
     }
+    s_trackShard = shard;
+    s_trackShardBlock = block;
+    return shard;
+}
+
+// A shard with one owner needs no read-modify-write, only the shared one does.
+static void track_add(std::atomic<int>* counter, int delta, bool shared)
+{
+    if (shared)
+        counter->fetch_add(delta, std::memory_order_relaxed);
+    else
+        counter->store(counter->load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+// The shared shard can be grown by two threads at once, so this locks even
+// though each chunk is only added once.
+static track_shard_chunk_t* track_add_shard_chunk(track_shard_t* shard, int index)
+{
+    track_shard_chunk_t* chunk;
+
+    std::lock_guard<std::mutex> lock(s_trackLock);
+    chunk = shard->chunks[index].load(std::memory_order_relaxed);
+    if (chunk)
+        return chunk;
+    chunk = new track_shard_chunk_t();
+    s_trackShardChunkCount.fetch_add(1, std::memory_order_relaxed);
+    shard->chunks[index].store(chunk, std::memory_order_release);
+    return chunk;
+}
+
+static void track_count(int record, int size, int location, int count, int overhead)
+{
+    track_shard_t* shard;
+    track_shard_chunk_t* chunk;
+    bool shared;
+    int slot;
+
+    shard = track_get_shard();
+    shared = shard == &s_trackSharedShard;
+    chunk = shard->chunks[record / TRACK_SHARD_CHUNK_SIZE].load(std::memory_order_acquire);
+    if (!chunk)
+        chunk = track_add_shard_chunk(shard, record / TRACK_SHARD_CHUNK_SIZE);
+    slot = record % TRACK_SHARD_CHUNK_SIZE;
+    track_add(&chunk->size[slot][location], size, shared);
+    track_add(&chunk->count[slot], count, shared);
+    if (overhead)
+        track_add(&shard->overhead, overhead, shared);
+}
+
+void track_physical_alloc(int size, const char* name, int type, int location)
+{
+    if (!size)
+        return;
+    track_count(track_find_record(name, type, 7), size, location, size > 0 ? 1 : -1, 0);
 }
 
 void track_z_alloc(int size, const char* name, int type, void* pos, int project, int overhead)
 {
-    TempMemInfo* memInfo; // eax
-    int memSize;
-    int extendedSize;
-    mem_track_node_s* memTrack;
+    track_count(track_find_record(name, type, 2), size, 0, 1, overhead);
+}
 
-    Sys_EnterCriticalSection(CRITSECT_MEMTRACK);
-    g_staticsMemTrack[0].size[0] += overhead;
-    g_info.typeTotal[0][0] += overhead;
-    g_info.total[0] += overhead;
-    if (type != 55)
+void track_z_free(int size, const char* name, int type, void* pos, int overhead)
+{
+    track_count(track_find_record(name, type, 2), -size, 0, -1, -overhead);
+}
+
+static track_entry_t* track_store_push(track_store_t* store)
+{
+    int chunk;
+
+    chunk = store->count / TRACK_STORE_CHUNK_SIZE;
+    if (chunk == store->chunkCount)
     {
-        memInfo = GetTempMemInfo(0, name, type, 2, g_mallocMemInfoArray, &g_mallocMemInfoCount, 1);
-        memInfo->data.size[0] += size;
-        memSize = memInfo->data.size[0];
-        ++memInfo->data.count;
-        if (memInfo->high < memSize)
-            memInfo->high = memSize;
-        if (memInfo->hunkSize < 0)
-        {
-            memInfo->hunkSize = 0;
-            memInfo->highExtra = memSize;
-        }
-        extendedSize = size + g_malloc_mem_size;
-        g_malloc_mem_size = extendedSize;
-        if (g_malloc_mem_high < extendedSize)
-            g_malloc_mem_high = extendedSize;
+        if (chunk == TRACK_STORE_MAX_CHUNKS)
+            Com_Error(ERR_FATAL, "track_store_push: more than %i hunk allocations", TRACK_STORE_MAX_CHUNKS * TRACK_STORE_CHUNK_SIZE);
+        store->chunks[chunk] = new track_entry_t[TRACK_STORE_CHUNK_SIZE];
+        ++store->chunkCount;
     }
-    memTrack = (mem_track_node_s*)((char*)pos - 164);
-    strcpy(memTrack->data.name, name);
-    memTrack->data.filename = "";
-    memTrack->data.size[0] = size;
-    memTrack->data.size[1] = 0;
-    memTrack->data.type = type;
-    memTrack->data.usageType = 2;
-    memTrack->next = g_ZMallocMemTrackList;
-    memTrack->prev = 0;
-    memTrack->project = project;
-    if (g_ZMallocMemTrackList)
-        g_ZMallocMemTrackList->prev = memTrack;
-    g_info.typeTotal[type][0] += size;
-    g_info.total[0] += size;
-    g_ZMallocMemTrackList = (mem_track_node_s*)((char*)pos - 164);
+    ++store->count;
+    if (store->high < store->count)
+        store->high = store->count;
+    return &store->chunks[chunk][(store->count - 1) % TRACK_STORE_CHUNK_SIZE];
+}
+
+static track_entry_t* track_store_get(track_store_t* store, int index)
+{
+    return &store->chunks[index / TRACK_STORE_CHUNK_SIZE][index % TRACK_STORE_CHUNK_SIZE];
+}
+
+static void track_store_add(track_store_t* store, int size, int pos, const char* name, int type)
+{
+    track_entry_t* entry;
+    int nameId;
+    int fileId;
+
+    nameId = track_intern_name(name);
+    fileId = g_mem_track_filename && *g_mem_track_filename ? track_intern_name(g_mem_track_filename) + 1 : 0;
+    Sys_EnterCriticalSection(CRITSECT_MEMTRACK);
+    entry = track_store_push(store);
+    entry->nameId = nameId;
+    entry->fileId = fileId;
+    entry->type = type;
+    entry->size = size;
+    entry->pos = pos;
+    Sys_LeaveCriticalSection(CRITSECT_MEMTRACK);
+}
+
+// Both ends pass the end's offset before the allocation, which is what
+// Hunk_SetMark and Hunk_SetMarkLow hand out, so clearing to a mark drops
+// every record at or past it.
+static void track_store_clear(track_store_t* store, int mark)
+{
+    Sys_EnterCriticalSection(CRITSECT_MEMTRACK);
+    while (store->count && track_store_get(store, store->count - 1)->pos >= mark)
+        --store->count;
+    Sys_LeaveCriticalSection(CRITSECT_MEMTRACK);
+}
+
+void track_hunk_alloc(int size, int pos, const char* name, int type)
+{
+    track_store_add(&s_trackHunkHigh, size, pos, name, type);
+}
+
+void track_hunk_allocLow(int size, int pos, const char* name, int type)
+{
+    track_store_add(&s_trackHunkLow, size, pos, name, type);
+}
+
+void track_hunk_ClearToMarkHigh(int mark)
+{
+    track_store_clear(&s_trackHunkHigh, mark);
+}
+
+void track_hunk_ClearToMarkLow(int mark)
+{
+    track_store_clear(&s_trackHunkLow, mark);
+}
+
+void track_hunk_ClearToStart()
+{
+    track_store_clear(&s_trackHunkHigh, 0);
+    track_store_clear(&s_trackHunkLow, 0);
+}
+
+static void track_add_total(int size, int type, int location)
+{
+    g_info.typeTotal[type][location] += size;
+    g_info.total[location] += size;
     switch (type)
     {
         case 0:
@@ -251,9 +412,300 @@ void track_z_alloc(int size, const char* name, int type, void* pos, int project,
             g_info.nonSwapMinSpecTotal += size;
             break;
     }
+}
+
+// Grows the per-record totals to cover every record; new ones start at zero.
+static void track_grow_info(int recordCount)
+{
+    track_info_t* info;
+    int capacity;
+
+    if (recordCount <= s_trackInfoCapacity)
+        return;
+    capacity = s_trackInfoCapacity ? s_trackInfoCapacity : TRACK_SHARD_CHUNK_SIZE;
+    while (capacity < recordCount)
+        capacity *= 2;
+    info = new track_info_t[capacity]();
+    if (s_trackInfo)
+    {
+        memcpy(info, s_trackInfo, s_trackInfoCapacity * sizeof(track_info_t));
+        delete[] s_trackInfo;
+    }
+    s_trackInfo = info;
+    s_trackInfoCapacity = capacity;
+}
+
+// Sums every shard into each record's track_info_t, g_info and
+// g_malloc_mem_size. Highs and lows are as of the calls to this.
+void track_aggregate()
+{
+    track_shard_chunk_t* chunk;
+    track_record_t* record;
+    track_shard_t* shard;
+    track_info_t* info;
+    int recordCount;
+    int shardCount;
+    int overhead;
+    int total;
+    int i;
+    int r;
+
+    Sys_EnterCriticalSection(CRITSECT_MEMTRACK);
+    recordCount = s_trackRecordCount.load(std::memory_order_acquire);
+    track_grow_info(recordCount);
+    for (r = 0; r < recordCount; ++r)
+    {
+        s_trackInfo[r].size[0] = 0;
+        s_trackInfo[r].size[1] = 0;
+        s_trackInfo[r].count = 0;
+    }
+    overhead = 0;
+    shardCount = Sys_GetThreadBlockCount();
+    for (i = -1; i < shardCount; ++i)
+    {
+        shard = i < 0 ? &s_trackSharedShard : s_trackShards[i].load(std::memory_order_acquire);
+        if (!shard)
+            continue;
+        for (r = 0; r < recordCount; ++r)
+        {
+            chunk = shard->chunks[r / TRACK_SHARD_CHUNK_SIZE].load(std::memory_order_acquire);
+            if (!chunk)
+            {
+                r += TRACK_SHARD_CHUNK_SIZE - 1 - r % TRACK_SHARD_CHUNK_SIZE;
+                continue;
+            }
+            info = &s_trackInfo[r];
+            info->size[0] += chunk->size[r % TRACK_SHARD_CHUNK_SIZE][0].load(std::memory_order_relaxed);
+            info->size[1] += chunk->size[r % TRACK_SHARD_CHUNK_SIZE][1].load(std::memory_order_relaxed);
+            info->count += chunk->count[r % TRACK_SHARD_CHUNK_SIZE].load(std::memory_order_relaxed);
+        }
+        overhead += shard->overhead.load(std::memory_order_relaxed);
+    }
+
+    memset(&g_info, 0, sizeof(g_info));
+    g_malloc_mem_size = 0;
+    for (r = 0; r < recordCount; ++r)
+    {
+        record = &s_trackRecords[r];
+        info = &s_trackInfo[r];
+        track_add_total(info->size[0], record->type, 0);
+        track_add_total(info->size[1], record->type, 1);
+        total = info->size[0] + info->size[1];
+        if (r >= s_trackInfoCount)
+        {
+            info->high = total;
+            info->low = total;
+        }
+        if (info->high < total)
+            info->high = total;
+        if (info->low > total)
+            info->low = total;
+        if (record->usageType == 2 && record->type != 55)
+            g_malloc_mem_size += info->size[0];
+    }
+    s_trackInfoCount = recordCount;
+
+    g_info.typeTotal[0][0] += overhead;
+    g_info.total[0] += overhead;
+    if (g_malloc_mem_high < g_malloc_mem_size)
+        g_malloc_mem_high = g_malloc_mem_size;
     Sys_LeaveCriticalSection(CRITSECT_MEMTRACK);
 }
 
-void track_z_free(int type, void* pos, int overhead)
+static void track_print_records(bool malloced)
+{
+    track_record_t* record;
+    track_info_t* info;
+    int recordCount;
+    int r;
+
+    recordCount = s_trackInfoCount;
+    for (r = 0; r < recordCount; ++r)
+    {
+        record = &s_trackRecords[r];
+        if ((record->usageType == 2) != malloced)
+            continue;
+        info = &s_trackInfo[r];
+        Com_Printf(CON_CHANNEL_SYSTEM, "%-32s %4i  %10.1f  %10.1f  %6i\n", s_trackNames[record->nameId], record->type,
+            (info->size[0] + info->size[1]) / 1024.0, info->high / 1024.0, info->count);
+    }
+}
+
+// Hunk records summed by name, high and low ends apart.
+static void track_print_hunk()
 {
+    track_entry_t* entry;
+    track_store_t* store;
+    int (*sizes)[2];
+    int nameCount;
+    int total;
+    int i;
+    int end;
+
+    if (!s_trackHunkHigh.count && !s_trackHunkLow.count)
+        return;
+    nameCount = s_trackNameCount.load(std::memory_order_acquire);
+    sizes = new int[nameCount][2]();
+    total = 0;
+    for (end = 0; end < 2; ++end)
+    {
+        store = end ? &s_trackHunkLow : &s_trackHunkHigh;
+        for (i = 0; i < store->count; ++i)
+        {
+            entry = track_store_get(store, i);
+            sizes[entry->nameId][end] += entry->size;
+            total += entry->size;
+        }
+    }
+    Com_Printf(CON_CHANNEL_SYSTEM, "hunk                              high KB      low KB\n");
+    for (i = 0; i < nameCount; ++i)
+    {
+        if (sizes[i][0] || sizes[i][1])
+            Com_Printf(CON_CHANNEL_SYSTEM, "%-32s %10.1f  %10.1f\n", s_trackNames[i], sizes[i][0] / 1024.0, sizes[i][1] / 1024.0);
+    }
+    Com_Printf(CON_CHANNEL_SYSTEM, "%.1f KB in %i hunk allocations\n", total / 1024.0, s_trackHunkHigh.count + s_trackHunkLow.count);
+    delete[] sizes;
+}
+
+void track_PrintInfo()
+{
+    track_aggregate();
+    Sys_EnterCriticalSection(CRITSECT_MEMTRACK);
+    Com_Printf(CON_CHANNEL_SYSTEM, "name                             type      cur KB     high KB   count\n");
+    track_print_records(false);
+    track_print_records(true);
+    Com_Printf(CON_CHANNEL_SYSTEM, "%.1f KB tracked, %.1f KB from Z_Malloc (%.1f KB high)\n",
+        (g_info.total[0] + g_info.total[1]) / 1024.0, g_malloc_mem_size / 1024.0, g_malloc_mem_high / 1024.0);
+    track_print_hunk();
+    Sys_LeaveCriticalSection(CRITSECT_MEMTRACK);
+}
+
+static int track_pages(size_t bytes)
+{
+    return (int)((bytes + 4095) / 4096);
+}
+
+// hash slots are scattered, so each filled one may be on its own page
+static int track_touched(int filled, size_t bytes)
+{
+    return filled < track_pages(bytes) ? filled : track_pages(bytes);
+}
+
+// What the tracker costs now against the fixed mem_track_t and TempMemInfo
+// tables it used to declare. Untouched static pages cost address space but
+// not memory, so the resident columns count the pages the current contents
+// touch under each layout.
+void track_Footprint_f()
+{
+    size_t legacyStatic;
+    size_t compactStatic;
+    size_t compactHeap;
+    int legacyPages;
+    int compactPages;
+    int nameChunks;
+    int recordCount;
+    int shardCount;
+    int shards;
+    int i;
+
+    legacyStatic = (size_t)(LEGACY_HUNK_TRACK + LEGACY_HUNKLOW_TRACK + LEGACY_STATICS_TRACK + LEGACY_USERHUNK_TRACK) * sizeof(mem_track_t)
+        + (size_t)LEGACY_TEMP_MEM_INFO_ARRAYS * LEGACY_TEMP_MEM_INFO_COUNT * sizeof(TempMemInfo);
+    compactStatic = sizeof(s_trackNameChunks) + sizeof(s_trackNames) + sizeof(s_trackNameIndex) + sizeof(s_trackRecords)
+        + sizeof(s_trackRecordIndex) + sizeof(s_trackShards) + sizeof(s_trackSharedShard) + sizeof(s_trackHunkHigh) + sizeof(s_trackHunkLow);
+
+    Sys_EnterCriticalSection(CRITSECT_MEMTRACK);
+    recordCount = s_trackRecordCount.load(std::memory_order_acquire);
+    shardCount = Sys_GetThreadBlockCount();
+    shards = 0;
+    for (i = 0; i < shardCount; ++i)
+    {
+        if (s_trackShards[i].load(std::memory_order_acquire))
+            ++shards;
+    }
+    {
+        std::lock_guard<std::mutex> lock(s_trackLock);
+        nameChunks = s_trackNameChunkCount;
+    }
+    compactHeap = (size_t)nameChunks * TRACK_NAME_CHUNK_SIZE
+        + (size_t)shards * sizeof(track_shard_t)
+        + (size_t)s_trackShardChunkCount.load(std::memory_order_relaxed) * sizeof(track_shard_chunk_t)
+        + (size_t)(s_trackHunkHigh.chunkCount + s_trackHunkLow.chunkCount) * TRACK_STORE_CHUNK_SIZE * sizeof(track_entry_t)
+        + (size_t)s_trackInfoCapacity * sizeof(track_info_t);
+
+    // the old layout touched one entry per hunk allocation and one
+    // TempMemInfo per record, and touched pages stay resident
+    legacyPages = track_pages((size_t)s_trackHunkHigh.high * sizeof(mem_track_t))
+        + track_pages((size_t)s_trackHunkLow.high * sizeof(mem_track_t))
+        + track_pages(sizeof(mem_track_t))
+        + track_pages((size_t)recordCount * sizeof(TempMemInfo));
+    compactPages = track_pages((size_t)s_trackNameCount.load(std::memory_order_relaxed) * sizeof(const char*))
+        + track_touched(s_trackNameCount.load(std::memory_order_relaxed), sizeof(s_trackNameIndex))
+        + track_pages((size_t)recordCount * sizeof(track_record_t))
+        + track_touched(recordCount, sizeof(s_trackRecordIndex))
+        + track_pages(sizeof(s_trackShards) + sizeof(s_trackSharedShard))
+        + track_pages(compactHeap);
+
+    Com_Printf(CON_CHANNEL_SYSTEM, "%i names, %i records, %i + %i hunk allocations, %i thread shards\n",
+        s_trackNameCount.load(std::memory_order_relaxed), recordCount, s_trackHunkHigh.count, s_trackHunkLow.count, shards);
+    Com_Printf(CON_CHANNEL_SYSTEM, "hunk record %i bytes, was %i\n", (int)sizeof(track_entry_t), (int)sizeof(mem_track_t));
+    Com_Printf(CON_CHANNEL_SYSTEM, "fixed tables: %10.1f KB, were %10.1f KB\n", compactStatic / 1024.0, legacyStatic / 1024.0);
+    Com_Printf(CON_CHANNEL_SYSTEM, "allocated:    %10.1f KB\n", compactHeap / 1024.0);
+    Com_Printf(CON_CHANNEL_SYSTEM, "resident:     %10.1f KB, was %10.1f KB (estimated from pages touched)\n",
+        compactPages * 4.0, legacyPages * 4.0);
+    Sys_LeaveCriticalSection(CRITSECT_MEMTRACK);
+}
+
+#define TRACK_BENCH_THREADS 4
+#define TRACK_BENCH_NAMES 64
+#define TRACK_BENCH_OPS 500000
+
+static char s_trackBenchNames[TRACK_BENCH_NAMES][32];
+
+static void track_bench_thread()
+{
+    unsigned int seed;
+    const char* name;
+    int i;
+
+    Sys_RegisterThread(THREAD_CONTEXT_COUNT);
+    seed = 12345;
+    for (i = 0; i < TRACK_BENCH_OPS; ++i)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        name = s_trackBenchNames[(seed >> 16) % TRACK_BENCH_NAMES];
+        track_z_alloc(64, name, TRACK_DEBUG, 0, 0, 16);
+        track_z_free(64, name, TRACK_DEBUG, 0, 16);
+    }
+    Sys_UnregisterThread();
+}
+
+// Tracked alloc/free pairs per second over a spread of names, on 1, 2 and
+// 4 threads at once, then how long a full aggregate takes.
+void track_Benchmark_f()
+{
+    std::thread threads[TRACK_BENCH_THREADS];
+    std::chrono::steady_clock::time_point start;
+    double seconds;
+    int threadCount;
+    int i;
+
+    for (i = 0; i < TRACK_BENCH_NAMES; ++i)
+        Com_sprintf(s_trackBenchNames[i], sizeof(s_trackBenchNames[i]), "track_Benchmark_f %i", i);
+    for (threadCount = 1; threadCount <= TRACK_BENCH_THREADS; threadCount *= 2)
+    {
+        start = std::chrono::steady_clock::now();
+        for (i = 0; i < threadCount; ++i)
+            threads[i] = std::thread(track_bench_thread);
+        for (i = 0; i < threadCount; ++i)
+            threads[i].join();
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        Com_Printf(CON_CHANNEL_SYSTEM, "%d thread%s: %6.1f M tracked pairs/s, %5.1f ns per pair per thread\n", threadCount, threadCount == 1 ? " " : "s",
+            threadCount * (double)TRACK_BENCH_OPS / seconds / 1e6, seconds * 1e9 / TRACK_BENCH_OPS);
+    }
+
+    start = std::chrono::steady_clock::now();
+    track_aggregate();
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    Com_Printf(CON_CHANNEL_SYSTEM, "aggregating %i records from %i threads took %.3f ms\n",
+        s_trackRecordCount.load(), Sys_GetThreadBlockCount(), seconds * 1000.0);
 }
@@ -99,14 +99,6 @@ typedef struct mem_track_t
 	int count;
 } mem_track_t;
 
-struct mem_track_node_s
-{
-	mem_track_t data;
-	int project;
-	mem_track_node_s* prev;
-	mem_track_node_s* next;
-};
-
 struct TempMemInfo
 {
 	int permanent;
@@ -117,23 +109,73 @@ struct TempMemInfo
 	mem_track_t data;
 };
 
-meminfo_t g_info;
-meminfo_t g_virtualMemInfo;
-TempMemInfo g_mallocMemInfoArray[1500];
-int g_mallocMemInfoCount;
-int g_malloc_mem_high;
-int g_malloc_mem_size;
-mem_track_t g_staticsMemTrack[2048];
-mem_track_node_s* g_ZMallocMemTrackList;
+extern meminfo_t g_info;
+extern meminfo_t g_virtualMemInfo;
+extern int g_malloc_mem_high;
+extern int g_malloc_mem_size;
+extern const char* g_mem_track_filename;
 
-bool inited_0;
+extern bool inited_0;
 const char aInternal[] = "internal";
 
-TempMemInfo* GetTempMemInfo(int permanent, const char* name, int type, int usageType, TempMemInfo* tempMemInfoArray, int* tempMemInfoCount, bool add_if_missing);
+// Names are interned once; every (name, type, usage) gets a record, and each
+// thread counts into its own shard of record totals. The globals above are
+// only brought up to date by track_aggregate.
+#define TRACK_MAX_NAMES 4096
+#define TRACK_NAME_POOL_SIZE (256 * 1024)
+#define TRACK_NAME_CHUNK_SIZE (16 * 1024)
+#define TRACK_MAX_RECORDS 4096
+#define TRACK_CACHE_SIZE 64
+
+// Shards, the name pool and the hunk records all grow in chunks as they are
+// first needed, so an idle tracker costs a few pages instead of the worst
+// level's worth of fixed tables.
+#define TRACK_SHARD_CHUNK_SIZE 256
+#define TRACK_STORE_CHUNK_SIZE 4096
+#define TRACK_STORE_MAX_CHUNKS 256
+
+typedef struct track_record_t
+{
+	unsigned short nameId;
+	char type;
+	char usageType;
+} track_record_t;
+
+// One hunk allocation. Names and source files are interned ids; fileId is 0
+// when g_mem_track_filename wasn't set, otherwise the name id plus one.
+typedef struct track_entry_t
+{
+	unsigned short nameId;
+	unsigned short fileId;
+	char type;
+	int size;
+	int pos;
+} track_entry_t;
+
+// A record's totals as of the last track_aggregate, and its high and low
+// since the first one that saw it.
+typedef struct track_info_t
+{
+	int size[2];
+	int count;
+	int high;
+	int low;
+} track_info_t;
 
 void track_init();
 void track_physical_alloc(int size, const char* name, int type, int location);
 void track_z_alloc(int size, const char* name, int type, void* pos, int project, int overhead);
-void track_z_free(int type, void* pos, int overhead);
+void track_z_free(int size, const char* name, int type, void* pos, int overhead);
+void track_hunk_alloc(int size, int pos, const char* name, int type);
+void track_hunk_allocLow(int size, int pos, const char* name, int type);
+void track_hunk_ClearToMarkHigh(int mark);
+void track_hunk_ClearToMarkLow(int mark);
+void track_hunk_ClearToStart();
+int track_intern_name(const char* name);
+const char* track_get_name(int nameId);
+void track_aggregate();
+void track_PrintInfo();
+void track_Footprint_f();
+void track_Benchmark_f();
 
 #endif
\ No newline at end of file
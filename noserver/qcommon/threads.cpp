@@ -15,56 +15,48 @@
  */
 
 #include "threads.h"
+#include "threads_budget.h"
+#include "threads_coro.h"
+#include "threads_jobs.h"
+#include "threads_load.h"
+#include "threads_profile.h"
+#include "threads_registry.h"
+#include "threads_ring.h"
+#include "threads_stream.h"
+#include "threads_timer.h"
+#include "threads_topology.h"
+#include "threads_wait.h"
 #include <universal/q_shared.h>
 #include <gfx_d3d/r_pix_profile.h>
 
 #include <windows.h>
+#include <thread>
 
 #define MS_VC_EXCEPTION 0x406D1388
 
-enum
-{
-	THREAD_CONTEXT_MAIN = 0x0,
-	THREAD_CONTEXT_BACKEND = 0x1,
-	THREAD_CONTEXT_WORKER0 = 0x2,
-	THREAD_CONTEXT_WORKER1 = 0x3,
-	THREAD_CONTEXT_WORKER2 = 0x4,
-	THREAD_CONTEXT_WORKER3 = 0x5,
-	THREAD_CONTEXT_WORKER4 = 0x6,
-	THREAD_CONTEXT_WORKER5 = 0x7,
-	THREAD_CONTEXT_WORKER6 = 0x8,
-	THREAD_CONTEXT_WORKER7 = 0x9,
-	THREAD_CONTEXT_SERVER = 0xA,
-	THREAD_CONTEXT_TITLE_SERVER = 0xB,
-	THREAD_CONTEXT_DATABASE = 0xC,
-	THREAD_CONTEXT_TRACE_COUNT = 0xD,
-	THREAD_CONTEXT_TRACE_LAST = 0xC,
-	THREAD_CONTEXT_STREAM = 0xD,
-	THREAD_CONTEXT_SOUND_MIX = 0xE,
-	THREAD_CONTEXT_SOUND_DECODE = 0xF,
-	THREAD_CONTEXT_WEBM_DEC_DECODE = 0x10,
-	THREAD_CONTEXT_COUNT = 0x11,
-	THREAD_CONTEXT_INVALID = 0xFFFFFFFF,
-};
+// reads kept in flight by the load pipeline, decompression overlaps on other workers
+#define LOAD_READS_IN_FLIGHT 2
+// stream I/O threads started next to the stream thread, enough to keep an
+// NVMe queue busy
+#define STREAM_IO_THREADS 2
 
-__declspec(thread) void** g_dwTlsIndex;
 __declspec(thread) unsigned int g_currentThreadId;
+__declspec(thread) int g_currentThreadContext = THREAD_CONTEXT_COUNT;
+// threads past the fixed contexts name themselves here
+__declspec(thread) char g_currentThreadName[32];
 #pragma comment (linker, "/INCLUDE:__tls_used")
 #pragma data_seg(".CRT$XLB")
 #pragma data_seg()
 
 unsigned int s_cpuCount;
-unsigned int s_affinityMaskForProcess;
-unsigned int s_affinityMaskForCpu[8];
 
 void* webmStreamingReady;
 void* backendEvent[2];
-void* g_threadValues[17][5];
 void* threadHandle[17];
 unsigned int threadId[17];
 void(*threadFunc[17])(unsigned int);
 
-static HANDLE allowServerNetworkEvent, databaseCompletedEvent, databaseCompletedEvent2, demoStreamingReady, d3dShutdownEvent, gumpFlushedEvent, gumpLoadedEvent, renderCompletedEvent, renderEvent, rendererRunningEvent, resumedDatabaseEvent, rgRegisteredEvent, serverCompletedEvent, serverNetworkCompletedEvent, sndInitializedEvent, streamCompletedEvent, streamDatabasePausedReading, streamEvent, wakeDatabaseEvent, wakeServerEvent, win32QuitEvent;
+static SysEvent allowServerNetworkEvent, databaseCompletedEvent, databaseCompletedEvent2, demoStreamingReady, d3dShutdownEvent, gumpFlushedEvent, gumpLoadedEvent, renderCompletedEvent, renderEvent, resumedDatabaseEvent, rgRegisteredEvent, serverCompletedEvent, serverNetworkCompletedEvent, sndInitializedEvent, streamCompletedEvent, streamDatabasePausedReading, streamEvent, wakeDatabaseEvent, wakeServerEvent, win32QuitEvent;
 
 const char* s_threadNames[17] = { "Main", "Backend", "Worker0", "Worker1", "Worker2", "Worker3", "Worker4", "Worker5", "Worker6", "Worker7", "Server", "TitleServer", "Database", "Sound Mix", "Sound Decode", "WebM Decode" };
 
@@ -73,6 +65,7 @@ unsigned int g_networkOverrideThread;
 bool g_supress_db_prints;
 bool g_gump_load_in_progress;
 void* volatile smpData;
+static SysFrameRing s_rendererFrames;
 
 enum BackendEventType {
 	BACKEND_EVENT_WORKER_CMD = 0x0,
@@ -108,10 +101,14 @@ void SetThreadName(unsigned int dwThreadID, char const* szThreadName)
 #pragma warning(pop)
 }
 
-void Sys_Sleep(int)
+// Plain sleeps; only the *Until waits spin out the scheduler's slack.
+void Sys_Sleep(int msec)
 {
+	if (msec > 0)
+		Sleep(msec);
 }
 
+// Sleep(0) gives up the rest of the time slice
 void NET_Sleep(unsigned int timeInMs)
 {
 	Sleep(timeInMs);
@@ -119,39 +116,36 @@ void NET_Sleep(unsigned int timeInMs)
 
 void Sys_SetEvent(void** event)
 {
-	SetEvent(*event);
+	if (*event)
+		Sys_SignalEvent((SysEvent*)*event);
 }
 
 void Sys_ResetEvent(void** event)
 {
-	ResetEvent(*event);
+	if (*event)
+		Sys_ClearEvent((SysEvent*)*event);
 }
 
 void Sys_CreateEvent(int manualReset, int initialState, void** evt)
 {
-	HANDLE evtHandle; // eax
+	SysEvent* event;
 
-	evtHandle = CreateEventA(0, manualReset, initialState, 0);
-	if (evtHandle)
-	{
-		*evt = evtHandle;
-	}
-	else
-	{
-		DWORD lastErr = GetLastError();
-		//Com_Printf(1, "error %d while creating event\n", v4);
-		*evt = 0;
-	}
+	event = new SysEvent;
+	Sys_InitEvent(event, manualReset, initialState);
+	*evt = event;
 }
 
 int Sys_WaitForSingleObjectTimeout(void** event, unsigned int msec)
 {
-	return WaitForSingleObject(*event, msec) == 0;
+	if (!*event)
+		return 0;
+	return Sys_WaitEvent((SysEvent*)*event, msec);
 }
 
 void Sys_WaitForSingleObject(void** event)
 {
-	WaitForSingleObject(*event, 0xFFFFFFFF);
+	if (*event)
+		Sys_WaitEvent((SysEvent*)*event, SYS_WAIT_INFINITE);
 }
 
 unsigned int Sys_GetCpuCount(void)
@@ -161,64 +155,8 @@ unsigned int Sys_GetCpuCount(void)
 
 void Win_InitThreads(void)
 {
-	unsigned int cpuCount;
-	unsigned int systemAffinityMask;
-	unsigned int threadAffinityMask;
-	unsigned int affinityMaskBits[32];
-	unsigned int processAffinityMask;
-
-	GetProcessAffinityMask(GetCurrentProcess(), (PDWORD_PTR)&processAffinityMask, (PDWORD_PTR)&systemAffinityMask);
-	s_affinityMaskForProcess = processAffinityMask;
-	cpuCount = 0;
-	for (threadAffinityMask = 1; processAffinityMask & -threadAffinityMask; threadAffinityMask *= 2)
-	{
-		if (processAffinityMask & threadAffinityMask)
-		{
-			affinityMaskBits[cpuCount++] = threadAffinityMask;
-			if (cpuCount == 32)
-			{
-				break;
-			}
-		}
-	}
-	if (cpuCount && cpuCount != 1)
-	{
-		s_cpuCount = cpuCount;
-		s_affinityMaskForCpu[0] = affinityMaskBits[0];
-		s_affinityMaskForCpu[1] = affinityMaskBits[s_cpuCount];
-		if (cpuCount != 2)
-		{
-			if (cpuCount == 3)
-			{
-				s_affinityMaskForCpu[2] = affinityMaskBits[1];
-			}
-			else if (cpuCount == 4)
-			{
-				s_affinityMaskForCpu[2] = affinityMaskBits[1];
-				s_affinityMaskForCpu[3] = affinityMaskBits[2];
-			}
-			else
-			{
-				s_affinityMaskForCpu[0] = -1;
-				s_affinityMaskForCpu[1] = -1;
-				s_affinityMaskForCpu[2] = -1;
-				s_affinityMaskForCpu[3] = -1;
-				s_affinityMaskForCpu[4] = -1;
-				s_affinityMaskForCpu[5] = -1;
-				s_affinityMaskForCpu[6] = -1;
-				s_affinityMaskForCpu[7] = -1;
-				if (s_cpuCount >= 8)
-				{
-					s_cpuCount = 8;
-				}
-			}
-		}
-	}
-	else
-	{
-		s_cpuCount = 1;
-		s_affinityMaskForCpu[0] = -1;
-	}
+	Sys_InitCpuTopology();
+	s_cpuCount = Sys_GetLogicalCpuCount();
 }
 
 void Sys_InitMainThread(void)
@@ -228,15 +166,19 @@ void Sys_InitMainThread(void)
 		g_currentThreadId = GetCurrentThreadId();
 	}
 	threadId[0] = g_currentThreadId;
+	g_currentThreadContext = THREAD_CONTEXT_MAIN;
+	Sys_InitFrameRing(&s_rendererFrames, SYS_FRAME_RING_MIN_DEPTH);
 	DuplicateHandle(GetCurrentProcess(), GetCurrentThread(), GetCurrentProcess(), threadHandle, 0, 0, 2u);
 	Win_InitThreads();
-	*g_dwTlsIndex = g_threadValues;
 	Com_InitThreadData(0);
+	// after the topology is known; pins the main thread before any other thread starts
+	Sys_RegisterAffinityDvars();
+	Sys_RegisterServerBudgetDvars();
 }
 
 void Sys_InitThread(int threadContext)
 {
-	*g_dwTlsIndex = g_threadValues[threadContext];
+	g_currentThreadContext = threadContext;
 	Com_InitThreadData(threadContext);
 }
 
@@ -244,8 +186,9 @@ unsigned long Sys_ThreadMain(void* parameter)
 {
 	unsigned int threadContext = (unsigned int)parameter;
 
+	g_currentThreadContext = threadContext;
 	SetThreadName(0xFFFFFFFF, s_threadNames[threadContext]);
-	*g_dwTlsIndex = g_threadValues[threadContext];
+	Sys_ApplyThreadAffinity(threadContext, 0);
 	Com_InitThreadData(threadContext);
 	threadFunc[threadContext](threadContext);
 	return 0;
@@ -257,7 +200,7 @@ void Sys_CreateThread(unsigned int threadContext, void(__cdecl* function)(unsign
 	DWORD lastError;
 
 	threadFunc[threadContext] = function;
-	newThread = CreateThread(0, 0, (LPTHREAD_START_ROUTINE)Sys_ThreadMain, (LPVOID)threadContext, 4u, (LPDWORD)(4 * threadContext + 125788032));
+	newThread = CreateThread(0, 0, (LPTHREAD_START_ROUTINE)Sys_ThreadMain, (LPVOID)threadContext, 4u, (LPDWORD)&threadId[threadContext]);
 	threadHandle[threadContext] = newThread;
 
 	if (!threadHandle[threadContext])
@@ -272,61 +215,79 @@ void Sys_TitleServerThreadData(void)
 {
 	if (!g_currentThreadId)
 		g_currentThreadId = GetCurrentThreadId();
+	g_currentThreadContext = THREAD_CONTEXT_TITLE_SERVER;
 	Com_InitThreadData(THREAD_CONTEXT_TITLE_SERVER);
 }
 
 void Sys_InitDemoStreamingEvent(void)
 {
-	HANDLE event = CreateEventA(0, 0, 0, 0);
-
-	if (!event) {
-		//Com_Printf(1, "error %d while creating event\n", GetLastError());
-	}
-	demoStreamingReady = event;
+	Sys_InitEvent(&demoStreamingReady, 0, 0);
 }
 
 void Sys_WaitForDemoStreamingEvent(void)
 {
-	WaitForSingleObject(demoStreamingReady, -1);
+	Sys_WaitEvent(&demoStreamingReady, SYS_WAIT_INFINITE);
 }
 
 int Sys_WaitForDemoStreamingEventTimeout(unsigned int msec)
 {
-	return WaitForSingleObject(demoStreamingReady, msec);
+	// keeps the WaitForSingleObject return convention callers test against
+	return Sys_WaitEvent(&demoStreamingReady, msec) ? WAIT_OBJECT_0 : WAIT_TIMEOUT;
+}
+
+SysCoroWait Sys_AwaitDemoStreaming(unsigned int msec)
+{
+	return Sys_AwaitEvent(&demoStreamingReady, msec);
 }
 
 void Sys_SetDemoStreamingEvent(void)
 {
-	SetEvent(demoStreamingReady);
+	Sys_SignalEvent(&demoStreamingReady);
 }
 
 void Sys_InitWebMStreamingEvent(void)
 {
-	HANDLE event = CreateEventA(0, 0, 0, 0);
-
-	if (!event) {
-		//Com_Printf(1, "error %d while creating event\n", GetLastError());
-	}
-	webmStreamingReady = event;
+	Sys_CreateEvent(0, 0, &webmStreamingReady);
 }
 
 void Sys_InitServerEvents(void)
 {
-	ResetEvent(wakeServerEvent);
-	ResetEvent(serverCompletedEvent);
-	SetEvent(allowServerNetworkEvent);
-	SetEvent(serverNetworkCompletedEvent);
+	Sys_ClearEvent(&wakeServerEvent);
+	Sys_ClearEvent(&serverCompletedEvent);
+	Sys_SignalEvent(&allowServerNetworkEvent);
+	Sys_SignalEvent(&serverNetworkCompletedEvent);
 	g_networkOverrideThread = 0;
 }
 
 void Sys_NotifyRenderer(void)
 {
-	SetEvent(backendEvent[1]);
+	Sys_SetEvent(&backendEvent[1]);
 }
 
 int Sys_WaitServer(int timeout)
 {
-	return WaitForSingleObject(serverCompletedEvent, timeout) == 0;
+	unsigned long long start;
+	int result;
+
+	SYS_PROFILE_SCOPE("Sys_WaitServer");
+	start = Sys_IsServerBudgetEnabled() ? Sys_NanoTime() : 0;
+	result = Sys_WaitEvent(&serverCompletedEvent, timeout);
+	Sys_BudgetServerWait(start);
+	return result;
+}
+
+// Like Sys_WaitServer, against an absolute Sys_NanoTime deadline so a tick
+// loop does not accumulate the rounding of millisecond timeouts.
+int Sys_WaitServerUntil(unsigned long long deadlineNsec)
+{
+	unsigned long long start;
+	int result;
+
+	SYS_PROFILE_SCOPE("Sys_WaitServerUntil");
+	start = Sys_IsServerBudgetEnabled() ? Sys_NanoTime() : 0;
+	result = Sys_WaitEventUntil(&serverCompletedEvent, deadlineNsec);
+	Sys_BudgetServerWait(start);
+	return result;
 }
 
 bool Sys_IsDBPrintingSuppressed(void)
@@ -347,255 +308,254 @@ int Sys_IsLoadingGump(void)
 
 int Sys_WaitForGumpLoad(int timeout)
 {
-	return WaitForSingleObject(gumpLoadedEvent, timeout) == 0;
+	return Sys_WaitEvent(&gumpLoadedEvent, timeout);
 }
 
 int Sys_WaitForGumpFlush(int timeout)
 {
-	return WaitForSingleObject(gumpFlushedEvent, timeout) == 0;
+	return Sys_WaitEvent(&gumpFlushedEvent, timeout);
+}
+
+SysCoroWait Sys_AwaitGumpLoad(unsigned int msec)
+{
+	return Sys_AwaitEvent(&gumpLoadedEvent, msec);
+}
+
+SysCoroWait Sys_AwaitGumpFlush(unsigned int msec)
+{
+	return Sys_AwaitEvent(&gumpFlushedEvent, msec);
 }
 
 void Sys_WakeServer(void)
 {
-	SetEvent(wakeServerEvent);
+	Sys_SignalEvent(&wakeServerEvent);
 }
 
 void Sys_ServerCompleted(void)
 {
-	SetEvent(serverCompletedEvent);
+	Sys_BudgetServerTickEnd();
+	Sys_SignalEvent(&serverCompletedEvent);
+}
+
+static int Sys_OnServerStarted(void)
+{
+	Sys_ClearEvent(&serverCompletedEvent);
+	Sys_BudgetServerTickBegin();
+	return !g_databaseStopServer;
 }
 
 int Sys_WaitStartServer(int timeout)
 {
-	DWORD eventReturn = WaitForSingleObject(wakeServerEvent, timeout);
-	bool isWaiting = eventReturn == 0;
-	if (!eventReturn)
-		ResetEvent(serverCompletedEvent);
-	if (g_databaseStopServer)
-		return 0;
-	else
-		return isWaiting;
+	bool isWaiting = Sys_WaitEvent(&wakeServerEvent, timeout);
+	if (isWaiting)
+		return Sys_OnServerStarted();
+	return 0;
+}
+
+SysCoroWait Sys_AwaitStartServer(unsigned int msec)
+{
+	SysCoroWait wait = Sys_AwaitEvent(&wakeServerEvent, msec);
+	wait.onSignaled = Sys_OnServerStarted;
+	return wait;
 }
 
 bool Sys_IsServerThread(void)
 {
-	if (!g_currentThreadId)
-		g_currentThreadId = GetCurrentThreadId();
-	return g_currentThreadId == threadId[THREAD_CONTEXT_SERVER];
+	return g_currentThreadContext == THREAD_CONTEXT_SERVER;
 }
 
 void Sys_DatabaseCompleted(void)
 {
 	g_databaseStopServer = 1;
-	if (serverCompletedEvent)
-	{
-		DWORD eventReturn = WaitForSingleObject(serverCompletedEvent, -1);
-		if (eventReturn)
-		{
-			//Assert
-		}
-	}
-	SetEvent(databaseCompletedEvent);
+	if (threadHandle[THREAD_CONTEXT_SERVER])
+		Sys_WaitEvent(&serverCompletedEvent, SYS_WAIT_INFINITE);
+	Sys_SignalEvent(&databaseCompletedEvent);
+	Sys_WakeLoadWaiters();
 }
 
 void Sys_WaitStartDatabase(void)
 {
-	WaitForSingleObject(wakeDatabaseEvent, 0xFFFFFFFF);
+	Sys_WaitEvent(&wakeDatabaseEvent, SYS_WAIT_INFINITE);
 }
 
 int Sys_IsDatabaseReady(void)
 {
-	return WaitForSingleObject(databaseCompletedEvent, 0) == 0;
+	return Sys_WaitEvent(&databaseCompletedEvent, 0);
 }
 
 void Sys_WakeDatabase(void)
 {
-	ResetEvent(databaseCompletedEvent);
+	Sys_ClearEvent(&databaseCompletedEvent);
 }
 
 void Sys_NotifyDatabase(void)
 {
-	SetEvent(wakeDatabaseEvent);
+	Sys_SignalEvent(&wakeDatabaseEvent);
 }
 
 void Sys_DatabaseCompleted2(void)
 {
 	g_databaseStopServer = 0;
-	SetEvent(databaseCompletedEvent2);
+	Sys_SignalEvent(&databaseCompletedEvent2);
 }
 
 int Sys_IsDatabaseReady2(void)
 {
-	return WaitForSingleObject(databaseCompletedEvent2, 0) == 0;
+	return Sys_WaitEvent(&databaseCompletedEvent2, 0);
 }
 
 void Sys_WakeDatabase2(void)
 {
-	ResetEvent(databaseCompletedEvent2);
+	Sys_ClearEvent(&databaseCompletedEvent2);
 }
 
 bool Sys_IsRenderThread(void)
 {
-	if (!g_currentThreadId)
-		g_currentThreadId = GetCurrentThreadId();
-	return g_currentThreadId == threadId[THREAD_CONTEXT_BACKEND];
+	return g_currentThreadContext == THREAD_CONTEXT_BACKEND;
 }
 
 bool _Sys_IsDatabaseThread()
 {
-	if (!g_currentThreadId)
-		g_currentThreadId = GetCurrentThreadId();
-	return g_currentThreadId == threadId[THREAD_CONTEXT_DATABASE];
+	return g_currentThreadContext == THREAD_CONTEXT_DATABASE;
 }
 
 bool Sys_IsMainThread(void)
 {
-	if (!g_currentThreadId)
-		g_currentThreadId = GetCurrentThreadId();
-	return g_currentThreadId == threadId[THREAD_CONTEXT_MAIN];
+	return g_currentThreadContext == THREAD_CONTEXT_MAIN;
 }
 
 int Sys_GetThreadContext(void)
 {
-	if (!g_currentThreadId)
-		g_currentThreadId = GetCurrentThreadId();
-	for (int i = 0; i < 17; ++i)
-	{
-		if (threadId[i] == g_currentThreadId)
-			return i;
-	}
-	//Com_Printf(1, "Current thread is not in thread table\n");
-	return 17;
+	// THREAD_CONTEXT_COUNT until the thread has been given a context
+	return g_currentThreadContext;
 }
 
 void Sys_SetValue(int valueIndex, void* data)
 {
-	g_dwTlsIndex[valueIndex] = data;
+	g_threadBlock->values[valueIndex] = data;
 }
 
 void* Sys_GetValue(int valueIndex)
 {
-	return g_dwTlsIndex[valueIndex];
+	return g_threadBlock->values[valueIndex];
 }
 
 void Sys_SetWin32QuitEvent(void)
 {
-	SetEvent(win32QuitEvent);
+	Sys_SignalEvent(&win32QuitEvent);
 }
 
 int Sys_QueryWin32QuitEvent(void)
 {
-	return WaitForSingleObject(win32QuitEvent, 0) == 0;
+	return Sys_WaitEvent(&win32QuitEvent, 0);
 }
 
 void Sys_SetRGRegisteredEvent(void)
 {
-	SetEvent(rgRegisteredEvent);
+	Sys_SignalEvent(&rgRegisteredEvent);
 }
 
 int Sys_QueryRGRegisteredEvent(void)
 {
-	return WaitForSingleObject(rgRegisteredEvent, 0) == 0;
+	return Sys_WaitEvent(&rgRegisteredEvent, 0);
 }
 
 void Sys_SetRenderEvent(void)
 {
-	SetEvent(renderEvent);
+	Sys_SignalEvent(&renderEvent);
 }
 
 void Sys_SetD3DShutdownEvent(void)
 {
-	SetEvent(d3dShutdownEvent);
+	Sys_SignalEvent(&d3dShutdownEvent);
 }
 
 int Sys_QueryD3DShutdownEvent(void)
 {
-	return WaitForSingleObject(d3dShutdownEvent, 0) == 0;
+	return Sys_WaitEvent(&d3dShutdownEvent, 0);
 }
 
 bool Sys_SpawnStreamThread(void(*function)(unsigned int))
 {
-	HANDLE m_sndInitializedEvent, m_streamCompletedEvent, m_streamDatabaseEventPausedReading, m_streamEvent;
-
-	m_sndInitializedEvent = CreateEventA(0, 1, 0, 0);
-	if (!m_sndInitializedEvent)
-	{
-		//Com_Printf(1, "error %d while creating event\n", GetLastError());
-	}
-	sndInitializedEvent = m_sndInitializedEvent;
-	m_streamCompletedEvent = CreateEventA(0, 1, 0, 0);
-	if (!m_streamCompletedEvent)
-	{
-		//Com_Printf(1, "error %d while creating event\n", GetLastError());
-	}
-	streamCompletedEvent = m_streamCompletedEvent;
-	m_streamDatabaseEventPausedReading = CreateEventA(0, 1, 0, 0);
-	if (!m_streamDatabaseEventPausedReading)
-	{
-		//Com_Printf(1, "error %d while creating event\n", GetLastError());
-	}
-	streamDatabasePausedReading = m_streamDatabaseEventPausedReading;
-	m_streamEvent = CreateEventA(0, 0, 0, 0);
-	if (!m_streamEvent)
-	{
-		//Com_Printf(1, "error %d while creating event\n", GetLastError());
-	}
-	streamEvent = m_streamEvent;
+	Sys_InitEvent(&sndInitializedEvent, 1, 0);
+	Sys_InitEvent(&streamCompletedEvent, 1, 0);
+	Sys_InitEvent(&streamDatabasePausedReading, 1, 0);
+	Sys_InitEvent(&streamEvent, 0, 0);
 	Sys_CreateThread(THREAD_CONTEXT_STREAM, function);
 	if (!threadHandle[THREAD_CONTEXT_STREAM])
 		return 0;
 	ResumeThread(threadHandle[THREAD_CONTEXT_STREAM]);
+	Sys_InitStreamThreads(STREAM_IO_THREADS);
 	return 1;
 }
 
+void Sys_InitStreamWorkerThread(int streamIndex)
+{
+	if (!g_currentThreadId)
+		g_currentThreadId = GetCurrentThreadId();
+	// shares the stream context, threadHandle and threadId stay the stream thread's
+	g_currentThreadContext = THREAD_CONTEXT_STREAM;
+	Com_sprintf(g_currentThreadName, sizeof(g_currentThreadName), "Stream%d", streamIndex);
+	SetThreadName(0xFFFFFFFF, g_currentThreadName);
+	Sys_ApplyThreadAffinity(THREAD_CONTEXT_STREAM, 0);
+	Com_InitThreadData(THREAD_CONTEXT_STREAM);
+}
+
+void Sys_ShutdownStreamWorkerThread(void)
+{
+	Sys_UnregisterThread();
+}
+
 void Sys_StreamSleep(void)
 {
-	SetEvent(streamCompletedEvent);
-	SetEvent(streamDatabasePausedReading);
-	DWORD eventReturn = WaitForSingleObject(streamEvent, 0xFFFFFFFF);
-	ResetEvent(streamCompletedEvent);
-	ResetEvent(streamDatabasePausedReading);
+	Sys_SignalEvent(&streamCompletedEvent);
+	Sys_SignalEvent(&streamDatabasePausedReading);
+	Sys_WaitEvent(&streamEvent, SYS_WAIT_INFINITE);
+	Sys_ClearEvent(&streamCompletedEvent);
+	Sys_ClearEvent(&streamDatabasePausedReading);
 }
 
 void Sys_ResetSndInitializedEvent(void)
 {
-	ResetEvent(sndInitializedEvent);
+	Sys_ClearEvent(&sndInitializedEvent);
 }
 
 int Sys_QueryStreamPaused(void)
 {
-	return WaitForSingleObject(streamDatabasePausedReading, 1u) == 0;
+	return Sys_WaitEvent(&streamDatabasePausedReading, 1u);
+}
+
+SysCoroWait Sys_AwaitStreamPaused(unsigned int msec)
+{
+	return Sys_AwaitEvent(&streamDatabasePausedReading, msec);
 }
 
 void Sys_WakeStream(void)
 {
-	SetEvent(streamEvent);
+	Sys_SignalEvent(&streamEvent);
 }
 
 bool Sys_IsStreamThread(void)
 {
-	if (!g_currentThreadId)
-		g_currentThreadId = GetCurrentThreadId();
-	return g_currentThreadId == threadId[THREAD_CONTEXT_STREAM];
+	return g_currentThreadContext == THREAD_CONTEXT_STREAM;
 }
 
 void Sys_SetServerAllowNetworkEvent(void)
 {
-	SetEvent(allowServerNetworkEvent);
+	Sys_SignalEvent(&allowServerNetworkEvent);
 }
 
 void Sys_ResetServerAllowNetworkEvent(void)
 {
-	ResetEvent(allowServerNetworkEvent);
+	Sys_ClearEvent(&allowServerNetworkEvent);
 }
 
 void Sys_SetServerNetworkCompletedEvent(void)
 {
 	//Sys_EnterCriticalSection(CRITSECT_NETTHREAD_OVERRIDE);
-	if (!g_currentThreadId)
-		g_currentThreadId = GetCurrentThreadId();
 	g_networkOverrideThread = 0;
-	SetEvent(serverNetworkCompletedEvent);
+	Sys_BudgetNetworkEnd();
+	Sys_SignalEvent(&serverNetworkCompletedEvent);
 	//Sys_LeaveCriticalSection(CRITSECT_NETTHREAD_OVERRIDE);
 }
 
@@ -605,34 +565,41 @@ void Sys_ResetServerNetworkCompletedEvent(void)
 	if (!g_currentThreadId)
 		g_currentThreadId = GetCurrentThreadId();
 	g_networkOverrideThread = g_currentThreadId;
-	ResetEvent(serverNetworkCompletedEvent);
+	Sys_BudgetNetworkBegin();
+	Sys_ClearEvent(&serverNetworkCompletedEvent);
 	//Sys_LeaveCriticalSection(CRITSECT_NETTHREAD_OVERRIDE);
 }
 
 void Sys_WaitServerNetworkCompleted(void)
 {
-	if (!g_currentThreadId)
-		g_currentThreadId = GetCurrentThreadId();
-	WaitForSingleObject(serverNetworkCompletedEvent, -1);
+	unsigned long long start;
+
+	SYS_PROFILE_SCOPE("Sys_WaitServerNetworkCompleted");
+	start = Sys_IsServerBudgetEnabled() ? Sys_NanoTime() : 0;
+	Sys_WaitEvent(&serverNetworkCompletedEvent, SYS_WAIT_INFINITE);
+	Sys_BudgetServerWait(start);
 }
 
 unsigned int Sys_GetDefaultWorkerThreadsCount(void)
 {
-	if (s_cpuCount <= 2)
+	unsigned int cpuCount;
+
+	cpuCount = s_cpuCount;
+	if (cpuCount <= 2)
 		return 1;
-	if (s_cpuCount <= 4)
+	if (cpuCount <= 4)
 		return 2;
-	if (s_cpuCount > 10)
-		return 8;
-	return s_cpuCount - 2;
+	if (cpuCount - 2 >= MAX_JOB_WORKERS)
+		return MAX_JOB_WORKERS - 1;
+	return cpuCount - 2;
 }
 
 bool Sys_SpawnServerThread(void(*function)(unsigned int))
 {
-	Sys_CreateEvent(1, 0, &wakeServerEvent);
-	Sys_CreateEvent(1, 0, &serverCompletedEvent);
-	Sys_CreateEvent(1, 1, &allowServerNetworkEvent);
-	Sys_CreateEvent(1, 1, &serverNetworkCompletedEvent);
+	Sys_InitEvent(&wakeServerEvent, 1, 0);
+	Sys_InitEvent(&serverCompletedEvent, 1, 0);
+	Sys_InitEvent(&allowServerNetworkEvent, 1, 1);
+	Sys_InitEvent(&serverNetworkCompletedEvent, 1, 1);
 	Sys_CreateThread(THREAD_CONTEXT_SERVER, function);
 	if (!threadHandle[THREAD_CONTEXT_SERVER])
 		return 0;
@@ -642,12 +609,12 @@ bool Sys_SpawnServerThread(void(*function)(unsigned int))
 
 bool Sys_SpawnDatabaseThread(void(*function)(unsigned int))
 {
-	Sys_CreateEvent(0, 0, &wakeDatabaseEvent);
-	Sys_CreateEvent(1, 1, &databaseCompletedEvent);
-	Sys_CreateEvent(1, 1, &databaseCompletedEvent2);
-	Sys_CreateEvent(1, 1, &resumedDatabaseEvent);
-	Sys_CreateEvent(0, 0, &gumpLoadedEvent);
-	Sys_CreateEvent(0, 0, &gumpFlushedEvent);
+	Sys_InitEvent(&wakeDatabaseEvent, 0, 0);
+	Sys_InitEvent(&databaseCompletedEvent, 1, 1);
+	Sys_InitEvent(&databaseCompletedEvent2, 1, 1);
+	Sys_InitEvent(&resumedDatabaseEvent, 1, 1);
+	Sys_InitEvent(&gumpLoadedEvent, 0, 0);
+	Sys_InitEvent(&gumpFlushedEvent, 0, 0);
 	Sys_CreateThread(THREAD_CONTEXT_DATABASE, function);
 	if (!threadHandle[THREAD_CONTEXT_DATABASE])
 		return false;
@@ -657,88 +624,133 @@ bool Sys_SpawnDatabaseThread(void(*function)(unsigned int))
 
 void Sys_InitWorkerThreadContext(void)
 {
+	// the calling thread takes job slot 0 on top of the spawned workers
+	Sys_InitJobSystem(Sys_GetDefaultWorkerThreadsCount() + 1);
+	Sys_InitLoadPipeline(LOAD_READS_IN_FLIGHT);
+}
 
+void Sys_InitJobWorkerThread(int workerIndex)
+{
+	int threadContext;
+	if (!g_currentThreadId)
+		g_currentThreadId = GetCurrentThreadId();
+	if (workerIndex - 1 <= THREAD_CONTEXT_WORKER7 - THREAD_CONTEXT_WORKER0)
+	{
+		threadContext = THREAD_CONTEXT_WORKER0 + workerIndex - 1;
+		threadId[threadContext] = g_currentThreadId;
+		SetThreadName(0xFFFFFFFF, s_threadNames[threadContext]);
+		Sys_ApplyThreadAffinity(threadContext, workerIndex);
+		Sys_InitThread(threadContext);
+		return;
+	}
+
+	// past the fixed Worker0-Worker7 contexts the worker only has a registry block
+	Com_sprintf(g_currentThreadName, sizeof(g_currentThreadName), "Worker%d", workerIndex - 1);
+	SetThreadName(0xFFFFFFFF, g_currentThreadName);
+	Sys_ApplyThreadAffinity(THREAD_CONTEXT_COUNT, workerIndex);
+	Com_InitThreadData(THREAD_CONTEXT_COUNT);
+}
+
+void Sys_ShutdownJobWorkerThread(void)
+{
+	Sys_UnregisterThread();
+}
+
+// Frontend only; waits for the backend to retire every queued frame first.
+void Sys_SetRendererFrameQueueDepth(int depth)
+{
+	Sys_ResizeFrameRing(&s_rendererFrames, depth);
+}
+
+void* Sys_WaitRendererFrame(void)
+{
+	smpData = Sys_AcquireFrame(&s_rendererFrames, SYS_WAIT_INFINITE);
+	return smpData;
 }
 
 void Sys_RenderCompleted(void)
 {
-	SetEvent(renderCompletedEvent);
-	SetEvent(backendEvent[0]);
+	Sys_ReleaseFrame(&s_rendererFrames);
+	Sys_SignalEvent(&renderCompletedEvent);
+	Sys_SetEvent(&backendEvent[0]);
 }
 
 void Sys_FrontEndSleep(void)
 {
 	PIXBeginNamedEvent(-1, "frontend sleep");
-	WaitForSingleObject(rendererRunningEvent, -1);
-	if (!g_currentThreadId)
-		g_currentThreadId = GetCurrentThreadId();
-	if (threadId[1])
-		D3DPERF_EndEvent();
+	Sys_WaitFrameSlot(&s_rendererFrames);
+	PIXEndNamedEvent();
 }
 
 void Sys_WakeRenderer(void* data)
 {
-	ResetEvent(renderCompletedEvent);
+	Sys_ClearEvent(&renderCompletedEvent);
+	// the backend still reads smpData until it takes frames from the ring
 	smpData = data;
+	Sys_PushFrame(&s_rendererFrames, data);
 	PIXSetMarker(-1, "set smpData");
-	SetEvent(backendEvent[1]);
-	SetEvent(backendEvent[0]);
+	Sys_SetEvent(&backendEvent[1]);
+	Sys_SetEvent(&backendEvent[0]);
+}
+
+void Sys_FrameQueueStats_f(void)
+{
+	Sys_PrintFrameRingStats("renderer frame queue", &s_rendererFrames);
 }
 
 void Sys_SleepServer(void)
 {
 	PIXBeginNamedEvent(-1, "sleep server");
-	int result = Sys_WaitForSingleObjectTimeout(&wakeServerEvent, 0);
-	if (!g_currentThreadId)
-		g_currentThreadId = GetCurrentThreadId();
-	if (g_currentThreadId == threadId[1])
-		D3DPERF_EndEvent();
+	int result = Sys_WaitEvent(&wakeServerEvent, 0);
+	PIXEndNamedEvent();
 	if (result + 1)
-		ResetEvent(wakeServerEvent);
+		Sys_ClearEvent(&wakeServerEvent);
+}
+
+// Sleeps until woken by Sys_WakeServer or until the deadline, whichever is first.
+void Sys_SleepServerUntil(unsigned long long deadlineNsec)
+{
+	PIXBeginNamedEvent(-1, "sleep server");
+	Sys_WaitEventUntil(&wakeServerEvent, deadlineNsec);
+	Sys_ClearEvent(&wakeServerEvent);
+	PIXEndNamedEvent();
 }
 
 void Sys_SyncDatabase(void)
 {
 	PIXBeginNamedEvent(-1, "Sys_SyncDatabase()");
-	if (WaitForSingleObject(databaseCompletedEvent, 0)) {
-		while (WaitForSingleObject(databaseCompletedEvent, 1000u))
-		{
-			//R_Cinematic_ForceRelinquishIO();
-			//Sys_CheckQuitRequest();
-		}
-		if (!g_currentThreadId)
-			g_currentThreadId = GetCurrentThreadId();
-		if (g_currentThreadId == threadId[1]) {
-			D3DPERF_EndEvent();
-			return;
-		}
-	}
-	else
+	// load completions are delivered on this thread, keep them flowing while we wait
+	while (!Sys_WaitEvent(&databaseCompletedEvent, 0))
 	{
-		if (!g_currentThreadId)
-			g_currentThreadId = GetCurrentThreadId();
-		if (g_currentThreadId == threadId[1]) {
-			D3DPERF_EndEvent();
-			return;
-		}
+		if (!Sys_PumpLoadCompletions())
+			Sys_WaitLoadActivity(SYS_WAIT_INFINITE);
+		//R_Cinematic_ForceRelinquishIO();
+		//Sys_CheckQuitRequest();
 	}
+	PIXEndNamedEvent();
 }
 
+// Workers past Worker7 and threads that never took a context have no entry
+// in s_threadNames; they get the name they set, or one made from their id.
 char const* Sys_GetCurrentThreadName(void)
 {
-	return s_threadNames[Sys_GetThreadContext()];
+	static __declspec(thread) char unnamed[32];
+	int threadContext;
+
+	if (g_currentThreadName[0])
+		return g_currentThreadName;
+	threadContext = Sys_GetThreadContext();
+	if (threadContext >= 0 && threadContext < THREAD_CONTEXT_COUNT && s_threadNames[threadContext])
+		return s_threadNames[threadContext];
+	Com_sprintf(unnamed, sizeof(unnamed), "Thread %u", GetCurrentThreadId());
+	return unnamed;
 }
 
 void Sys_WaitAllowServerNetworkLoop(void)
 {
 	PIXBeginNamedEvent(-1, "Sys_WaitAllowServerNetworkLoop");
-	if (!g_currentThreadId)
-		g_currentThreadId = GetCurrentThreadId();
-	Sys_WaitForSingleObject(&allowServerNetworkEvent);
-	if (!g_currentThreadId)
-		g_currentThreadId = GetCurrentThreadId();
-	if (g_currentThreadId == threadId[1])
-		D3DPERF_EndEvent();
+	Sys_WaitEvent(&allowServerNetworkEvent, SYS_WAIT_INFINITE);
+	PIXEndNamedEvent();
 }
 
 void Sys_GumpPrint(char const* fmt, ...)
@@ -760,11 +772,11 @@ void Sys_GumpLoaded(void)
 	Sys_GumpPrint("Sys_GumpLoaded set gumpLoadedEvent\n");
 	g_gump_load_in_progress = 0;
 	g_supress_db_prints = 0;
-	SetEvent(gumpLoadedEvent);
+	Sys_SignalEvent(&gumpLoadedEvent);
 }
 
 void Sys_GumpFlushed(void)
 {
 	Sys_GumpPrint("Sys_GumpFlushed set gumpFlushedEvent\n");
-	SetEvent(gumpFlushedEvent);
+	Sys_SignalEvent(&gumpFlushedEvent);
 }
@@ -17,6 +17,31 @@
 #ifndef THREADS_H
 #define THREADS_H
 
+enum
+{
+	THREAD_CONTEXT_MAIN = 0x0,
+	THREAD_CONTEXT_BACKEND = 0x1,
+	THREAD_CONTEXT_WORKER0 = 0x2,
+	THREAD_CONTEXT_WORKER1 = 0x3,
+	THREAD_CONTEXT_WORKER2 = 0x4,
+	THREAD_CONTEXT_WORKER3 = 0x5,
+	THREAD_CONTEXT_WORKER4 = 0x6,
+	THREAD_CONTEXT_WORKER5 = 0x7,
+	THREAD_CONTEXT_WORKER6 = 0x8,
+	THREAD_CONTEXT_WORKER7 = 0x9,
+	THREAD_CONTEXT_SERVER = 0xA,
+	THREAD_CONTEXT_TITLE_SERVER = 0xB,
+	THREAD_CONTEXT_DATABASE = 0xC,
+	THREAD_CONTEXT_TRACE_COUNT = 0xD,
+	THREAD_CONTEXT_TRACE_LAST = 0xC,
+	THREAD_CONTEXT_STREAM = 0xD,
+	THREAD_CONTEXT_SOUND_MIX = 0xE,
+	THREAD_CONTEXT_SOUND_DECODE = 0xF,
+	THREAD_CONTEXT_WEBM_DEC_DECODE = 0x10,
+	THREAD_CONTEXT_COUNT = 0x11,
+	THREAD_CONTEXT_INVALID = 0xFFFFFFFF,
+};
+
 extern "C" {
 	void SetThreadName(unsigned int, char const*);
 	void Sys_Sleep(int);
@@ -41,6 +66,7 @@ extern "C" {
 	void Sys_InitServerEvents(void);
 	void Sys_NotifyRenderer(void);
 	int Sys_WaitServer(int);
+	int Sys_WaitServerUntil(unsigned long long);
 	bool Sys_IsDBPrintingSuppressed(void);
 	void Sys_StartGumpLoading(void);
 	int Sys_IsLoadingGump(void);
@@ -72,6 +98,8 @@ extern "C" {
 	void Sys_SetD3DShutdownEvent(void);
 	int Sys_QueryD3DShutdownEvent(void);
 	bool Sys_SpawnStreamThread(void (*)(unsigned int));
+	void Sys_InitStreamWorkerThread(int);
+	void Sys_ShutdownStreamWorkerThread(void);
 	void Sys_StreamSleep(void);
 	void Sys_ResetSndInitializedEvent(void);
 	int Sys_QueryStreamPaused(void);
@@ -86,10 +114,16 @@ extern "C" {
 	bool Sys_SpawnServerThread(void (*)(unsigned int));
 	bool Sys_SpawnDatabaseThread(void (*)(unsigned int));
 	void Sys_InitWorkerThreadContext(void);
+	void Sys_InitJobWorkerThread(int);
+	void Sys_ShutdownJobWorkerThread(void);
+	void Sys_SetRendererFrameQueueDepth(int);
+	void* Sys_WaitRendererFrame(void);
 	void Sys_RenderCompleted(void);
 	void Sys_FrontEndSleep(void);
 	void Sys_WakeRenderer(void*);
+	void Sys_FrameQueueStats_f(void);
 	void Sys_SleepServer(void);
+	void Sys_SleepServerUntil(unsigned long long);
 	void Sys_SyncDatabase(void);
 	char const* Sys_GetCurrentThreadName(void);
 	void Sys_WaitAllowServerNetworkLoop(void);
@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threads_budget.h"
+
+#include <universal/q_shared.h>
+#include <universal/dvar.h>
+#include <qcommon/common.h>
+#include <qcommon/threads_timer.h>
+
+#include <mutex>
+#include <stdio.h>
+
+#define BUDGET_PRINT_OVER_TICKS 8
+
+// A tick runs from the server being woken to Sys_ServerCompleted. The wait
+// and network time of a frame are what the main thread spent blocked on the
+// server and what the network phase took while that tick was outstanding.
+typedef struct ServerBudget
+{
+	SysHdrHistogram tick;
+	SysHdrHistogram wait;
+	SysHdrHistogram net;
+	unsigned long long tickStartNsec;
+	unsigned int frame;
+	bool pending;
+	SysBudgetSample pendingSample;
+	std::atomic<unsigned long long> waitNsec;
+	std::atomic<unsigned long long> netNsec;
+	std::atomic<unsigned long long> netStartNsec;
+	std::atomic<unsigned int> overBudget;
+	std::mutex windowMutex;
+	SysBudgetSample window[SYS_BUDGET_WINDOW];
+	unsigned int windowCount;
+} ServerBudget;
+
+static ServerBudget s_serverBudget;
+static const dvar_t* sys_serverBudgetMsec;
+
+static unsigned int Sys_HighestBit(unsigned int value)
+{
+	unsigned int bit;
+
+	for (bit = 0; value >>= 1; ++bit)
+	{
+	}
+	return bit;
+}
+
+static int Sys_HdrBucket(unsigned int value)
+{
+	unsigned int exponent;
+
+	if (value < SYS_HDR_SUB_COUNT)
+		return value;
+	exponent = Sys_HighestBit(value);
+	return (exponent - SYS_HDR_SUB_BITS + 1) * SYS_HDR_SUB_COUNT + ((value >> (exponent - SYS_HDR_SUB_BITS)) & (SYS_HDR_SUB_COUNT - 1));
+}
+
+// Largest value that lands in the bucket, so percentiles never under-report.
+static unsigned int Sys_HdrBucketHighest(int bucket)
+{
+	unsigned int exponent;
+	unsigned int sub;
+
+	if (bucket < SYS_HDR_SUB_COUNT)
+		return bucket;
+	exponent = bucket / SYS_HDR_SUB_COUNT + SYS_HDR_SUB_BITS - 1;
+	sub = bucket % SYS_HDR_SUB_COUNT;
+	return ((SYS_HDR_SUB_COUNT + sub) << (exponent - SYS_HDR_SUB_BITS)) + (1u << (exponent - SYS_HDR_SUB_BITS)) - 1;
+}
+
+void Sys_ClearHdrHistogram(SysHdrHistogram* histogram)
+{
+	int i;
+
+	for (i = 0; i < SYS_HDR_BUCKETS; ++i)
+		histogram->buckets[i].store(0, std::memory_order_relaxed);
+	histogram->count.store(0, std::memory_order_relaxed);
+	histogram->maxUsec.store(0, std::memory_order_relaxed);
+	histogram->sumUsec.store(0, std::memory_order_relaxed);
+}
+
+void Sys_RecordHdrValue(SysHdrHistogram* histogram, unsigned long long usec)
+{
+	unsigned int value;
+	unsigned int maxUsec;
+
+	value = usec > 0xFFFFFFFFull ? 0xFFFFFFFFu : (unsigned int)usec;
+	histogram->buckets[Sys_HdrBucket(value)].fetch_add(1, std::memory_order_relaxed);
+	histogram->count.fetch_add(1, std::memory_order_relaxed);
+	histogram->sumUsec.fetch_add(value, std::memory_order_relaxed);
+	maxUsec = histogram->maxUsec.load(std::memory_order_relaxed);
+	while (value > maxUsec && !histogram->maxUsec.compare_exchange_weak(maxUsec, value, std::memory_order_relaxed))
+	{
+	}
+}
+
+unsigned int Sys_GetHdrPercentile(SysHdrHistogram const* histogram, double percentile)
+{
+	unsigned int count;
+	unsigned int target;
+	unsigned int seen;
+	unsigned int maxUsec;
+	int i;
+
+	count = histogram->count.load(std::memory_order_relaxed);
+	if (!count)
+		return 0;
+	target = (unsigned int)(count * percentile / 100.0 + 0.5);
+	if (target < 1)
+		target = 1;
+	maxUsec = histogram->maxUsec.load(std::memory_order_relaxed);
+	seen = 0;
+	for (i = 0; i < SYS_HDR_BUCKETS; ++i)
+	{
+		seen += histogram->buckets[i].load(std::memory_order_relaxed);
+		if (seen >= target)
+			return Sys_HdrBucketHighest(i) < maxUsec ? Sys_HdrBucketHighest(i) : maxUsec;
+	}
+	return maxUsec;
+}
+
+void Sys_PrintHdrHistogram(char const* name, SysHdrHistogram const* histogram)
+{
+	unsigned int count;
+
+	count = histogram->count.load(std::memory_order_relaxed);
+	if (!count)
+	{
+		Com_Printf(CON_CHANNEL_SYSTEM, "  %-5s no samples\n", name);
+		return;
+	}
+	Com_Printf(CON_CHANNEL_SYSTEM, "  %-5s %7.2f %7.2f %7.2f %7.2f %7.2f %7.2f ms\n",
+		name,
+		histogram->sumUsec.load(std::memory_order_relaxed) / 1000.0 / count,
+		Sys_GetHdrPercentile(histogram, 50.0) / 1000.0,
+		Sys_GetHdrPercentile(histogram, 90.0) / 1000.0,
+		Sys_GetHdrPercentile(histogram, 99.0) / 1000.0,
+		Sys_GetHdrPercentile(histogram, 99.9) / 1000.0,
+		histogram->maxUsec.load(std::memory_order_relaxed) / 1000.0);
+}
+
+void Sys_RegisterServerBudgetDvars(void)
+{
+	sys_serverBudgetMsec = _Dvar_RegisterInt("sys_serverBudgetMsec", 0, 0, 1000, 0,
+		"Server tick budget in milliseconds; above 0 records tick, wait and network times and flags ticks that overrun it");
+}
+
+bool Sys_IsServerBudgetEnabled(void)
+{
+	return sys_serverBudgetMsec && sys_serverBudgetMsec->current.integer > 0;
+}
+
+static void Sys_CommitBudgetSample(ServerBudget* budget)
+{
+	SysBudgetSample* sample;
+	unsigned long long waitNsec;
+	unsigned long long netNsec;
+
+	sample = &budget->pendingSample;
+	waitNsec = budget->waitNsec.exchange(0, std::memory_order_relaxed);
+	netNsec = budget->netNsec.exchange(0, std::memory_order_relaxed);
+	sample->waitUsec = (unsigned int)(waitNsec / 1000);
+	sample->netUsec = (unsigned int)(netNsec / 1000);
+	Sys_RecordHdrValue(&budget->wait, sample->waitUsec);
+	Sys_RecordHdrValue(&budget->net, sample->netUsec);
+	if (sample->overBudget)
+		budget->overBudget.fetch_add(1, std::memory_order_relaxed);
+
+	std::lock_guard<std::mutex> lock(budget->windowMutex);
+	budget->window[budget->windowCount++ % SYS_BUDGET_WINDOW] = *sample;
+	budget->pending = false;
+}
+
+// Server thread. The previous frame is committed here rather than at its
+// Sys_ServerCompleted so the main thread's wait on it has been counted.
+void Sys_BudgetServerTickBegin(void)
+{
+	ServerBudget* budget;
+
+	budget = &s_serverBudget;
+	if (budget->pending)
+		Sys_CommitBudgetSample(budget);
+	if (!Sys_IsServerBudgetEnabled())
+	{
+		budget->tickStartNsec = 0;
+		return;
+	}
+	budget->tickStartNsec = Sys_NanoTime();
+}
+
+void Sys_BudgetServerTickEnd(void)
+{
+	ServerBudget* budget;
+	unsigned long long tickUsec;
+
+	budget = &s_serverBudget;
+	if (!budget->tickStartNsec)
+		return;
+	tickUsec = (Sys_NanoTime() - budget->tickStartNsec) / 1000;
+	budget->tickStartNsec = 0;
+	Sys_RecordHdrValue(&budget->tick, tickUsec);
+	budget->pendingSample.frame = budget->frame++;
+	budget->pendingSample.tickUsec = tickUsec > 0xFFFFFFFFull ? 0xFFFFFFFFu : (unsigned int)tickUsec;
+	budget->pendingSample.overBudget = sys_serverBudgetMsec && tickUsec > (unsigned long long)sys_serverBudgetMsec->current.integer * 1000;
+	budget->pending = true;
+}
+
+// startNsec is 0 when the budget was off as the wait began.
+void Sys_BudgetServerWait(unsigned long long startNsec)
+{
+	if (!startNsec)
+		return;
+	s_serverBudget.waitNsec.fetch_add(Sys_NanoTime() - startNsec, std::memory_order_relaxed);
+}
+
+void Sys_BudgetNetworkBegin(void)
+{
+	if (!Sys_IsServerBudgetEnabled())
+		return;
+	s_serverBudget.netStartNsec.store(Sys_NanoTime(), std::memory_order_relaxed);
+}
+
+void Sys_BudgetNetworkEnd(void)
+{
+	unsigned long long startNsec;
+
+	startNsec = s_serverBudget.netStartNsec.exchange(0, std::memory_order_relaxed);
+	if (!startNsec)
+		return;
+	s_serverBudget.netNsec.fetch_add(Sys_NanoTime() - startNsec, std::memory_order_relaxed);
+}
+
+void Sys_ResetServerBudget(void)
+{
+	ServerBudget* budget;
+
+	budget = &s_serverBudget;
+	Sys_ClearHdrHistogram(&budget->tick);
+	Sys_ClearHdrHistogram(&budget->wait);
+	Sys_ClearHdrHistogram(&budget->net);
+	budget->overBudget.store(0, std::memory_order_relaxed);
+	std::lock_guard<std::mutex> lock(budget->windowMutex);
+	budget->windowCount = 0;
+}
+
+// Copies the window oldest first and returns how many samples it holds.
+static unsigned int Sys_CopyBudgetWindow(SysBudgetSample* out)
+{
+	unsigned int count;
+	unsigned int first;
+	unsigned int i;
+
+	std::lock_guard<std::mutex> lock(s_serverBudget.windowMutex);
+	count = s_serverBudget.windowCount < SYS_BUDGET_WINDOW ? s_serverBudget.windowCount : SYS_BUDGET_WINDOW;
+	first = s_serverBudget.windowCount - count;
+	for (i = 0; i < count; ++i)
+		out[i] = s_serverBudget.window[(first + i) % SYS_BUDGET_WINDOW];
+	return count;
+}
+
+bool Sys_WriteServerBudget(char const* filename)
+{
+	SysBudgetSample window[SYS_BUDGET_WINDOW];
+	unsigned int count;
+	unsigned int i;
+	FILE* f;
+
+	f = fopen(filename, "w");
+	if (!f)
+	{
+		Com_Printf(CON_CHANNEL_SYSTEM, "couldn't open %s for writing\n", filename);
+		return false;
+	}
+	count = Sys_CopyBudgetWindow(window);
+	fprintf(f, "frame,tick_us,wait_us,net_us,over_budget\n");
+	for (i = 0; i < count; ++i)
+		fprintf(f, "%u,%u,%u,%u,%d\n", window[i].frame, window[i].tickUsec, window[i].waitUsec, window[i].netUsec, window[i].overBudget);
+	fclose(f);
+	Com_Printf(CON_CHANNEL_SYSTEM, "wrote %u frames to %s\n", count, filename);
+	return true;
+}
+
+void Sys_ServerBudget_f(void)
+{
+	SysBudgetSample window[SYS_BUDGET_WINDOW];
+	unsigned int count;
+	unsigned int ticks;
+	unsigned int over;
+	int printed;
+	int i;
+
+	if (!Sys_IsServerBudgetEnabled())
+		Com_Printf(CON_CHANNEL_SYSTEM, "server budget tracking is off, set sys_serverBudgetMsec to enable it\n");
+	else
+		Com_Printf(CON_CHANNEL_SYSTEM, "server budget %d ms\n", sys_serverBudgetMsec->current.integer);
+
+	ticks = s_serverBudget.tick.count.load(std::memory_order_relaxed);
+	over = s_serverBudget.overBudget.load(std::memory_order_relaxed);
+	Com_Printf(CON_CHANNEL_SYSTEM, "%u ticks, %u over budget (%.2f%%)\n", ticks, over, ticks ? 100.0 * over / ticks : 0.0);
+	Com_Printf(CON_CHANNEL_SYSTEM, "           mean     p50     p90     p99   p99.9     max\n");
+	Sys_PrintHdrHistogram("tick", &s_serverBudget.tick);
+	Sys_PrintHdrHistogram("wait", &s_serverBudget.wait);
+	Sys_PrintHdrHistogram("net", &s_serverBudget.net);
+
+	count = Sys_CopyBudgetWindow(window);
+	printed = 0;
+	for (i = (int)count - 1; i >= 0 && printed < BUDGET_PRINT_OVER_TICKS; --i)
+	{
+		if (!window[i].overBudget)
+			continue;
+		if (!printed)
+			Com_Printf(CON_CHANNEL_SYSTEM, "recent overruns:\n");
+		Com_Printf(CON_CHANNEL_SYSTEM, "  frame %u: tick %.2f ms, wait %.2f ms, net %.2f ms\n",
+			window[i].frame, window[i].tickUsec / 1000.0, window[i].waitUsec / 1000.0, window[i].netUsec / 1000.0);
+		++printed;
+	}
+}
+
+void Sys_ServerBudgetDump_f(void)
+{
+	Sys_WriteServerBudget("server_budget.csv");
+}
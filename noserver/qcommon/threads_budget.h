@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADS_BUDGET_H
+#define THREADS_BUDGET_H
+
+#include <atomic>
+
+// Log-linear buckets: values below 16 are exact, above that every power of
+// two is split into 16 sub-buckets, so any value is within 1/16 of its
+// bucket. Covers 1 us to over an hour in 464 counters.
+#define SYS_HDR_SUB_BITS 4
+#define SYS_HDR_SUB_COUNT (1 << SYS_HDR_SUB_BITS)
+#define SYS_HDR_BUCKETS ((32 - SYS_HDR_SUB_BITS + 1) * SYS_HDR_SUB_COUNT)
+
+#define SYS_BUDGET_WINDOW 256
+
+typedef struct SysHdrHistogram
+{
+	std::atomic<unsigned int> buckets[SYS_HDR_BUCKETS];
+	std::atomic<unsigned int> count;
+	std::atomic<unsigned int> maxUsec;
+	std::atomic<unsigned long long> sumUsec;
+} SysHdrHistogram;
+
+typedef struct SysBudgetSample
+{
+	unsigned int frame;
+	unsigned int tickUsec;
+	unsigned int waitUsec;
+	unsigned int netUsec;
+	bool overBudget;
+} SysBudgetSample;
+
+void Sys_ClearHdrHistogram(SysHdrHistogram* histogram);
+void Sys_RecordHdrValue(SysHdrHistogram* histogram, unsigned long long usec);
+unsigned int Sys_GetHdrPercentile(SysHdrHistogram const* histogram, double percentile);
+void Sys_PrintHdrHistogram(char const* name, SysHdrHistogram const* histogram);
+
+void Sys_RegisterServerBudgetDvars(void);
+bool Sys_IsServerBudgetEnabled(void);
+void Sys_BudgetServerTickBegin(void);
+void Sys_BudgetServerTickEnd(void);
+void Sys_BudgetServerWait(unsigned long long startNsec);
+void Sys_BudgetNetworkBegin(void);
+void Sys_BudgetNetworkEnd(void);
+void Sys_ResetServerBudget(void);
+bool Sys_WriteServerBudget(char const* filename);
+void Sys_ServerBudget_f(void);
+void Sys_ServerBudgetDump_f(void);
+
+#endif // THREADS_BUDGET_H
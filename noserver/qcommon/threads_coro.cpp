@@ -0,0 +1,319 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threads_coro.h"
+
+#include <universal/q_shared.h>
+#include <qcommon/common.h>
+#include <qcommon/threads_timer.h>
+
+#include <chrono>
+#include <thread>
+
+// scheduler whose Sys_RunCoroutines is resuming coroutines on this thread
+static thread_local SysCoroScheduler* s_currentScheduler;
+
+SysCoroutine::promise_type::~promise_type()
+{
+	if (scheduler)
+		--scheduler->liveCount;
+}
+
+static bool Sys_PollCoroWait(SysCoroWait* wait)
+{
+	if (wait->event)
+		return Sys_WaitEvent(wait->event, 0);
+	if (wait->counter)
+		return Sys_IsCounterDone(wait->counter);
+	return false;
+}
+
+static bool Sys_IsCoroWaitExpired(SysCoroWait const* wait, unsigned long long now)
+{
+	return wait->deadlineNsec && now >= wait->deadlineNsec;
+}
+
+bool SysCoroWait::await_ready()
+{
+	signaled = Sys_PollCoroWait(this);
+	return signaled || Sys_IsCoroWaitExpired(this, Sys_NanoTime());
+}
+
+void SysCoroWait::await_suspend(std::coroutine_handle<> handle)
+{
+	SysCoroScheduler* scheduler;
+	SysCoroWaiter* waiter;
+
+	scheduler = s_currentScheduler;
+	assert(scheduler);
+	if (scheduler->waiterCount == SYS_CORO_MAX_WAITERS)
+		Com_Error(ERR_FATAL, "SysCoroWait: more than %d coroutines parked on one scheduler", SYS_CORO_MAX_WAITERS);
+	waiter = &scheduler->waiters[scheduler->waiterCount++];
+	waiter->wait = this;
+	waiter->handle = handle;
+}
+
+int SysCoroWait::await_resume()
+{
+	if (!signaled)
+		return 0;
+	return onSignaled ? onSignaled() : 1;
+}
+
+void Sys_InitCoroutineScheduler(SysCoroScheduler* scheduler)
+{
+	scheduler->waiterCount = 0;
+	scheduler->readyHead = 0;
+	scheduler->readyTail = 0;
+	scheduler->liveCount = 0;
+	Sys_InitEvent(&scheduler->wake, 0, 0);
+}
+
+void Sys_SpawnCoroutine(SysCoroScheduler* scheduler, SysCoroutine coroutine)
+{
+	if (scheduler->readyHead - scheduler->readyTail == SYS_CORO_MAX_READY)
+		Com_Error(ERR_FATAL, "Sys_SpawnCoroutine: more than %d coroutines waiting to start", SYS_CORO_MAX_READY);
+	coroutine.handle.promise().scheduler = scheduler;
+	++scheduler->liveCount;
+	scheduler->ready[scheduler->readyHead++ % SYS_CORO_MAX_READY] = coroutine.handle;
+}
+
+// Resumes everything that can make progress and returns how many resumed.
+static int Sys_RunCoroutinePass(SysCoroScheduler* scheduler)
+{
+	std::coroutine_handle<> handle;
+	SysCoroWait* wait;
+	unsigned long long now;
+	int resumed;
+	int i;
+
+	resumed = 0;
+	while (scheduler->readyTail != scheduler->readyHead)
+	{
+		handle = scheduler->ready[scheduler->readyTail++ % SYS_CORO_MAX_READY];
+		handle.resume();
+		++resumed;
+	}
+
+	now = Sys_NanoTime();
+	i = 0;
+	while (i < scheduler->waiterCount)
+	{
+		wait = scheduler->waiters[i].wait;
+		wait->signaled = Sys_PollCoroWait(wait);
+		if (!wait->signaled && !Sys_IsCoroWaitExpired(wait, now))
+		{
+			++i;
+			continue;
+		}
+		// unpark before resuming, the coroutine may park again right away
+		handle = scheduler->waiters[i].handle;
+		scheduler->waiters[i] = scheduler->waiters[--scheduler->waiterCount];
+		handle.resume();
+		++resumed;
+	}
+	return resumed;
+}
+
+static unsigned int Sys_GetCoroutineSleepMsec(SysCoroScheduler const* scheduler, unsigned int msec)
+{
+	unsigned long long nearest;
+	unsigned long long now;
+	unsigned long long deadline;
+	int i;
+
+	if (msec > SYS_CORO_POLL_MSEC)
+		msec = SYS_CORO_POLL_MSEC;
+	nearest = 0;
+	for (i = 0; i < scheduler->waiterCount; ++i)
+	{
+		deadline = scheduler->waiters[i].wait->deadlineNsec;
+		if (deadline && (!nearest || deadline < nearest))
+			nearest = deadline;
+	}
+	if (nearest)
+	{
+		now = Sys_NanoTime();
+		if (nearest <= now)
+			return 0;
+		if ((nearest - now) / SYS_NSEC_PER_MSEC < msec)
+			msec = (unsigned int)((nearest - now) / SYS_NSEC_PER_MSEC);
+	}
+	return msec;
+}
+
+// Runs coroutines until at least one made progress or msec ran out, and
+// returns how many were resumed. Parked coroutines are polled every
+// SYS_CORO_POLL_MSEC, or sooner on Sys_WakeCoroutineScheduler.
+int Sys_RunCoroutines(SysCoroScheduler* scheduler, unsigned int msec)
+{
+	SysCoroScheduler* outer;
+	unsigned long long deadline;
+	unsigned long long now;
+	unsigned int left;
+	int resumed;
+
+	outer = s_currentScheduler;
+	s_currentScheduler = scheduler;
+	deadline = msec == SYS_WAIT_INFINITE ? 0 : Sys_NanoTime() + msec * SYS_NSEC_PER_MSEC;
+	while (1)
+	{
+		resumed = Sys_RunCoroutinePass(scheduler);
+		if (resumed || !msec || !scheduler->liveCount)
+			break;
+		left = SYS_WAIT_INFINITE;
+		if (deadline)
+		{
+			now = Sys_NanoTime();
+			if (now >= deadline)
+				break;
+			left = (unsigned int)((deadline - now) / SYS_NSEC_PER_MSEC);
+		}
+		Sys_WaitEvent(&scheduler->wake, Sys_GetCoroutineSleepMsec(scheduler, left));
+	}
+	s_currentScheduler = outer;
+	return resumed;
+}
+
+void Sys_RunCoroutinesUntilDone(SysCoroScheduler* scheduler)
+{
+	while (scheduler->liveCount)
+		Sys_RunCoroutines(scheduler, SYS_WAIT_INFINITE);
+}
+
+int Sys_GetCoroutineCount(SysCoroScheduler const* scheduler)
+{
+	return scheduler->liveCount;
+}
+
+// Any thread: makes the scheduler poll its parked coroutines now.
+void Sys_WakeCoroutineScheduler(SysCoroScheduler* scheduler)
+{
+	Sys_SignalEvent(&scheduler->wake);
+}
+
+SysCoroWait Sys_AwaitEvent(SysEvent* event, unsigned int msec)
+{
+	SysCoroWait wait;
+
+	wait.event = event;
+	wait.counter = 0;
+	wait.deadlineNsec = msec == SYS_WAIT_INFINITE ? 0 : Sys_NanoTime() + msec * SYS_NSEC_PER_MSEC;
+	wait.onSignaled = 0;
+	wait.signaled = false;
+	return wait;
+}
+
+SysCoroWait Sys_AwaitCounter(SysJobCounter const* counter)
+{
+	SysCoroWait wait;
+
+	wait.event = 0;
+	wait.counter = counter;
+	wait.deadlineNsec = 0;
+	wait.onSignaled = 0;
+	wait.signaled = false;
+	return wait;
+}
+
+SysCoroWait Sys_AwaitSleep(unsigned int msec)
+{
+	SysCoroWait wait;
+
+	wait.event = 0;
+	wait.counter = 0;
+	wait.deadlineNsec = Sys_NanoTime() + msec * SYS_NSEC_PER_MSEC;
+	wait.onSignaled = 0;
+	wait.signaled = false;
+	return wait;
+}
+
+#define CORO_BENCH_SEQUENCES 64
+#define CORO_BENCH_STEPS 4
+#define CORO_BENCH_IO_MSEC 1
+#define CORO_BENCH_DECODE_WORK 20000
+
+static std::atomic<unsigned int> s_coroBenchSink;
+static std::atomic<int> s_coroBenchDone;
+
+static void Sys_CoroBenchDecode(void* data)
+{
+	unsigned int value;
+	int i;
+
+	value = (unsigned int)(uintptr_t)data;
+	for (i = 0; i < CORO_BENCH_DECODE_WORK; ++i)
+		value = value * 1664525u + 1013904223u;
+	s_coroBenchSink.fetch_add(value, std::memory_order_relaxed);
+}
+
+// One load sequence: wait out the read latency, hand the decode to a worker,
+// wait for it, repeat.
+static SysCoroutine Sys_CoroBenchSequence(int sequence)
+{
+	SysJobCounter counter;
+	int step;
+
+	counter.pending.store(0, std::memory_order_relaxed);
+	for (step = 0; step < CORO_BENCH_STEPS; ++step)
+	{
+		co_await Sys_AwaitSleep(CORO_BENCH_IO_MSEC);
+		Sys_SubmitJob(Sys_CoroBenchDecode, (void*)(uintptr_t)(sequence * CORO_BENCH_STEPS + step), &counter);
+		co_await Sys_AwaitCounter(&counter);
+	}
+	s_coroBenchDone.fetch_add(1, std::memory_order_relaxed);
+}
+
+// The same sequences run back to back on a blocking thread, then all in
+// flight at once on one thread through a scheduler.
+void Sys_CoroutineBenchmark_f(void)
+{
+	SysCoroScheduler* scheduler;
+	SysJobCounter counter;
+	std::chrono::steady_clock::time_point start;
+	double blockingSeconds;
+	double coroutineSeconds;
+	int sequence;
+	int step;
+
+	counter.pending.store(0, std::memory_order_relaxed);
+	start = std::chrono::steady_clock::now();
+	for (sequence = 0; sequence < CORO_BENCH_SEQUENCES; ++sequence)
+	{
+		for (step = 0; step < CORO_BENCH_STEPS; ++step)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(CORO_BENCH_IO_MSEC));
+			Sys_SubmitJob(Sys_CoroBenchDecode, (void*)(uintptr_t)(sequence * CORO_BENCH_STEPS + step), &counter);
+			Sys_WaitForCounter(&counter);
+		}
+	}
+	blockingSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	scheduler = new SysCoroScheduler;
+	Sys_InitCoroutineScheduler(scheduler);
+	s_coroBenchDone.store(0);
+	start = std::chrono::steady_clock::now();
+	for (sequence = 0; sequence < CORO_BENCH_SEQUENCES; ++sequence)
+		Sys_SpawnCoroutine(scheduler, Sys_CoroBenchSequence(sequence));
+	Sys_RunCoroutinesUntilDone(scheduler);
+	coroutineSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	delete scheduler;
+
+	Com_Printf(CON_CHANNEL_SYSTEM, "%d sequences of %d steps (%d ms read + decode job)\n", CORO_BENCH_SEQUENCES, CORO_BENCH_STEPS, CORO_BENCH_IO_MSEC);
+	Com_Printf(CON_CHANNEL_SYSTEM, "  blocking thread:  %8.1f ms\n", blockingSeconds * 1000.0);
+	Com_Printf(CON_CHANNEL_SYSTEM, "  coroutines:       %8.1f ms, %d finished, %.1fx\n",
+		coroutineSeconds * 1000.0, s_coroBenchDone.load(), blockingSeconds / coroutineSeconds);
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADS_CORO_H
+#define THREADS_CORO_H
+
+#include <qcommon/threads_jobs.h>
+#include <qcommon/threads_wait.h>
+
+#include <coroutine>
+#include <exception>
+
+#define SYS_CORO_MAX_WAITERS 1024
+#define SYS_CORO_MAX_READY 1024
+// how long a scheduler with parked coroutines sleeps between polls; events
+// signaled by other threads are noticed within this
+#define SYS_CORO_POLL_MSEC 1
+
+struct SysCoroScheduler;
+
+// Return type of a coroutine run by a SysCoroScheduler. It starts suspended,
+// Sys_SpawnCoroutine queues it, and its frame frees itself when it returns.
+struct SysCoroutine
+{
+	struct promise_type
+	{
+		SysCoroScheduler* scheduler;
+
+		promise_type() : scheduler(0)
+		{
+		}
+		~promise_type();
+		SysCoroutine get_return_object()
+		{
+			return SysCoroutine{ std::coroutine_handle<promise_type>::from_promise(*this) };
+		}
+		std::suspend_always initial_suspend() noexcept
+		{
+			return {};
+		}
+		std::suspend_never final_suspend() noexcept
+		{
+			return {};
+		}
+		void return_void()
+		{
+		}
+		void unhandled_exception()
+		{
+			std::terminate();
+		}
+	};
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+// What a parked coroutine waits for: an event, a job counter, a deadline, or
+// an event or counter with a deadline. Resumes with nonzero if the condition
+// was met, 0 on timeout; onSignaled, when set, supplies the nonzero result and
+// runs the same follow-up the blocking Sys_ call would.
+struct SysCoroWait
+{
+	SysEvent* event;
+	SysJobCounter const* counter;
+	unsigned long long deadlineNsec;
+	int (*onSignaled)(void);
+	bool signaled;
+
+	bool await_ready();
+	void await_suspend(std::coroutine_handle<> handle);
+	int await_resume();
+};
+
+typedef struct SysCoroWaiter
+{
+	SysCoroWait* wait;
+	std::coroutine_handle<> handle;
+} SysCoroWaiter;
+
+// Runs coroutines on the thread that calls Sys_RunCoroutines. Everything but
+// Sys_WakeCoroutineScheduler must be called from that thread.
+typedef struct SysCoroScheduler
+{
+	SysCoroWaiter waiters[SYS_CORO_MAX_WAITERS];
+	int waiterCount;
+	std::coroutine_handle<> ready[SYS_CORO_MAX_READY];
+	unsigned int readyHead;
+	unsigned int readyTail;
+	int liveCount;
+	SysEvent wake;
+} SysCoroScheduler;
+
+void Sys_InitCoroutineScheduler(SysCoroScheduler* scheduler);
+void Sys_SpawnCoroutine(SysCoroScheduler* scheduler, SysCoroutine coroutine);
+int Sys_RunCoroutines(SysCoroScheduler* scheduler, unsigned int msec);
+void Sys_RunCoroutinesUntilDone(SysCoroScheduler* scheduler);
+int Sys_GetCoroutineCount(SysCoroScheduler const* scheduler);
+void Sys_WakeCoroutineScheduler(SysCoroScheduler* scheduler);
+
+SysCoroWait Sys_AwaitEvent(SysEvent* event, unsigned int msec);
+SysCoroWait Sys_AwaitCounter(SysJobCounter const* counter);
+SysCoroWait Sys_AwaitSleep(unsigned int msec);
+
+// awaitable forms of the thread handshakes in threads.cpp
+SysCoroWait Sys_AwaitStartServer(unsigned int msec);
+SysCoroWait Sys_AwaitGumpLoad(unsigned int msec);
+SysCoroWait Sys_AwaitGumpFlush(unsigned int msec);
+SysCoroWait Sys_AwaitDemoStreaming(unsigned int msec);
+SysCoroWait Sys_AwaitStreamPaused(unsigned int msec);
+
+void Sys_CoroutineBenchmark_f(void);
+
+#endif // THREADS_CORO_H
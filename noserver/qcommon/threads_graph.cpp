@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threads_graph.h"
+
+#include <universal/q_shared.h>
+#include <qcommon/common.h>
+#include <qcommon/threads_profile.h>
+#include <qcommon/threads_timer.h>
+
+#include <cstring>
+
+void Sys_InitTaskGraph(SysTaskGraph* graph)
+{
+	graph->taskCount = 0;
+	graph->counter.pending.store(0, std::memory_order_relaxed);
+	graph->frameCount = 0;
+	graph->frameStartNsec = 0;
+	graph->frameEndNsec = 0;
+	graph->criticalPath.count = 0;
+	graph->criticalPath.pathNsec = 0;
+	graph->criticalPath.workNsec = 0;
+	graph->criticalPath.frameNsec = 0;
+}
+
+int Sys_FindGraphTask(SysTaskGraph const* graph, char const* name)
+{
+	int i;
+
+	for (i = 0; i < graph->taskCount; ++i)
+	{
+		if (!strcmp(graph->tasks[i].name, name))
+			return i;
+	}
+	return -1;
+}
+
+// after is a null-terminated list of task names this one waits for, or null
+// for a root. Returns the new task's index.
+int Sys_AddGraphTask(SysTaskGraph* graph, char const* name, SysJobFunc func, void* data, char const* const* after)
+{
+	SysGraphTask* task;
+	int index;
+	int dependency;
+
+	if (graph->taskCount == SYS_GRAPH_MAX_TASKS)
+		Com_Error(ERR_FATAL, "Sys_AddGraphTask: more than %d tasks adding '%s'", SYS_GRAPH_MAX_TASKS, name);
+	index = graph->taskCount;
+	task = &graph->tasks[index];
+	task->name = name;
+	task->func = func;
+	task->data = data;
+	task->graph = graph;
+	task->dependencies = 0;
+	task->dependents = 0;
+	task->dependencyCount = 0;
+	task->remaining.store(0, std::memory_order_relaxed);
+	task->startNsec = 0;
+	task->endNsec = 0;
+	task->totalNsec = 0;
+	task->criticalFrames = 0;
+
+	for (; after && *after; ++after)
+	{
+		dependency = Sys_FindGraphTask(graph, *after);
+		if (dependency < 0)
+			Com_Error(ERR_FATAL, "Sys_AddGraphTask: '%s' runs after '%s', which has not been added", name, *after);
+		if (task->dependencies & (1ull << dependency))
+			continue;
+		task->dependencies |= 1ull << dependency;
+		++task->dependencyCount;
+		graph->tasks[dependency].dependents |= 1ull << index;
+	}
+	++graph->taskCount;
+	return index;
+}
+
+static void Graph_RunTask(void* data)
+{
+	SysGraphTask* task;
+	SysTaskGraph* graph;
+	int i;
+
+	task = (SysGraphTask*)data;
+	graph = task->graph;
+	task->startNsec = Sys_NanoTime();
+	Sys_BeginProfileZone(task->name);
+	task->func(task->data);
+	Sys_EndProfileZone();
+	task->endNsec = Sys_NanoTime();
+
+	// released before this job retires, so the counter can't reach zero early
+	for (i = 0; i < graph->taskCount; ++i)
+	{
+		if (!(task->dependents & (1ull << i)))
+			continue;
+		if (graph->tasks[i].remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			Sys_SubmitJob(Graph_RunTask, &graph->tasks[i], &graph->counter);
+	}
+}
+
+// Longest chain of measured task times through the dependencies: the frame
+// can't finish sooner than this however many workers there are.
+static void Graph_FindCriticalPath(SysTaskGraph* graph)
+{
+	unsigned long long finish[SYS_GRAPH_MAX_TASKS];
+	int parent[SYS_GRAPH_MAX_TASKS];
+	SysGraphPath* path;
+	SysGraphTask* task;
+	unsigned long long duration;
+	int last;
+	int i;
+	int j;
+
+	path = &graph->criticalPath;
+	path->workNsec = 0;
+	last = -1;
+	for (i = 0; i < graph->taskCount; ++i)
+	{
+		task = &graph->tasks[i];
+		duration = task->endNsec - task->startNsec;
+		path->workNsec += duration;
+		finish[i] = 0;
+		parent[i] = -1;
+		for (j = 0; j < i; ++j)
+		{
+			if ((task->dependencies & (1ull << j)) && finish[j] > finish[i])
+			{
+				finish[i] = finish[j];
+				parent[i] = j;
+			}
+		}
+		finish[i] += duration;
+		if (last < 0 || finish[i] > finish[last])
+			last = i;
+	}
+
+	path->count = 0;
+	path->pathNsec = last < 0 ? 0 : finish[last];
+	for (i = last; i >= 0; i = parent[i])
+		path->tasks[path->count++] = i;
+	// collected back to front
+	for (i = 0; i < path->count / 2; ++i)
+	{
+		j = path->tasks[i];
+		path->tasks[i] = path->tasks[path->count - 1 - i];
+		path->tasks[path->count - 1 - i] = j;
+	}
+	for (i = 0; i < path->count; ++i)
+		++graph->tasks[path->tasks[i]].criticalFrames;
+	path->frameNsec = graph->frameEndNsec - graph->frameStartNsec;
+}
+
+// Runs one frame of the graph on the job workers, with the calling thread
+// helping, and returns once every task has finished.
+void Sys_RunTaskGraph(SysTaskGraph* graph)
+{
+	SysJobDecl roots[SYS_GRAPH_MAX_TASKS];
+	SysGraphTask* task;
+	int rootCount;
+	int i;
+
+	rootCount = 0;
+	for (i = 0; i < graph->taskCount; ++i)
+	{
+		task = &graph->tasks[i];
+		task->remaining.store(task->dependencyCount, std::memory_order_relaxed);
+		if (!task->dependencyCount)
+		{
+			roots[rootCount].func = Graph_RunTask;
+			roots[rootCount].data = task;
+			++rootCount;
+		}
+	}
+
+	graph->frameStartNsec = Sys_NanoTime();
+	Sys_SubmitJobs(roots, rootCount, &graph->counter);
+	Sys_WaitForCounter(&graph->counter);
+	graph->frameEndNsec = Sys_NanoTime();
+
+	for (i = 0; i < graph->taskCount; ++i)
+		graph->tasks[i].totalNsec += graph->tasks[i].endNsec - graph->tasks[i].startNsec;
+	++graph->frameCount;
+	Graph_FindCriticalPath(graph);
+}
+
+// Last frame's critical path, then every task's average time and how often
+// it was on the critical path.
+void Sys_PrintTaskGraph(SysTaskGraph const* graph)
+{
+	SysGraphPath const* path;
+	SysGraphTask const* task;
+	int i;
+
+	if (!graph->frameCount)
+	{
+		Com_Printf(CON_CHANNEL_SYSTEM, "task graph has not run yet\n");
+		return;
+	}
+	path = &graph->criticalPath;
+	Com_Printf(CON_CHANNEL_SYSTEM, "frame %u: %.3f ms wall, %.3f ms critical path, %.3f ms of work (%.2fx parallel)\n",
+		graph->frameCount, path->frameNsec / 1000000.0, path->pathNsec / 1000000.0, path->workNsec / 1000000.0,
+		path->frameNsec ? (double)path->workNsec / path->frameNsec : 0.0);
+	Com_Printf(CON_CHANNEL_SYSTEM, "critical path:");
+	for (i = 0; i < path->count; ++i)
+	{
+		task = &graph->tasks[path->tasks[i]];
+		Com_Printf(CON_CHANNEL_SYSTEM, "%s %s %.3f", i ? " ->" : "", task->name, (task->endNsec - task->startNsec) / 1000000.0);
+	}
+	Com_Printf(CON_CHANNEL_SYSTEM, "\n");
+
+	Com_Printf(CON_CHANNEL_SYSTEM, "task                     avg ms  critical\n");
+	for (i = 0; i < graph->taskCount; ++i)
+	{
+		task = &graph->tasks[i];
+		Com_Printf(CON_CHANNEL_SYSTEM, "%-24s %7.3f  %7.1f%%\n", task->name,
+			task->totalNsec / 1000000.0 / graph->frameCount, 100.0 * task->criticalFrames / graph->frameCount);
+	}
+}
+
+#define GRAPH_BENCH_FRAMES 60
+
+typedef struct GraphBenchStage
+{
+	char const* name;
+	int usec;
+	char const* after[4];
+} GraphBenchStage;
+
+// A frame shaped like the current event choreography, with every stage
+// declared against what it actually consumes instead of the thread it
+// happens to run on.
+static GraphBenchStage s_graphBenchStages[] =
+{
+	{ "input", 200, { 0 } },
+	{ "server", 2000, { 0 } },
+	{ "snapshot", 500, { "server", 0 } },
+	{ "client", 500, { "input", 0 } },
+	{ "database", 1500, { "input", 0 } },
+	{ "cgame", 1500, { "client", "snapshot", 0 } },
+	{ "ui", 500, { "client", 0 } },
+	{ "sound", 700, { "cgame", 0 } },
+	{ "frontend", 2000, { "cgame", 0 } },
+	{ "backend", 2000, { "frontend", "database", "ui", 0 } },
+};
+
+static void Graph_BenchWork(void* data)
+{
+	GraphBenchStage const* stage;
+	unsigned long long end;
+
+	stage = (GraphBenchStage const*)data;
+	end = Sys_NanoTime() + (unsigned long long)stage->usec * 1000;
+	while (Sys_NanoTime() < end)
+		;
+}
+
+// Runs a mock frame graph on spin-loop stages and reports its critical path;
+// with enough workers the wall time approaches the path instead of the sum.
+void Sys_TaskGraphBenchmark_f(void)
+{
+	SysTaskGraph* graph;
+	unsigned long long serialNsec;
+	unsigned long long wallNsec;
+	int stageCount;
+	int i;
+
+	graph = new SysTaskGraph;
+	Sys_InitTaskGraph(graph);
+	stageCount = sizeof(s_graphBenchStages) / sizeof(s_graphBenchStages[0]);
+	serialNsec = 0;
+	for (i = 0; i < stageCount; ++i)
+	{
+		Sys_AddGraphTask(graph, s_graphBenchStages[i].name, Graph_BenchWork, &s_graphBenchStages[i], s_graphBenchStages[i].after);
+		serialNsec += (unsigned long long)s_graphBenchStages[i].usec * 1000;
+	}
+
+	wallNsec = 0;
+	for (i = 0; i < GRAPH_BENCH_FRAMES; ++i)
+	{
+		Sys_RunTaskGraph(graph);
+		wallNsec += graph->frameEndNsec - graph->frameStartNsec;
+	}
+
+	Com_Printf(CON_CHANNEL_SYSTEM, "%d frames on %u job workers: %.3f ms average, %.3f ms if run serially\n",
+		GRAPH_BENCH_FRAMES, Sys_GetJobWorkerCount(), wallNsec / 1000000.0 / GRAPH_BENCH_FRAMES, serialNsec / 1000000.0);
+	Sys_PrintTaskGraph(graph);
+	delete graph;
+}
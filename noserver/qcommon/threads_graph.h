@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADS_GRAPH_H
+#define THREADS_GRAPH_H
+
+#include <qcommon/threads_jobs.h>
+
+#include <atomic>
+
+// one bit per task in the dependency masks
+#define SYS_GRAPH_MAX_TASKS 64
+
+struct SysTaskGraph;
+
+typedef struct SysGraphTask
+{
+	char const* name;
+	SysJobFunc func;
+	void* data;
+	struct SysTaskGraph* graph;
+	unsigned long long dependencies;
+	unsigned long long dependents;
+	int dependencyCount;
+	std::atomic<int> remaining;
+	unsigned long long startNsec;
+	unsigned long long endNsec;
+	unsigned long long totalNsec;
+	unsigned int criticalFrames;
+} SysGraphTask;
+
+typedef struct SysGraphPath
+{
+	int tasks[SYS_GRAPH_MAX_TASKS];
+	int count;
+	unsigned long long pathNsec;
+	unsigned long long workNsec;
+	unsigned long long frameNsec;
+} SysGraphPath;
+
+// A fixed set of tasks run once per frame. A task can only depend on tasks
+// added before it, so the graph is acyclic by construction and the order of
+// addition is a valid serial order.
+typedef struct SysTaskGraph
+{
+	SysGraphTask tasks[SYS_GRAPH_MAX_TASKS];
+	int taskCount;
+	SysJobCounter counter;
+	unsigned int frameCount;
+	unsigned long long frameStartNsec;
+	unsigned long long frameEndNsec;
+	SysGraphPath criticalPath;
+} SysTaskGraph;
+
+void Sys_InitTaskGraph(SysTaskGraph* graph);
+int Sys_AddGraphTask(SysTaskGraph* graph, char const* name, SysJobFunc func, void* data, char const* const* after);
+int Sys_FindGraphTask(SysTaskGraph const* graph, char const* name);
+void Sys_RunTaskGraph(SysTaskGraph* graph);
+void Sys_PrintTaskGraph(SysTaskGraph const* graph);
+void Sys_TaskGraphBenchmark_f(void);
+
+#endif // THREADS_GRAPH_H
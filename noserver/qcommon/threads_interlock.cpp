@@ -0,0 +1,386 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threads_interlock.h"
+
+#include <qcommon/common.h>
+
+#include <chrono>
+#include <thread>
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+#define FCS_SPIN_ROUNDS 7
+#define FCS_YIELD_ROUNDS 4
+
+thread_local FastCriticalSectionHeld g_readLocksHeld;
+
+typedef bool (*FastCriticalSectionBlocked)(FastCriticalSection* critSect);
+
+static bool Sys_IsReadBlocked(FastCriticalSection* critSect)
+{
+    if (Sys_HoldsReadLock(critSect))
+        return critSect->writeOwner.load(std::memory_order_seq_cst) == FCS_WRITER_ACTIVE;
+    return critSect->writeCount.load(std::memory_order_seq_cst) != 0;
+}
+
+static bool Sys_IsWriteOwnerBlocked(FastCriticalSection* critSect)
+{
+    return critSect->writeOwner.load(std::memory_order_seq_cst) != FCS_WRITER_NONE;
+}
+
+static bool Sys_IsWriteDrainBlocked(FastCriticalSection* critSect)
+{
+    return critSect->readCount.load(std::memory_order_seq_cst) != 0;
+}
+
+static void Sys_LockBackoff(FastCriticalSection* critSect, int* attempt, FastCriticalSectionBlocked blocked)
+{
+    int sequence;
+    int spins;
+    int i;
+
+    if (*attempt < FCS_SPIN_ROUNDS)
+    {
+        spins = 1 << *attempt;
+        for (i = 0; i < spins; ++i)
+            Sys_Pause();
+    }
+    else if (*attempt < FCS_SPIN_ROUNDS + FCS_YIELD_ROUNDS)
+    {
+        std::this_thread::yield();
+    }
+    else
+    {
+        // publish the park before sampling the sequence so a concurrent
+        // unlock either sees us or bumps the sequence we compare against
+        critSect->parkedCount.fetch_add(1, std::memory_order_seq_cst);
+        sequence = critSect->wakeSequence.load(std::memory_order_seq_cst);
+        if (blocked(critSect))
+        {
+            if (critSect->stats)
+                critSect->stats->parks.fetch_add(1, std::memory_order_relaxed);
+            Sys_WaitOnAddress(&critSect->wakeSequence, sequence, SYS_WAIT_INFINITE);
+        }
+        critSect->parkedCount.fetch_sub(1, std::memory_order_seq_cst);
+    }
+    ++*attempt;
+}
+
+void Sys_WakeLockWaiters(FastCriticalSection* critSect)
+{
+    critSect->wakeSequence.fetch_add(1, std::memory_order_seq_cst);
+    if (critSect->parkedCount.load(std::memory_order_seq_cst))
+        Sys_WakeAddressAll(&critSect->wakeSequence);
+}
+
+void Sys_PushReadLock(FastCriticalSection* critSect)
+{
+    if (g_readLocksHeld.count == FCS_MAX_HELD_READ_LOCKS)
+        Com_Error(ERR_FATAL, "Sys_LockRead: more than %i read locks held by one thread", FCS_MAX_HELD_READ_LOCKS);
+    g_readLocksHeld.locks[g_readLocksHeld.count++] = critSect;
+}
+
+void Sys_LockReadContended(FastCriticalSection* critSect)
+{
+    int attempt;
+
+    if (critSect->stats)
+        critSect->stats->readContended.fetch_add(1, std::memory_order_relaxed);
+    attempt = 0;
+    do
+    {
+        Sys_LockBackoff(critSect, &attempt, Sys_IsReadBlocked);
+    } while (!Sys_TryLockRead(critSect));
+}
+
+void Sys_LockWrite(FastCriticalSection* critSect)
+{
+    int attempt;
+    int expected;
+    bool contended;
+
+    contended = false;
+    critSect->writeCount.fetch_add(1, std::memory_order_seq_cst);
+
+    // one writer at a time gets to drain the readers
+    attempt = 0;
+    while (1)
+    {
+        expected = FCS_WRITER_NONE;
+        if (critSect->writeOwner.compare_exchange_strong(expected, FCS_WRITER_PENDING, std::memory_order_seq_cst))
+            break;
+        contended = true;
+        Sys_LockBackoff(critSect, &attempt, Sys_IsWriteOwnerBlocked);
+    }
+
+    attempt = 0;
+    while (1)
+    {
+        if (!critSect->readCount.load(std::memory_order_seq_cst))
+        {
+            critSect->writeOwner.store(FCS_WRITER_ACTIVE, std::memory_order_seq_cst);
+            if (!critSect->readCount.load(std::memory_order_seq_cst))
+                break;
+            critSect->writeOwner.store(FCS_WRITER_PENDING, std::memory_order_seq_cst);
+        }
+        contended = true;
+        Sys_LockBackoff(critSect, &attempt, Sys_IsWriteDrainBlocked);
+    }
+
+    if (critSect->stats)
+    {
+        critSect->stats->writeLocks.fetch_add(1, std::memory_order_relaxed);
+        if (contended)
+            critSect->stats->writeContended.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Sys_UnlockWrite(FastCriticalSection* critSect)
+{
+    critSect->writeOwner.store(FCS_WRITER_NONE, std::memory_order_seq_cst);
+    critSect->writeCount.fetch_sub(1, std::memory_order_seq_cst);
+    Sys_WakeLockWaiters(critSect);
+}
+
+void Sys_PrintLockStats(char const* name, FastCriticalSectionStats const* stats)
+{
+    Com_Printf(CON_CHANNEL_SYSTEM, "%s: %u reads (%u contended), %u writes (%u contended), %u parks\n",
+        name,
+        stats->readLocks.load(std::memory_order_relaxed),
+        stats->readContended.load(std::memory_order_relaxed),
+        stats->writeLocks.load(std::memory_order_relaxed),
+        stats->writeContended.load(std::memory_order_relaxed),
+        stats->parks.load(std::memory_order_relaxed));
+}
+
+#define RWLOCK_BENCH_READERS 12
+#define RWLOCK_BENCH_WRITERS 2
+#define RWLOCK_BENCH_MSEC 1000
+#define RWLOCK_BENCH_VALUES 64
+
+static FastCriticalSection s_benchLock;
+static FastCriticalSectionStats s_benchLockStats;
+static int s_benchValues[RWLOCK_BENCH_VALUES];
+static std::atomic<bool> s_benchQuit;
+static std::atomic<unsigned int> s_benchTornReads;
+static std::atomic<long long> s_benchMaxWriteWaitUsec;
+
+static void Sys_RWLockBenchReader(unsigned int* reads)
+{
+    int first;
+    int i;
+
+    while (!s_benchQuit.load(std::memory_order_relaxed))
+    {
+        Sys_LockRead(&s_benchLock);
+        first = s_benchValues[0];
+        for (i = 1; i < RWLOCK_BENCH_VALUES; ++i)
+        {
+            if (s_benchValues[i] != first)
+            {
+                s_benchTornReads.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+        }
+        Sys_UnlockRead(&s_benchLock);
+        ++*reads;
+    }
+}
+
+static void Sys_RWLockBenchWriter(unsigned int* writes)
+{
+    std::chrono::steady_clock::time_point start;
+    long long waited;
+    long long maxWait;
+    int i;
+
+    while (!s_benchQuit.load(std::memory_order_relaxed))
+    {
+        start = std::chrono::steady_clock::now();
+        Sys_LockWrite(&s_benchLock);
+        waited = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        for (i = 0; i < RWLOCK_BENCH_VALUES; ++i)
+            ++s_benchValues[i];
+        Sys_UnlockWrite(&s_benchLock);
+        ++*writes;
+
+        maxWait = s_benchMaxWriteWaitUsec.load(std::memory_order_relaxed);
+        while (waited > maxWait && !s_benchMaxWriteWaitUsec.compare_exchange_weak(maxWait, waited))
+        {
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+void Sys_RWLockBenchmark_f(void)
+{
+    std::thread threads[RWLOCK_BENCH_READERS + RWLOCK_BENCH_WRITERS];
+    unsigned int counts[RWLOCK_BENCH_READERS + RWLOCK_BENCH_WRITERS];
+    unsigned int reads;
+    unsigned int writes;
+    int i;
+
+    s_benchLockStats.readLocks.store(0);
+    s_benchLockStats.readContended.store(0);
+    s_benchLockStats.writeLocks.store(0);
+    s_benchLockStats.writeContended.store(0);
+    s_benchLockStats.parks.store(0);
+    s_benchLock.stats = &s_benchLockStats;
+    s_benchQuit.store(false);
+    s_benchTornReads.store(0);
+    s_benchMaxWriteWaitUsec.store(0);
+    for (i = 0; i < RWLOCK_BENCH_READERS + RWLOCK_BENCH_WRITERS; ++i)
+    {
+        counts[i] = 0;
+        if (i < RWLOCK_BENCH_READERS)
+            threads[i] = std::thread(Sys_RWLockBenchReader, &counts[i]);
+        else
+            threads[i] = std::thread(Sys_RWLockBenchWriter, &counts[i]);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(RWLOCK_BENCH_MSEC));
+    s_benchQuit.store(true);
+
+    reads = 0;
+    writes = 0;
+    for (i = 0; i < RWLOCK_BENCH_READERS + RWLOCK_BENCH_WRITERS; ++i)
+    {
+        threads[i].join();
+        if (i < RWLOCK_BENCH_READERS)
+            reads += counts[i];
+        else
+            writes += counts[i];
+    }
+
+    Com_Printf(CON_CHANNEL_SYSTEM, "%d readers, %d writers for %d msec\n", RWLOCK_BENCH_READERS, RWLOCK_BENCH_WRITERS, RWLOCK_BENCH_MSEC);
+    Com_Printf(CON_CHANNEL_SYSTEM, "%u reads, %u writes, max write wait %lld usec, %u torn reads\n",
+        reads, writes, s_benchMaxWriteWaitUsec.load(), s_benchTornReads.load());
+    Sys_PrintLockStats("bench lock", &s_benchLockStats);
+    s_benchLock.stats = 0;
+}
+
+#define INTERLOCK_BENCH_THREADS 4
+#define INTERLOCK_BENCH_WAITS 100
+
+typedef void (*InterlockBenchAcquire)(volatile int* destination, int value, int comperand);
+typedef void (*InterlockBenchRelease)(volatile int* destination, int value);
+
+typedef struct InterlockBenchMode
+{
+    char const* name;
+    InterlockBenchAcquire acquire;
+    InterlockBenchRelease release;
+} InterlockBenchMode;
+
+static volatile int s_benchInterlock;
+static std::atomic<unsigned long long> s_benchCpuNsec;
+
+static unsigned long long Sys_ThreadCpuNsec(void)
+{
+#ifdef _WIN32
+    FILETIME creation;
+    FILETIME exit;
+    FILETIME kernel;
+    FILETIME user;
+
+    GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+    return ((((unsigned long long)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime)
+        + (((unsigned long long)user.dwHighDateTime << 32) | user.dwLowDateTime)) * 100;
+#else
+    timespec now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ull + now.tv_nsec;
+#endif
+}
+
+// The loop Sys_WaitInterlockedCompareExchange used to be.
+static void Sys_BenchSpinCompareExchange(volatile int* destination, int value, int comperand)
+{
+    std::atomic<int>* address;
+    int expected;
+
+    address = reinterpret_cast<std::atomic<int>*>(const_cast<int*>(destination));
+    do
+    {
+        while (address->load(std::memory_order_relaxed) != comperand)
+        {
+        }
+        expected = comperand;
+    } while (!address->compare_exchange_strong(expected, value, std::memory_order_acq_rel, std::memory_order_relaxed));
+}
+
+static void Sys_BenchSpinRelease(volatile int* destination, int value)
+{
+    reinterpret_cast<std::atomic<int>*>(const_cast<int*>(destination))->store(value, std::memory_order_release);
+}
+
+static void Sys_InterlockBenchThread(InterlockBenchMode const* mode, unsigned int holdUsec)
+{
+    unsigned long long cpuStart;
+    int i;
+
+    cpuStart = Sys_ThreadCpuNsec();
+    for (i = 0; i < INTERLOCK_BENCH_WAITS; ++i)
+    {
+        mode->acquire(&s_benchInterlock, 1, 0);
+        if (holdUsec)
+            std::this_thread::sleep_for(std::chrono::microseconds(holdUsec));
+        mode->release(&s_benchInterlock, 0);
+    }
+    s_benchCpuNsec.fetch_add(Sys_ThreadCpuNsec() - cpuStart, std::memory_order_relaxed);
+}
+
+// Threads pass a flag around, each holding it for a while; CPU time is what
+// the threads burned per acquire, which is nearly all waiting.
+void Sys_InterlockWaitBenchmark_f(void)
+{
+    static const InterlockBenchMode modes[] =
+    {
+        { "spin", Sys_BenchSpinCompareExchange, Sys_BenchSpinRelease },
+        { "spin-park", Sys_WaitInterlockedCompareExchange, Sys_InterlockedExchangeAndWake },
+    };
+    static const unsigned int holdUsec[] = { 0, 200, 2000 };
+    std::thread threads[INTERLOCK_BENCH_THREADS];
+    std::chrono::steady_clock::time_point start;
+    double seconds;
+    unsigned int waits;
+    unsigned int h;
+    unsigned int m;
+    int i;
+
+    waits = INTERLOCK_BENCH_THREADS * INTERLOCK_BENCH_WAITS;
+    Com_Printf(CON_CHANNEL_SYSTEM, "%d threads, %d waits each\n", INTERLOCK_BENCH_THREADS, INTERLOCK_BENCH_WAITS);
+    Com_Printf(CON_CHANNEL_SYSTEM, "mode        hold us   wall ms   cpu us/wait\n");
+    for (h = 0; h < sizeof(holdUsec) / sizeof(holdUsec[0]); ++h)
+    {
+        for (m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m)
+        {
+            s_benchInterlock = 0;
+            s_benchCpuNsec.store(0);
+            start = std::chrono::steady_clock::now();
+            for (i = 0; i < INTERLOCK_BENCH_THREADS; ++i)
+                threads[i] = std::thread(Sys_InterlockBenchThread, &modes[m], holdUsec[h]);
+            for (i = 0; i < INTERLOCK_BENCH_THREADS; ++i)
+                threads[i].join();
+            seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            Com_Printf(CON_CHANNEL_SYSTEM, "%-10s %8u %9.1f %13.1f\n",
+                modes[m].name, holdUsec[h], seconds * 1000.0, s_benchCpuNsec.load() / 1000.0 / waits);
+        }
+    }
+}
@@ -19,48 +19,164 @@
 
 #include <Windows.h>
 #include <qcommon/threads.h>
+#include <qcommon/threads_wait.h>
 
+#define SYS_INTERLOCK_SPIN_ROUNDS 10
+#define SYS_INTERLOCK_PARK_MSEC 1
+
+enum FastCriticalSectionWriter
+{
+    FCS_WRITER_NONE = 0x0,
+    FCS_WRITER_PENDING = 0x1,
+    FCS_WRITER_ACTIVE = 0x2,
+};
+
+typedef struct FastCriticalSectionStats
+{
+    std::atomic<unsigned int> readLocks;
+    std::atomic<unsigned int> readContended;
+    std::atomic<unsigned int> writeLocks;
+    std::atomic<unsigned int> writeContended;
+    std::atomic<unsigned int> parks;
+} FastCriticalSectionStats;
+
+// Writer-preferring reader/writer lock. writeCount counts writers that hold
+// or wait for the lock so new readers back off as soon as one shows up;
+// blocked threads spin with exponential backoff, then park on wakeSequence.
 typedef struct FastCriticalSection
 {
-    volatile long readCount;
-    volatile long writeCount;
+    std::atomic<int> readCount;
+    std::atomic<int> writeCount;
+    std::atomic<int> writeOwner;
+    std::atomic<int> wakeSequence;
+    std::atomic<int> parkedCount;
+    FastCriticalSectionStats* stats;
 } FastCriticalSection;
 
-static void Sys_LockWrite(FastCriticalSection* critSect)
+#define FCS_MAX_HELD_READ_LOCKS 16
+
+// Read locks held by this thread, once per hold. A reader re-entering a lock
+// it already holds may pass that lock's draining writer instead of
+// deadlocking against it; holding some other lock doesn't let it.
+typedef struct FastCriticalSectionHeld
 {
-    while (1)
+    FastCriticalSection* locks[FCS_MAX_HELD_READ_LOCKS];
+    int count;
+} FastCriticalSectionHeld;
+
+extern thread_local FastCriticalSectionHeld g_readLocksHeld;
+
+void Sys_WakeLockWaiters(FastCriticalSection* critSect);
+void Sys_PushReadLock(FastCriticalSection* critSect);
+void Sys_LockReadContended(FastCriticalSection* critSect);
+void Sys_LockWrite(FastCriticalSection* critSect);
+void Sys_UnlockWrite(FastCriticalSection* critSect);
+void Sys_PrintLockStats(char const* name, FastCriticalSectionStats const* stats);
+void Sys_RWLockBenchmark_f(void);
+void Sys_InterlockWaitBenchmark_f(void);
+
+static bool Sys_HoldsReadLock(FastCriticalSection* critSect)
+{
+    int i;
+
+    for (i = 0; i < g_readLocksHeld.count; ++i)
+    {
+        if (g_readLocksHeld.locks[i] == critSect)
+            return true;
+    }
+    return false;
+}
+
+static void Sys_PopReadLock(FastCriticalSection* critSect)
+{
+    int i;
+
+    for (i = g_readLocksHeld.count - 1; i >= 0; --i)
     {
-        if (!critSect->readCount)
+        if (g_readLocksHeld.locks[i] == critSect)
         {
-            if (_InterlockedIncrement(&critSect->writeCount) == 1 && !critSect->readCount)
-                //if ( Sys_InterlockedIncrement(&critSect->writeCount) == 1 && !critSect->readCount )
-            {
-                break;
-            }
-            _InterlockedDecrement(&critSect->writeCount);
+            g_readLocksHeld.locks[i] = g_readLocksHeld.locks[--g_readLocksHeld.count];
+            return;
         }
-        NET_Sleep(0);
     }
 }
 
-static void Sys_UnlockWrite(FastCriticalSection* critSect)
+static bool Sys_TryLockRead(FastCriticalSection* critSect)
 {
-    _InterlockedDecrement(&critSect->writeCount);
+    bool acquired;
+
+    critSect->readCount.fetch_add(1, std::memory_order_seq_cst);
+    if (Sys_HoldsReadLock(critSect))
+        acquired = critSect->writeOwner.load(std::memory_order_seq_cst) != FCS_WRITER_ACTIVE;
+    else
+        acquired = !critSect->writeCount.load(std::memory_order_seq_cst);
+    if (acquired)
+    {
+        Sys_PushReadLock(critSect);
+        if (critSect->stats)
+            critSect->stats->readLocks.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    if (critSect->readCount.fetch_sub(1, std::memory_order_seq_cst) == 1)
+        Sys_WakeLockWaiters(critSect);
+    return false;
+}
+
+static void Sys_LockRead(FastCriticalSection* critSect)
+{
+    if (!Sys_TryLockRead(critSect))
+        Sys_LockReadContended(critSect);
 }
 
 static void Sys_UnlockRead(FastCriticalSection* critSect)
 {
-    _InterlockedDecrement(&critSect->readCount);
+    Sys_PopReadLock(critSect);
+    if (critSect->readCount.fetch_sub(1, std::memory_order_seq_cst) == 1 && critSect->writeCount.load(std::memory_order_seq_cst))
+        Sys_WakeLockWaiters(critSect);
 }
 
+// Spins with exponential pause backoff while another cpu can be releasing
+// the value, then parks on its address. The park times out after
+// SYS_INTERLOCK_PARK_MSEC so writers that store without waking are still
+// seen; Sys_InterlockedExchangeAndWake releases parked waiters at once.
 static void Sys_WaitInterlockedCompareExchange(volatile int* destination, int value, int comperand)
 {
-    do
+    std::atomic<int>* address;
+    int observed;
+    int attempt;
+    int i;
+
+    address = reinterpret_cast<std::atomic<int>*>(const_cast<int*>(destination));
+    attempt = 0;
+    while (1)
     {
-        while (*destination != comperand)
+        observed = address->load(std::memory_order_acquire);
+        if (observed == comperand)
         {
+            if (address->compare_exchange_strong(observed, value, std::memory_order_acq_rel, std::memory_order_relaxed))
+                return;
+            continue;
         }
-    }     while (_InterlockedCompareExchange((volatile LONG*)destination, value, comperand) != comperand);
+        if (attempt < SYS_INTERLOCK_SPIN_ROUNDS && Sys_GetSpinCount())
+        {
+            for (i = 0; i < (1 << attempt); ++i)
+                Sys_Pause();
+            ++attempt;
+        }
+        else
+        {
+            Sys_WaitOnAddress(address, observed, SYS_INTERLOCK_PARK_MSEC);
+        }
+    }
+}
+
+static void Sys_InterlockedExchangeAndWake(volatile int* destination, int value)
+{
+    std::atomic<int>* address;
+
+    address = reinterpret_cast<std::atomic<int>*>(const_cast<int*>(destination));
+    address->exchange(value, std::memory_order_seq_cst);
+    Sys_WakeAddressAll(address);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,839 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threads_jobs.h"
+
+#include <universal/q_shared.h>
+#include <universal/com_vector.h>
+#include <universal/com_math.h>
+#include <qcommon/threads.h>
+#include <qcommon/common.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include <immintrin.h>
+
+#define JOB_DEQUE_SIZE 4096
+#define JOB_DEQUE_MASK (JOB_DEQUE_SIZE - 1)
+#define JOB_INJECT_SIZE 4096
+#define JOB_INJECT_MASK (JOB_INJECT_SIZE - 1)
+#define JOB_IDLE_SPINS 256
+// with no grain given, aim for this many chunks per participant
+#define PARALLEL_CHUNKS_PER_WORKER 16
+
+typedef struct SysJob
+{
+	SysJobFunc func;
+	void* data;
+	SysJobCounter* counter;
+} SysJob;
+
+// A job held by value in the deque. A thief may read a slot the owner is
+// refilling, so every field is atomic; the thief's claim on top fails in
+// that case and the torn copy is thrown away.
+typedef struct JobEntry
+{
+	std::atomic<SysJobFunc> func;
+	std::atomic<void*> data;
+	std::atomic<SysJobCounter*> counter;
+} JobEntry;
+
+// Chase-Lev work-stealing deque. The owning worker pushes and pops at the
+// bottom, every other thread steals from the top.
+typedef struct alignas(64) JobDeque
+{
+	std::atomic<int> top;
+	char pad0[60];
+	std::atomic<int> bottom;
+	char pad1[60];
+	JobEntry entries[JOB_DEQUE_SIZE];
+} JobDeque;
+
+typedef struct alignas(64) JobWorker
+{
+	JobDeque deque;
+	unsigned int stealSeed;
+	int index;
+	std::thread thread;
+} JobWorker;
+
+typedef struct JobSystem
+{
+	JobWorker* workers[MAX_JOB_WORKERS];
+	unsigned int workerCount;
+	std::atomic<unsigned int> activeWorkerCount;
+	std::atomic<int> queuedJobs;
+	std::atomic<int> sleepingWorkers;
+	std::atomic<bool> quit;
+	std::mutex wakeMutex;
+	std::condition_variable wakeCond;
+	std::mutex injectMutex;
+	SysJob injectQueue[JOB_INJECT_SIZE];
+	unsigned int injectHead;
+	unsigned int injectTail;
+} JobSystem;
+
+static JobSystem s_jobSystem;
+static thread_local JobWorker* s_currentJobWorker;
+
+static bool Job_Push(JobDeque* deque, SysJob const* job)
+{
+	JobEntry* entry;
+	int bottom;
+	int top;
+
+	bottom = deque->bottom.load(std::memory_order_relaxed);
+	top = deque->top.load(std::memory_order_acquire);
+	if (bottom - top >= JOB_DEQUE_SIZE)
+		return false;
+	entry = &deque->entries[bottom & JOB_DEQUE_MASK];
+	entry->func.store(job->func, std::memory_order_relaxed);
+	entry->data.store(job->data, std::memory_order_relaxed);
+	entry->counter.store(job->counter, std::memory_order_relaxed);
+	deque->bottom.store(bottom + 1, std::memory_order_release);
+	return true;
+}
+
+static void Job_ReadEntry(JobEntry const* entry, SysJob* out)
+{
+	out->func = entry->func.load(std::memory_order_relaxed);
+	out->data = entry->data.load(std::memory_order_relaxed);
+	out->counter = entry->counter.load(std::memory_order_relaxed);
+}
+
+// Pop and steal copy the job out of its slot, since the owner refills the
+// slot once the entry has left the deque.
+static bool Job_Pop(JobDeque* deque, SysJob* out)
+{
+	int bottom;
+	int top;
+	bool popped;
+
+	bottom = deque->bottom.load(std::memory_order_relaxed) - 1;
+	deque->bottom.store(bottom, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	top = deque->top.load(std::memory_order_relaxed);
+	if (top > bottom)
+	{
+		deque->bottom.store(bottom + 1, std::memory_order_relaxed);
+		return false;
+	}
+	Job_ReadEntry(&deque->entries[bottom & JOB_DEQUE_MASK], out);
+	popped = true;
+	if (top == bottom)
+	{
+		// last entry, race any thief for it
+		if (!deque->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			popped = false;
+		deque->bottom.store(bottom + 1, std::memory_order_relaxed);
+	}
+	return popped;
+}
+
+// The copy is taken before the claim. The owner only refills the slot at top
+// once top has moved past it, so a won claim proves the copy is the entry
+// that was claimed.
+static bool Job_Steal(JobDeque* deque, SysJob* out)
+{
+	int top;
+	int bottom;
+
+	top = deque->top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	bottom = deque->bottom.load(std::memory_order_acquire);
+	if (top >= bottom)
+		return false;
+	Job_ReadEntry(&deque->entries[top & JOB_DEQUE_MASK], out);
+	return deque->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+static void Job_Execute(SysJob const* job)
+{
+	job->func(job->data);
+	if (job->counter)
+		job->counter->pending.fetch_sub(1, std::memory_order_release);
+}
+
+static void Job_WakeWorkers(int count)
+{
+	s_jobSystem.queuedJobs.fetch_add(count, std::memory_order_seq_cst);
+	if (s_jobSystem.sleepingWorkers.load(std::memory_order_seq_cst))
+	{
+		std::lock_guard<std::mutex> lock(s_jobSystem.wakeMutex);
+		if (count == 1)
+			s_jobSystem.wakeCond.notify_one();
+		else
+			s_jobSystem.wakeCond.notify_all();
+	}
+}
+
+static bool Job_PopInjected(SysJob* out)
+{
+	std::lock_guard<std::mutex> lock(s_jobSystem.injectMutex);
+
+	if (s_jobSystem.injectHead == s_jobSystem.injectTail)
+		return false;
+	*out = s_jobSystem.injectQueue[s_jobSystem.injectTail++ & JOB_INJECT_MASK];
+	return true;
+}
+
+static bool Job_TryRunOne(JobWorker* self)
+{
+	SysJob job;
+	unsigned int workerCount;
+	unsigned int start;
+	unsigned int i;
+
+	if (self)
+	{
+		if (Job_Pop(&self->deque, &job))
+		{
+			s_jobSystem.queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+			Job_Execute(&job);
+			return true;
+		}
+	}
+
+	if (Job_PopInjected(&job))
+	{
+		s_jobSystem.queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+		Job_Execute(&job);
+		return true;
+	}
+
+	workerCount = s_jobSystem.workerCount;
+	if (!workerCount)
+		return false;
+	if (self)
+	{
+		// xorshift so thieves don't all hammer the same victim
+		self->stealSeed ^= self->stealSeed << 13;
+		self->stealSeed ^= self->stealSeed >> 17;
+		self->stealSeed ^= self->stealSeed << 5;
+		start = self->stealSeed % workerCount;
+	}
+	else
+	{
+		start = 0;
+	}
+	for (i = 0; i < workerCount; ++i)
+	{
+		JobWorker* victim = s_jobSystem.workers[(start + i) % workerCount];
+		if (victim == self)
+			continue;
+		if (Job_Steal(&victim->deque, &job))
+		{
+			s_jobSystem.queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+			Job_Execute(&job);
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool Job_ShouldWake(JobWorker* self)
+{
+	if (s_jobSystem.quit.load(std::memory_order_seq_cst))
+		return true;
+	if ((unsigned int)self->index >= s_jobSystem.activeWorkerCount.load(std::memory_order_relaxed))
+		return false;
+	return s_jobSystem.queuedJobs.load(std::memory_order_seq_cst) > 0;
+}
+
+static void Job_WorkerMain(JobWorker* self)
+{
+	int spins;
+
+	s_currentJobWorker = self;
+	Sys_InitJobWorkerThread(self->index);
+	spins = 0;
+	while (!s_jobSystem.quit.load(std::memory_order_relaxed))
+	{
+		if ((unsigned int)self->index < s_jobSystem.activeWorkerCount.load(std::memory_order_relaxed) && Job_TryRunOne(self))
+		{
+			spins = 0;
+			continue;
+		}
+		if (++spins < JOB_IDLE_SPINS)
+		{
+			_mm_pause();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(s_jobSystem.wakeMutex);
+		s_jobSystem.sleepingWorkers.fetch_add(1, std::memory_order_seq_cst);
+		s_jobSystem.wakeCond.wait(lock, [self] { return Job_ShouldWake(self); });
+		s_jobSystem.sleepingWorkers.fetch_sub(1, std::memory_order_seq_cst);
+		spins = 0;
+	}
+	Sys_ShutdownJobWorkerThread();
+}
+
+void Sys_InitJobSystem(unsigned int workerCount)
+{
+	unsigned int i;
+	JobWorker* worker;
+
+	if (s_jobSystem.workerCount)
+		return;
+	if (workerCount < 1)
+		workerCount = 1;
+	if (workerCount > MAX_JOB_WORKERS)
+		workerCount = MAX_JOB_WORKERS;
+
+	s_jobSystem.quit.store(false);
+	s_jobSystem.queuedJobs.store(0);
+	s_jobSystem.sleepingWorkers.store(0);
+	s_jobSystem.injectHead = 0;
+	s_jobSystem.injectTail = 0;
+	for (i = 0; i < workerCount; ++i)
+	{
+		worker = new JobWorker;
+		worker->deque.top.store(0);
+		worker->deque.bottom.store(0);
+		worker->stealSeed = 0x9E3779B9u * (i + 1);
+		worker->index = i;
+		s_jobSystem.workers[i] = worker;
+	}
+	s_jobSystem.workerCount = workerCount;
+	s_jobSystem.activeWorkerCount.store(workerCount);
+
+	// slot 0 belongs to the thread that owns the job system; it runs jobs
+	// while it waits on a counter instead of getting a thread of its own
+	s_currentJobWorker = s_jobSystem.workers[0];
+	for (i = 1; i < workerCount; ++i)
+	{
+		worker = s_jobSystem.workers[i];
+		worker->thread = std::thread(Job_WorkerMain, worker);
+	}
+	Com_Printf(CON_CHANNEL_SYSTEM, "Job system started with %u workers\n", workerCount);
+}
+
+void Sys_ShutdownJobSystem(void)
+{
+	unsigned int i;
+
+	if (!s_jobSystem.workerCount)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(s_jobSystem.wakeMutex);
+		s_jobSystem.quit.store(true, std::memory_order_seq_cst);
+		s_jobSystem.wakeCond.notify_all();
+	}
+	for (i = 1; i < s_jobSystem.workerCount; ++i)
+	{
+		if (s_jobSystem.workers[i]->thread.joinable())
+			s_jobSystem.workers[i]->thread.join();
+	}
+	for (i = 0; i < s_jobSystem.workerCount; ++i)
+	{
+		delete s_jobSystem.workers[i];
+		s_jobSystem.workers[i] = 0;
+	}
+	s_jobSystem.workerCount = 0;
+	s_currentJobWorker = 0;
+}
+
+unsigned int Sys_GetJobWorkerCount(void)
+{
+	return s_jobSystem.workerCount;
+}
+
+int Sys_GetJobWorkerIndex(void)
+{
+	if (!s_currentJobWorker)
+		return -1;
+	return s_currentJobWorker->index;
+}
+
+void Sys_SubmitJobs(SysJobDecl const* jobs, int count, SysJobCounter* counter)
+{
+	JobWorker* self;
+	SysJob* job;
+	SysJob queued;
+	SysJob overflow;
+	int pushed;
+	int i;
+
+	if (count <= 0)
+		return;
+	if (counter)
+		counter->pending.fetch_add(count, std::memory_order_relaxed);
+
+	if (!s_jobSystem.workerCount)
+	{
+		for (i = 0; i < count; ++i)
+		{
+			overflow.func = jobs[i].func;
+			overflow.data = jobs[i].data;
+			overflow.counter = counter;
+			Job_Execute(&overflow);
+		}
+		return;
+	}
+
+	pushed = 0;
+	self = s_currentJobWorker;
+	if (self)
+	{
+		for (i = 0; i < count; ++i)
+		{
+			queued.func = jobs[i].func;
+			queued.data = jobs[i].data;
+			queued.counter = counter;
+			if (!Job_Push(&self->deque, &queued))
+				break;
+			++pushed;
+		}
+	}
+	else
+	{
+		std::lock_guard<std::mutex> lock(s_jobSystem.injectMutex);
+		for (i = 0; i < count; ++i)
+		{
+			if (s_jobSystem.injectHead - s_jobSystem.injectTail >= JOB_INJECT_SIZE)
+				break;
+			job = &s_jobSystem.injectQueue[s_jobSystem.injectHead++ & JOB_INJECT_MASK];
+			job->func = jobs[i].func;
+			job->data = jobs[i].data;
+			job->counter = counter;
+			++pushed;
+		}
+	}
+	if (pushed)
+		Job_WakeWorkers(pushed);
+
+	// queue is full, run what is left on the submitting thread
+	for (i = pushed; i < count; ++i)
+	{
+		overflow.func = jobs[i].func;
+		overflow.data = jobs[i].data;
+		overflow.counter = counter;
+		Job_Execute(&overflow);
+	}
+}
+
+void Sys_SubmitJob(SysJobFunc func, void* data, SysJobCounter* counter)
+{
+	SysJobDecl decl;
+
+	decl.func = func;
+	decl.data = data;
+	Sys_SubmitJobs(&decl, 1, counter);
+}
+
+bool Sys_IsCounterDone(SysJobCounter const* counter)
+{
+	return counter->pending.load(std::memory_order_acquire) == 0;
+}
+
+void Sys_WaitForCounter(SysJobCounter* counter)
+{
+	int spins;
+
+	spins = 0;
+	while (counter->pending.load(std::memory_order_acquire))
+	{
+		if (Job_TryRunOne(s_currentJobWorker))
+		{
+			spins = 0;
+			continue;
+		}
+		if (++spins < JOB_IDLE_SPINS)
+			_mm_pause();
+		else
+			std::this_thread::yield();
+	}
+}
+
+typedef struct alignas(64) ParallelPartial
+{
+	unsigned char bytes[SYS_PARALLEL_MAX_RESULT];
+} ParallelPartial;
+
+typedef struct ParallelLoop
+{
+	std::atomic<int> next;
+	std::atomic<int> slot;
+	int end;
+	int grain;
+	int participants;
+	SysParallelForFunc forFunc;
+	SysParallelReduceFunc reduceFunc;
+	void* data;
+	void const* identity;
+	int resultSize;
+	ParallelPartial* partials;
+} ParallelLoop;
+
+// Guided self-scheduling: each claim takes a share of what is left, so the
+// chunks start large and shrink toward the grain, and whoever finishes early
+// picks up the small tail chunks instead of waiting on a slow one.
+static bool Parallel_Claim(ParallelLoop* loop, int* begin, int* end)
+{
+	int start;
+	int remaining;
+	int chunk;
+
+	start = loop->next.load(std::memory_order_relaxed);
+	do
+	{
+		remaining = loop->end - start;
+		if (remaining <= 0)
+			return false;
+		chunk = remaining / (2 * loop->participants);
+		if (chunk < loop->grain)
+			chunk = loop->grain;
+		if (chunk > remaining)
+			chunk = remaining;
+	} while (!loop->next.compare_exchange_weak(start, start + chunk, std::memory_order_relaxed, std::memory_order_relaxed));
+	*begin = start;
+	*end = start + chunk;
+	return true;
+}
+
+static void Parallel_Participant(void* data)
+{
+	ParallelLoop* loop;
+	void* partial;
+	int begin;
+	int end;
+
+	loop = (ParallelLoop*)data;
+	partial = 0;
+	if (loop->reduceFunc)
+	{
+		partial = loop->partials[loop->slot.fetch_add(1, std::memory_order_relaxed)].bytes;
+		memcpy(partial, loop->identity, loop->resultSize);
+	}
+	while (Parallel_Claim(loop, &begin, &end))
+	{
+		if (loop->reduceFunc)
+			loop->reduceFunc(begin, end, loop->data, partial);
+		else
+			loop->forFunc(begin, end, loop->data);
+	}
+}
+
+// Returns how many threads should share the loop, 1 meaning run it inline.
+static int Parallel_GetParticipants(int count, int* grain)
+{
+	int workerCount;
+	int chunks;
+
+	workerCount = (int)s_jobSystem.activeWorkerCount.load(std::memory_order_relaxed);
+	if (!s_jobSystem.workerCount || workerCount < 1)
+		workerCount = 1;
+	if (*grain <= 0)
+	{
+		*grain = count / (workerCount * PARALLEL_CHUNKS_PER_WORKER);
+		if (*grain < 1)
+			*grain = 1;
+	}
+	chunks = count / *grain + (count % *grain != 0);
+	return chunks < workerCount ? chunks : workerCount;
+}
+
+static void Parallel_Run(ParallelLoop* loop)
+{
+	SysJobCounter counter;
+	SysJobDecl helpers[MAX_JOB_WORKERS];
+	int i;
+
+	counter.pending.store(0, std::memory_order_relaxed);
+	for (i = 0; i < loop->participants - 1; ++i)
+	{
+		helpers[i].func = Parallel_Participant;
+		helpers[i].data = loop;
+	}
+	Sys_SubmitJobs(helpers, loop->participants - 1, &counter);
+	// the caller takes a share too, then helps with other jobs until the
+	// helpers it submitted have drained
+	Parallel_Participant(loop);
+	Sys_WaitForCounter(&counter);
+}
+
+// Splits [begin, end) across the job workers and returns once every index has
+// been visited. grain is the smallest chunk handed out; 0 sizes it from the
+// range and the worker count. Bodies may run on any worker, in any order.
+void Sys_ParallelFor(int begin, int end, int grain, SysParallelForFunc func, void* data)
+{
+	ParallelLoop loop;
+
+	if (end <= begin)
+		return;
+	loop.participants = Parallel_GetParticipants(end - begin, &grain);
+	if (loop.participants <= 1)
+	{
+		func(begin, end, data);
+		return;
+	}
+	loop.next.store(begin, std::memory_order_relaxed);
+	loop.slot.store(0, std::memory_order_relaxed);
+	loop.end = end;
+	loop.grain = grain;
+	loop.forFunc = func;
+	loop.reduceFunc = 0;
+	loop.data = data;
+	loop.identity = 0;
+	loop.resultSize = 0;
+	loop.partials = 0;
+	Parallel_Run(&loop);
+}
+
+// result must hold the identity of the reduction on entry. Each participant
+// folds its chunks into a private copy of it, and the partials are joined
+// into result on the calling thread, so func and join need no locking.
+void Sys_ParallelReduce(int begin, int end, int grain, SysParallelReduceFunc func, SysParallelJoinFunc join, void* data, void* result, int resultSize)
+{
+	ParallelLoop loop;
+	ParallelPartial partials[MAX_JOB_WORKERS];
+	int i;
+
+	assert(resultSize > 0 && resultSize <= SYS_PARALLEL_MAX_RESULT);
+	if (end <= begin)
+		return;
+	loop.participants = Parallel_GetParticipants(end - begin, &grain);
+	if (loop.participants <= 1 || resultSize > SYS_PARALLEL_MAX_RESULT)
+	{
+		func(begin, end, data, result);
+		return;
+	}
+	loop.next.store(begin, std::memory_order_relaxed);
+	loop.slot.store(0, std::memory_order_relaxed);
+	loop.end = end;
+	loop.grain = grain;
+	loop.forFunc = 0;
+	loop.reduceFunc = func;
+	loop.data = data;
+	loop.identity = result;
+	loop.resultSize = resultSize;
+	loop.partials = partials;
+	Parallel_Run(&loop);
+
+	// every participant copied the identity before it was overwritten here
+	for (i = 0; i < loop.participants; ++i)
+		join(result, partials[i].bytes, data);
+}
+
+#define JOB_BENCH_DEPTH 16
+#define JOB_BENCH_LEAF_WORK 256
+
+static SysJobCounter s_jobBenchCounter;
+static std::atomic<unsigned int> s_jobBenchSink;
+
+// Each job is a node of a binary tree; inner nodes spawn their two children
+// so the work fans out through the deques and has to be stolen to scale.
+static void Job_BenchNode(void* data)
+{
+	unsigned int node;
+	unsigned int depth;
+	unsigned int value;
+	int i;
+	SysJobDecl children[2];
+
+	node = (unsigned int)(uintptr_t)data;
+	for (depth = 0; (node >> depth) > 1; ++depth)
+	{
+	}
+	if (depth < JOB_BENCH_DEPTH)
+	{
+		children[0].func = Job_BenchNode;
+		children[0].data = (void*)(uintptr_t)(2 * node);
+		children[1].func = Job_BenchNode;
+		children[1].data = (void*)(uintptr_t)(2 * node + 1);
+		Sys_SubmitJobs(children, 2, &s_jobBenchCounter);
+		return;
+	}
+
+	value = node;
+	for (i = 0; i < JOB_BENCH_LEAF_WORK; ++i)
+		value = value * 1664525u + 1013904223u;
+	s_jobBenchSink.fetch_add(value, std::memory_order_relaxed);
+}
+
+void Sys_JobBenchmark_f(void)
+{
+	unsigned int workerCount;
+	unsigned int activeCount;
+	unsigned int jobCount;
+	double seconds;
+	double baseRate;
+	double rate;
+	std::chrono::steady_clock::time_point start;
+
+	workerCount = s_jobSystem.workerCount;
+	if (!workerCount || Sys_GetJobWorkerIndex() != 0)
+	{
+		Com_Printf(CON_CHANNEL_SYSTEM, "Sys_JobBenchmark_f: job system is not running on this thread\n");
+		return;
+	}
+
+	jobCount = (2u << JOB_BENCH_DEPTH) - 1;
+	baseRate = 0.0;
+	Com_Printf(CON_CHANNEL_SYSTEM, "workers      jobs/sec   speedup\n");
+	for (activeCount = 1; activeCount <= workerCount; ++activeCount)
+	{
+		s_jobSystem.activeWorkerCount.store(activeCount, std::memory_order_relaxed);
+		start = std::chrono::steady_clock::now();
+		Sys_SubmitJob(Job_BenchNode, (void*)(uintptr_t)1, &s_jobBenchCounter);
+		Sys_WaitForCounter(&s_jobBenchCounter);
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		rate = jobCount / seconds;
+		if (activeCount == 1)
+			baseRate = rate;
+		Com_Printf(CON_CHANNEL_SYSTEM, "%7u  %12.0f   %6.2fx\n", activeCount, rate, rate / baseRate);
+	}
+	s_jobSystem.activeWorkerCount.store(workerCount, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(s_jobSystem.wakeMutex);
+		s_jobSystem.wakeCond.notify_all();
+	}
+}
+
+#define PARALLEL_BENCH_COUNT (1 << 20)
+#define PARALLEL_BENCH_ROUNDS 4
+
+static void Parallel_BenchHash(int begin, int end, void* data, void* result)
+{
+	unsigned long long sum;
+	unsigned int value;
+	int i;
+	int j;
+
+	sum = 0;
+	for (i = begin; i < end; ++i)
+	{
+		value = (unsigned int)i;
+		for (j = 0; j < 64; ++j)
+			value = value * 1664525u + 1013904223u;
+		sum += value;
+	}
+	*(unsigned long long*)result += sum;
+}
+
+static void Parallel_BenchHashJoin(void* result, void const* partial, void* data)
+{
+	*(unsigned long long*)result += *(unsigned long long const*)partial;
+}
+
+typedef struct ParallelBenchState
+{
+	vec3_t* points;
+	vec3_t* transformed;
+	vec3_t axis[4];
+	vec3_t mins;
+	vec3_t maxs;
+	unsigned long long hash;
+	int grain;
+} ParallelBenchState;
+
+static void Parallel_BenchRunHash(ParallelBenchState* state)
+{
+	state->hash = 0;
+	Sys_ParallelReduce(0, PARALLEL_BENCH_COUNT, state->grain, Parallel_BenchHash, Parallel_BenchHashJoin, 0, &state->hash, sizeof(state->hash));
+}
+
+static void Parallel_BenchRunTransform(ParallelBenchState* state)
+{
+	MatrixTransformVector43Array(state->points, PARALLEL_BENCH_COUNT, state->axis, state->transformed);
+}
+
+static void Parallel_BenchRunBounds(ParallelBenchState* state)
+{
+	BoundsFromPoints(PARALLEL_BENCH_COUNT, state->transformed, &state->mins, &state->maxs);
+}
+
+typedef struct ParallelBenchKernel
+{
+	char const* name;
+	void (*run)(ParallelBenchState* state);
+	int grain;
+} ParallelBenchKernel;
+
+// The hash loop is compute bound and shows how close the split gets to linear;
+// the com_math batches are a few flops per point and run into memory bandwidth.
+void Sys_ParallelBenchmark_f(void)
+{
+	static const ParallelBenchKernel kernels[] =
+	{
+		{ "hash, grain 256", Parallel_BenchRunHash, 256 },
+		{ "hash, adaptive", Parallel_BenchRunHash, 0 },
+		{ "transform43", Parallel_BenchRunTransform, 0 },
+		{ "bounds", Parallel_BenchRunBounds, 0 },
+	};
+	ParallelBenchState state;
+	unsigned int workerCount;
+	unsigned int activeCount;
+	unsigned int k;
+	int i;
+	double seconds;
+	double baseRate;
+	double rate;
+	std::chrono::steady_clock::time_point start;
+
+	workerCount = s_jobSystem.workerCount;
+	if (!workerCount || Sys_GetJobWorkerIndex() != 0)
+	{
+		Com_Printf(CON_CHANNEL_SYSTEM, "Sys_ParallelBenchmark_f: job system is not running on this thread\n");
+		return;
+	}
+
+	state.points = new vec3_t[PARALLEL_BENCH_COUNT];
+	state.transformed = new vec3_t[PARALLEL_BENCH_COUNT];
+	for (i = 0; i < PARALLEL_BENCH_COUNT; ++i)
+	{
+		state.points[i].x = (float)(i & 1023);
+		state.points[i].y = (float)((i >> 10) & 1023);
+		state.points[i].z = (float)(i % 977);
+	}
+	AxisClear(state.axis);
+	state.axis[3].x = 16.0f;
+	state.axis[3].y = -8.0f;
+	state.axis[3].z = 4.0f;
+
+	for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k)
+	{
+		Com_Printf(CON_CHANNEL_SYSTEM, "%s\n", kernels[k].name);
+		Com_Printf(CON_CHANNEL_SYSTEM, "workers    Mitems/sec   speedup\n");
+		state.grain = kernels[k].grain;
+		baseRate = 0.0;
+		for (activeCount = 1; activeCount <= workerCount; ++activeCount)
+		{
+			s_jobSystem.activeWorkerCount.store(activeCount, std::memory_order_relaxed);
+			start = std::chrono::steady_clock::now();
+			for (i = 0; i < PARALLEL_BENCH_ROUNDS; ++i)
+				kernels[k].run(&state);
+			seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			rate = (double)PARALLEL_BENCH_COUNT * PARALLEL_BENCH_ROUNDS / seconds / 1000000.0;
+			if (activeCount == 1)
+				baseRate = rate;
+			Com_Printf(CON_CHANNEL_SYSTEM, "%7u  %12.2f   %6.2fx\n", activeCount, rate, rate / baseRate);
+		}
+	}
+	s_jobSystem.activeWorkerCount.store(workerCount, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(s_jobSystem.wakeMutex);
+		s_jobSystem.wakeCond.notify_all();
+	}
+	delete[] state.points;
+	delete[] state.transformed;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADS_JOBS_H
+#define THREADS_JOBS_H
+
+#include <atomic>
+
+#define MAX_JOB_WORKERS 64
+#define SYS_PARALLEL_MAX_RESULT 64
+
+typedef void (*SysJobFunc)(void* data);
+
+// Runs the loop body over the half-open subrange [begin, end).
+typedef void (*SysParallelForFunc)(int begin, int end, void* data);
+// Folds [begin, end) into result, which starts out as a copy of the identity.
+typedef void (*SysParallelReduceFunc)(int begin, int end, void* data, void* result);
+// Folds one participant's partial result into result.
+typedef void (*SysParallelJoinFunc)(void* result, void const* partial, void* data);
+
+// Counts the jobs of a batch that have not finished yet. A counter must stay
+// alive until Sys_WaitForCounter returns for it.
+typedef struct SysJobCounter
+{
+	std::atomic<int> pending;
+} SysJobCounter;
+
+typedef struct SysJobDecl
+{
+	SysJobFunc func;
+	void* data;
+} SysJobDecl;
+
+void Sys_InitJobSystem(unsigned int workerCount);
+void Sys_ShutdownJobSystem(void);
+unsigned int Sys_GetJobWorkerCount(void);
+int Sys_GetJobWorkerIndex(void);
+void Sys_SubmitJobs(SysJobDecl const* jobs, int count, SysJobCounter* counter);
+void Sys_SubmitJob(SysJobFunc func, void* data, SysJobCounter* counter);
+bool Sys_IsCounterDone(SysJobCounter const* counter);
+void Sys_WaitForCounter(SysJobCounter* counter);
+void Sys_JobBenchmark_f(void);
+void Sys_ParallelFor(int begin, int end, int grain, SysParallelForFunc func, void* data);
+void Sys_ParallelReduce(int begin, int end, int grain, SysParallelReduceFunc func, SysParallelJoinFunc join, void* data, void* result, int resultSize);
+void Sys_ParallelBenchmark_f(void);
+
+#endif // THREADS_JOBS_H
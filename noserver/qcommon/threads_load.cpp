@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threads_load.h"
+
+#include <qcommon/threads_jobs.h>
+#include <qcommon/threads_queue.h>
+#include <qcommon/threads_wait.h>
+
+#include <mutex>
+#include <thread>
+
+#define LOAD_COMPLETION_CAPACITY 1024
+#define LOAD_COMPLETION_BATCH 32
+
+typedef struct LoadPipeline
+{
+	std::mutex pendingMutex;
+	SysLoadRequest* pendingHead[SYS_LOAD_PRIORITY_COUNT];
+	SysLoadRequest* pendingTail[SYS_LOAD_PRIORITY_COUNT];
+	int readsInFlight;
+	int maxReadsInFlight;
+	std::atomic<int> outstanding;
+	SysMpscCell completionCells[LOAD_COMPLETION_CAPACITY];
+	SysMpscQueue completions;
+	SysEvent activity;
+} LoadPipeline;
+
+static LoadPipeline s_loadPipeline;
+// set on the thread that pumps completions the first time it does
+static thread_local bool s_loadPumpThread;
+
+static bool Load_IsCancelled(SysLoadRequest* request)
+{
+	return request->token && request->token->cancelled.load(std::memory_order_acquire);
+}
+
+static void Load_Finish(SysLoadRequest* request, int status)
+{
+	request->status.store(status, std::memory_order_release);
+	// only fills up if the completion thread stops pumping. A job can run on
+	// that thread while it helps in Sys_WaitForCounter, and then nobody else
+	// will drain the queue, so it delivers what is queued itself.
+	while (!Sys_TryPushMpsc(&s_loadPipeline.completions, request))
+	{
+		if (!s_loadPumpThread || !Sys_PumpLoadCompletions())
+			std::this_thread::yield();
+	}
+	Sys_SignalEvent(&s_loadPipeline.activity);
+}
+
+// Must be called with pendingMutex held.
+static SysLoadRequest* Load_PopPending(void)
+{
+	SysLoadRequest* request;
+	int priority;
+
+	for (priority = SYS_LOAD_PRIORITY_COUNT - 1; priority >= 0; --priority)
+	{
+		request = s_loadPipeline.pendingHead[priority];
+		if (!request)
+			continue;
+		s_loadPipeline.pendingHead[priority] = request->next;
+		if (!request->next)
+			s_loadPipeline.pendingTail[priority] = 0;
+		request->next = 0;
+		return request;
+	}
+	return 0;
+}
+
+static void Load_ReadJob(void* data);
+
+// Starts reads for the highest priority requests while I/O slots are free.
+// Jobs are submitted outside the lock since a full job queue runs them inline.
+static void Load_Dispatch(void)
+{
+	SysLoadRequest* start;
+	SysLoadRequest* cancelled;
+	SysLoadRequest* request;
+
+	start = 0;
+	cancelled = 0;
+	{
+		std::lock_guard<std::mutex> lock(s_loadPipeline.pendingMutex);
+		while (s_loadPipeline.readsInFlight < s_loadPipeline.maxReadsInFlight)
+		{
+			request = Load_PopPending();
+			if (!request)
+				break;
+			if (Load_IsCancelled(request))
+			{
+				request->next = cancelled;
+				cancelled = request;
+				continue;
+			}
+			++s_loadPipeline.readsInFlight;
+			request->next = start;
+			start = request;
+		}
+	}
+
+	while (cancelled)
+	{
+		request = cancelled;
+		cancelled = request->next;
+		Load_Finish(request, SYS_LOAD_CANCELLED);
+	}
+	while (start)
+	{
+		request = start;
+		start = request->next;
+		Sys_SubmitJob(Load_ReadJob, request, 0);
+	}
+}
+
+static void Load_ReadJob(void* data)
+{
+	SysLoadRequest* request;
+	int status;
+
+	request = (SysLoadRequest*)data;
+	status = SYS_LOAD_PENDING;
+	if (Load_IsCancelled(request))
+		status = SYS_LOAD_CANCELLED;
+	else if (request->read && !request->read(request))
+		status = SYS_LOAD_FAILED;
+
+	// hand the I/O slot to the next request before decompressing this one
+	{
+		std::lock_guard<std::mutex> lock(s_loadPipeline.pendingMutex);
+		--s_loadPipeline.readsInFlight;
+	}
+	Load_Dispatch();
+
+	if (status == SYS_LOAD_PENDING)
+	{
+		if (Load_IsCancelled(request))
+			status = SYS_LOAD_CANCELLED;
+		else if (request->decode && !request->decode(request))
+			status = SYS_LOAD_FAILED;
+		else
+			status = SYS_LOAD_DONE;
+	}
+	Load_Finish(request, status);
+}
+
+void Sys_InitLoadPipeline(int maxReadsInFlight)
+{
+	int priority;
+
+	for (priority = 0; priority < SYS_LOAD_PRIORITY_COUNT; ++priority)
+	{
+		s_loadPipeline.pendingHead[priority] = 0;
+		s_loadPipeline.pendingTail[priority] = 0;
+	}
+	s_loadPipeline.readsInFlight = 0;
+	s_loadPipeline.maxReadsInFlight = maxReadsInFlight > 0 ? maxReadsInFlight : 1;
+	s_loadPipeline.outstanding.store(0, std::memory_order_relaxed);
+	Sys_InitMpscQueue(&s_loadPipeline.completions, s_loadPipeline.completionCells, LOAD_COMPLETION_CAPACITY);
+	Sys_InitEvent(&s_loadPipeline.activity, 0, 0);
+}
+
+void Sys_EnqueueLoad(SysLoadRequest* request)
+{
+	int priority;
+
+	priority = request->priority;
+	if (priority < 0)
+		priority = 0;
+	if (priority >= SYS_LOAD_PRIORITY_COUNT)
+		priority = SYS_LOAD_PRIORITY_COUNT - 1;
+
+	request->status.store(SYS_LOAD_PENDING, std::memory_order_relaxed);
+	request->next = 0;
+	s_loadPipeline.outstanding.fetch_add(1, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(s_loadPipeline.pendingMutex);
+		if (s_loadPipeline.pendingTail[priority])
+			s_loadPipeline.pendingTail[priority]->next = request;
+		else
+			s_loadPipeline.pendingHead[priority] = request;
+		s_loadPipeline.pendingTail[priority] = request;
+	}
+	Load_Dispatch();
+}
+
+void Sys_CancelLoads(SysCancelToken* token)
+{
+	SysLoadRequest* cancelled;
+	SysLoadRequest* request;
+	SysLoadRequest** link;
+	int priority;
+
+	token->cancelled.store(1, std::memory_order_release);
+
+	cancelled = 0;
+	{
+		std::lock_guard<std::mutex> lock(s_loadPipeline.pendingMutex);
+		for (priority = 0; priority < SYS_LOAD_PRIORITY_COUNT; ++priority)
+		{
+			s_loadPipeline.pendingTail[priority] = 0;
+			for (link = &s_loadPipeline.pendingHead[priority]; *link; )
+			{
+				request = *link;
+				if (request->token == token)
+				{
+					*link = request->next;
+					request->next = cancelled;
+					cancelled = request;
+				}
+				else
+				{
+					s_loadPipeline.pendingTail[priority] = request;
+					link = &request->next;
+				}
+			}
+		}
+	}
+	while (cancelled)
+	{
+		request = cancelled;
+		cancelled = request->next;
+		Load_Finish(request, SYS_LOAD_CANCELLED);
+	}
+}
+
+// Runs the complete callbacks of finished requests on the calling thread.
+// Only one thread may pump, normally the main thread once a frame.
+int Sys_PumpLoadCompletions(void)
+{
+	void* batch[LOAD_COMPLETION_BATCH];
+	SysLoadRequest* request;
+	int delivered;
+	int count;
+	int i;
+
+	if (!s_loadPipeline.completions.cells)
+		return 0;
+	s_loadPumpThread = true;
+	delivered = 0;
+	while ((count = Sys_DrainMpsc(&s_loadPipeline.completions, batch, LOAD_COMPLETION_BATCH)) != 0)
+	{
+		for (i = 0; i < count; ++i)
+		{
+			request = (SysLoadRequest*)batch[i];
+			s_loadPipeline.outstanding.fetch_sub(1, std::memory_order_relaxed);
+			if (request->complete)
+				request->complete(request);
+		}
+		delivered += count;
+	}
+	return delivered;
+}
+
+int Sys_GetOutstandingLoads(void)
+{
+	return s_loadPipeline.outstanding.load(std::memory_order_relaxed);
+}
+
+void Sys_WakeLoadWaiters(void)
+{
+	Sys_SignalEvent(&s_loadPipeline.activity);
+}
+
+bool Sys_WaitLoadActivity(unsigned int msec)
+{
+	return Sys_WaitEvent(&s_loadPipeline.activity, msec);
+}
+
+void Sys_WaitForLoads(void)
+{
+	while (Sys_GetOutstandingLoads())
+	{
+		if (!Sys_PumpLoadCompletions())
+			Sys_WaitLoadActivity(SYS_WAIT_INFINITE);
+	}
+}
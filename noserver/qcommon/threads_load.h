@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADS_LOAD_H
+#define THREADS_LOAD_H
+
+#include <atomic>
+
+enum SysLoadPriority
+{
+	SYS_LOAD_PRIORITY_LOW = 0x0,
+	SYS_LOAD_PRIORITY_NORMAL = 0x1,
+	SYS_LOAD_PRIORITY_HIGH = 0x2,
+	SYS_LOAD_PRIORITY_CRITICAL = 0x3,
+	SYS_LOAD_PRIORITY_COUNT = 0x4,
+};
+
+enum SysLoadStatus
+{
+	SYS_LOAD_PENDING = 0x0,
+	SYS_LOAD_DONE = 0x1,
+	SYS_LOAD_FAILED = 0x2,
+	SYS_LOAD_CANCELLED = 0x3,
+};
+
+// Shared by every request of one load (a map change, a gump); cancelling it
+// drops the queued requests and stops in-flight ones at the next stage.
+typedef struct SysCancelToken
+{
+	std::atomic<int> cancelled;
+} SysCancelToken;
+
+struct SysLoadRequest;
+
+typedef bool (*SysLoadStageFunc)(struct SysLoadRequest* request);
+typedef void (*SysLoadCompleteFunc)(struct SysLoadRequest* request);
+
+// Owned by the caller and must stay alive until its complete callback has
+// run. read does the I/O and decode the decompression, both on job workers;
+// either may be null. complete runs on the thread that pumps completions.
+typedef struct SysLoadRequest
+{
+	char const* name;
+	int priority;
+	SysCancelToken* token;
+	SysLoadStageFunc read;
+	SysLoadStageFunc decode;
+	SysLoadCompleteFunc complete;
+	void* data;
+	std::atomic<int> status;
+	struct SysLoadRequest* next;
+} SysLoadRequest;
+
+void Sys_InitLoadPipeline(int maxReadsInFlight);
+void Sys_EnqueueLoad(SysLoadRequest* request);
+void Sys_CancelLoads(SysCancelToken* token);
+int Sys_PumpLoadCompletions(void);
+int Sys_GetOutstandingLoads(void);
+void Sys_WakeLoadWaiters(void);
+bool Sys_WaitLoadActivity(unsigned int msec);
+void Sys_WaitForLoads(void);
+
+#endif // THREADS_LOAD_H
@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threads_profile.h"
+
+#include <universal/q_shared.h>
+#include <qcommon/common.h>
+#include <qcommon/threads.h>
+#include <qcommon/threads_timer.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+#define PROFILE_RING_MASK (SYS_PROFILE_RING_SIZE - 1)
+#define PROFILE_THREAD_NAME_LEN 32
+
+// Written only by its owning thread. The dump reads it from another thread
+// and throws away whatever the owner may have overwritten meanwhile, so the
+// owner never waits on anyone.
+typedef struct alignas(64) ProfileRing
+{
+	std::atomic<unsigned int> head;
+	std::atomic<bool> inUse;
+	int tid;
+	char threadName[PROFILE_THREAD_NAME_LEN];
+	struct ProfileRing* next;
+	int depth;
+	unsigned int droppedZones;
+	unsigned long long openStart[SYS_PROFILE_MAX_DEPTH];
+	char openName[SYS_PROFILE_MAX_DEPTH][SYS_PROFILE_NAME_LEN];
+	SysProfileEvent events[SYS_PROFILE_RING_SIZE];
+} ProfileRing;
+
+// Hands the ring back when its thread exits so the next thread reuses it.
+typedef struct ProfileThreadRef
+{
+	ProfileRing* ring;
+	~ProfileThreadRef()
+	{
+		if (ring)
+			ring->inUse.store(false, std::memory_order_release);
+	}
+} ProfileThreadRef;
+
+static std::atomic<ProfileRing*> s_profileRings;
+static std::atomic<int> s_profileRingCount;
+static std::atomic<bool> s_profiling;
+static unsigned long long s_profileStartNsec;
+static thread_local ProfileThreadRef s_profileThread;
+
+static void Profile_SetThreadName(ProfileRing* ring)
+{
+	I_strncpyz(ring->threadName, Sys_GetCurrentThreadName(), sizeof(ring->threadName));
+}
+
+static ProfileRing* Profile_ClaimRing(void)
+{
+	ProfileRing* ring;
+	ProfileRing* head;
+	bool expected;
+
+	for (ring = s_profileRings.load(std::memory_order_acquire); ring; ring = ring->next)
+	{
+		expected = false;
+		if (!ring->inUse.load(std::memory_order_relaxed)
+			&& ring->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire, std::memory_order_relaxed))
+		{
+			// the dead thread's events go, a dump in progress sees head
+			// move backwards and skips the ring
+			ring->head.store(0, std::memory_order_release);
+			ring->depth = 0;
+			ring->droppedZones = 0;
+			Profile_SetThreadName(ring);
+			return ring;
+		}
+	}
+
+	ring = new ProfileRing;
+	ring->head.store(0, std::memory_order_relaxed);
+	ring->inUse.store(true, std::memory_order_relaxed);
+	ring->tid = s_profileRingCount.fetch_add(1, std::memory_order_relaxed) + 1;
+	ring->depth = 0;
+	ring->droppedZones = 0;
+	Profile_SetThreadName(ring);
+	head = s_profileRings.load(std::memory_order_relaxed);
+	do
+	{
+		ring->next = head;
+	} while (!s_profileRings.compare_exchange_weak(head, ring, std::memory_order_release, std::memory_order_relaxed));
+	return ring;
+}
+
+static ProfileRing* Profile_GetRing(void)
+{
+	if (!s_profileThread.ring)
+		s_profileThread.ring = Profile_ClaimRing();
+	return s_profileThread.ring;
+}
+
+static void Profile_Emit(ProfileRing* ring, char const* name, unsigned long long startNsec, unsigned long long endNsec, int depth, int phase)
+{
+	unsigned int head;
+	SysProfileEvent* event;
+
+	head = ring->head.load(std::memory_order_relaxed);
+	event = &ring->events[head & PROFILE_RING_MASK];
+	event->startNsec = startNsec;
+	event->endNsec = endNsec;
+	I_strncpyz(event->name, name, sizeof(event->name));
+	event->depth = (unsigned char)depth;
+	event->phase = (unsigned char)phase;
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+void Sys_StartProfiling(void)
+{
+	if (s_profiling.load(std::memory_order_relaxed))
+		return;
+	s_profileStartNsec = Sys_NanoTime();
+	s_profiling.store(true, std::memory_order_release);
+}
+
+void Sys_StopProfiling(void)
+{
+	s_profiling.store(false, std::memory_order_release);
+}
+
+bool Sys_IsProfiling(void)
+{
+	return s_profiling.load(std::memory_order_relaxed);
+}
+
+// Zones opened while profiling is off still nest, they just record nothing,
+// so begin and end stay paired when capture starts or stops mid-zone.
+void Sys_BeginProfileZone(char const* name)
+{
+	ProfileRing* ring;
+
+	if (!s_profiling.load(std::memory_order_relaxed) && !s_profileThread.ring)
+		return;
+	ring = Profile_GetRing();
+	if (ring->depth >= SYS_PROFILE_MAX_DEPTH)
+	{
+		++ring->depth;
+		++ring->droppedZones;
+		return;
+	}
+	if (s_profiling.load(std::memory_order_relaxed))
+	{
+		ring->openStart[ring->depth] = Sys_NanoTime();
+		I_strncpyz(ring->openName[ring->depth], name, SYS_PROFILE_NAME_LEN);
+	}
+	else
+	{
+		ring->openStart[ring->depth] = 0;
+	}
+	++ring->depth;
+}
+
+void Sys_EndProfileZone(void)
+{
+	ProfileRing* ring;
+	int depth;
+
+	ring = s_profileThread.ring;
+	if (!ring || !ring->depth)
+		return;
+	depth = --ring->depth;
+	if (depth >= SYS_PROFILE_MAX_DEPTH || !ring->openStart[depth])
+		return;
+	Profile_Emit(ring, ring->openName[depth], ring->openStart[depth], Sys_NanoTime(), depth, SYS_PROFILE_ZONE);
+}
+
+void Sys_ProfileMarker(char const* name)
+{
+	ProfileRing* ring;
+	unsigned long long now;
+
+	if (!s_profiling.load(std::memory_order_relaxed))
+		return;
+	ring = Profile_GetRing();
+	now = Sys_NanoTime();
+	Profile_Emit(ring, name, now, now, ring->depth < SYS_PROFILE_MAX_DEPTH ? ring->depth : SYS_PROFILE_MAX_DEPTH, SYS_PROFILE_MARKER);
+}
+
+static void Profile_WriteJsonString(FILE* f, char const* s)
+{
+	fputc('"', f);
+	for (; *s; ++s)
+	{
+		if (*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(f, "\\u%04x", (unsigned char)*s);
+		else
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+// Copies the ring's newest events into out and returns how many are intact.
+static int Profile_SnapshotRing(ProfileRing* ring, SysProfileEvent* out)
+{
+	unsigned int head;
+	unsigned int after;
+	unsigned int first;
+	unsigned int valid;
+	unsigned int i;
+
+	head = ring->head.load(std::memory_order_acquire);
+	first = head > SYS_PROFILE_RING_SIZE ? head - SYS_PROFILE_RING_SIZE : 0;
+	for (i = first; i != head; ++i)
+		out[i - first] = ring->events[i & PROFILE_RING_MASK];
+	std::atomic_thread_fence(std::memory_order_acquire);
+	after = ring->head.load(std::memory_order_relaxed);
+	if (after < head)
+		return 0;
+
+	// anything the owner lapped while we copied is torn
+	valid = after > SYS_PROFILE_RING_SIZE ? after - SYS_PROFILE_RING_SIZE : 0;
+	if (valid <= first)
+		return head - first;
+	if (valid >= head)
+		return 0;
+	memmove(out, out + (valid - first), (head - valid) * sizeof(*out));
+	return head - valid;
+}
+
+// Writes every thread's recorded zones in the Chrome trace event format, for
+// chrome://tracing, Perfetto or speedscope.
+bool Sys_WriteProfileTrace(char const* filename)
+{
+	FILE* f;
+	ProfileRing* ring;
+	SysProfileEvent* events;
+	SysProfileEvent const* event;
+	int count;
+	int total;
+	int i;
+	bool first;
+
+	f = fopen(filename, "w");
+	if (!f)
+	{
+		Com_Printf(CON_CHANNEL_SYSTEM, "couldn't open %s for writing\n", filename);
+		return false;
+	}
+
+	events = new SysProfileEvent[SYS_PROFILE_RING_SIZE];
+	total = 0;
+	first = true;
+	fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	for (ring = s_profileRings.load(std::memory_order_acquire); ring; ring = ring->next)
+	{
+		count = Profile_SnapshotRing(ring, events);
+		fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", first ? "" : ",", ring->tid);
+		Profile_WriteJsonString(f, ring->threadName);
+		fprintf(f, "}}");
+		first = false;
+		for (i = 0; i < count; ++i)
+		{
+			event = &events[i];
+			if (event->startNsec < s_profileStartNsec)
+				continue;
+			fprintf(f, ",\n{\"name\":");
+			Profile_WriteJsonString(f, event->name);
+			if (event->phase == SYS_PROFILE_MARKER)
+			{
+				fprintf(f, ",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+					(event->startNsec - s_profileStartNsec) / 1000.0, ring->tid);
+			}
+			else
+			{
+				fprintf(f, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"depth\":%u}}",
+					(event->startNsec - s_profileStartNsec) / 1000.0, (event->endNsec - event->startNsec) / 1000.0, ring->tid, event->depth);
+			}
+			++total;
+		}
+		if (ring->droppedZones)
+			Com_Printf(CON_CHANNEL_SYSTEM, "%s: %u zones nested deeper than %d were dropped\n", ring->threadName, ring->droppedZones, SYS_PROFILE_MAX_DEPTH);
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+	delete[] events;
+	Com_Printf(CON_CHANNEL_SYSTEM, "wrote %d events to %s\n", total, filename);
+	return true;
+}
+
+void Sys_ProfileStart_f(void)
+{
+	Sys_StartProfiling();
+	Com_Printf(CON_CHANNEL_SYSTEM, "zone profiling started\n");
+}
+
+void Sys_ProfileStop_f(void)
+{
+	Sys_StopProfiling();
+	Com_Printf(CON_CHANNEL_SYSTEM, "zone profiling stopped\n");
+}
+
+void Sys_ProfileDump_f(void)
+{
+	Sys_WriteProfileTrace("profile_trace.json");
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADS_PROFILE_H
+#define THREADS_PROFILE_H
+
+#define SYS_PROFILE_RING_SIZE 4096
+#define SYS_PROFILE_MAX_DEPTH 32
+#define SYS_PROFILE_NAME_LEN 46
+
+enum SysProfilePhase
+{
+	SYS_PROFILE_ZONE = 0x0,
+	SYS_PROFILE_MARKER = 0x1,
+};
+
+// One finished zone or marker, a cache line each. Names are copied so zones
+// can be named from stack buffers.
+typedef struct SysProfileEvent
+{
+	unsigned long long startNsec;
+	unsigned long long endNsec;
+	char name[SYS_PROFILE_NAME_LEN];
+	unsigned char depth;
+	unsigned char phase;
+} SysProfileEvent;
+
+void Sys_StartProfiling(void);
+void Sys_StopProfiling(void);
+bool Sys_IsProfiling(void);
+void Sys_BeginProfileZone(char const* name);
+void Sys_EndProfileZone(void);
+void Sys_ProfileMarker(char const* name);
+bool Sys_WriteProfileTrace(char const* filename);
+void Sys_ProfileStart_f(void);
+void Sys_ProfileStop_f(void);
+void Sys_ProfileDump_f(void);
+
+// Zone that ends when it goes out of scope.
+struct SysProfileScope
+{
+	explicit SysProfileScope(char const* name)
+	{
+		Sys_BeginProfileZone(name);
+	}
+	~SysProfileScope()
+	{
+		Sys_EndProfileZone();
+	}
+	SysProfileScope(SysProfileScope const&) = delete;
+	SysProfileScope& operator=(SysProfileScope const&) = delete;
+};
+
+#define SYS_PROFILE_CONCAT2(a, b) a##b
+#define SYS_PROFILE_CONCAT(a, b) SYS_PROFILE_CONCAT2(a, b)
+#define SYS_PROFILE_SCOPE(name) SysProfileScope SYS_PROFILE_CONCAT(profileScope, __LINE__)(name)
+
+#endif // THREADS_PROFILE_H
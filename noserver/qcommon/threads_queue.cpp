@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threads_queue.h"
+
+#include <qcommon/common.h>
+#include <qcommon/threads_wait.h>
+
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <mutex>
+#endif
+
+#define MPSC_BENCH_CAPACITY 1024
+#define MPSC_BENCH_MESSAGES 200000
+#define MPSC_BENCH_BATCH 64
+#define MPSC_BENCH_MAX_PRODUCERS 16
+
+// The critical-section path the queue replaces: a ring guarded by one lock.
+typedef struct LockedQueue
+{
+#ifdef _WIN32
+	CRITICAL_SECTION lock;
+#else
+	std::mutex lock;
+#endif
+	void* payloads[MPSC_BENCH_CAPACITY];
+	unsigned int head;
+	unsigned int tail;
+} LockedQueue;
+
+static SysMpscCell s_benchCells[MPSC_BENCH_CAPACITY];
+static SysMpscQueue s_benchQueue;
+static LockedQueue s_benchLocked;
+static std::atomic<bool> s_benchStart;
+
+static void Sys_LockBenchQueue(void)
+{
+#ifdef _WIN32
+	EnterCriticalSection(&s_benchLocked.lock);
+#else
+	s_benchLocked.lock.lock();
+#endif
+}
+
+static void Sys_UnlockBenchQueue(void)
+{
+#ifdef _WIN32
+	LeaveCriticalSection(&s_benchLocked.lock);
+#else
+	s_benchLocked.lock.unlock();
+#endif
+}
+
+static bool Sys_TryPushLocked(void* payload)
+{
+	bool pushed;
+
+	Sys_LockBenchQueue();
+	pushed = s_benchLocked.head - s_benchLocked.tail < MPSC_BENCH_CAPACITY;
+	if (pushed)
+		s_benchLocked.payloads[s_benchLocked.head++ % MPSC_BENCH_CAPACITY] = payload;
+	Sys_UnlockBenchQueue();
+	return pushed;
+}
+
+static int Sys_DrainLocked(void** payloads, int maxCount)
+{
+	int count;
+
+	Sys_LockBenchQueue();
+	for (count = 0; count < maxCount && s_benchLocked.tail != s_benchLocked.head; ++count)
+		payloads[count] = s_benchLocked.payloads[s_benchLocked.tail++ % MPSC_BENCH_CAPACITY];
+	Sys_UnlockBenchQueue();
+	return count;
+}
+
+static void Sys_BackoffFull(int* attempt)
+{
+	if (++*attempt < 64)
+		Sys_Pause();
+	else
+		std::this_thread::yield();
+}
+
+static void Sys_MpscBenchProducer(bool locked, int messages)
+{
+	int attempt;
+	int i;
+
+	while (!s_benchStart.load(std::memory_order_acquire))
+		std::this_thread::yield();
+	for (i = 1; i <= messages; ++i)
+	{
+		attempt = 0;
+		if (locked)
+		{
+			while (!Sys_TryPushLocked((void*)(size_t)i))
+				Sys_BackoffFull(&attempt);
+		}
+		else
+		{
+			while (!Sys_TryPushMpsc(&s_benchQueue, (void*)(size_t)i))
+				Sys_BackoffFull(&attempt);
+		}
+	}
+}
+
+static double Sys_RunMpscBench(bool locked, int producers)
+{
+	std::thread threads[MPSC_BENCH_MAX_PRODUCERS];
+	std::chrono::steady_clock::time_point start;
+	void* batch[MPSC_BENCH_BATCH];
+	int perProducer;
+	int received;
+	int count;
+	int attempt;
+	int i;
+
+	perProducer = MPSC_BENCH_MESSAGES / producers;
+	Sys_InitMpscQueue(&s_benchQueue, s_benchCells, MPSC_BENCH_CAPACITY);
+	s_benchLocked.head = 0;
+	s_benchLocked.tail = 0;
+	s_benchStart.store(false);
+	for (i = 0; i < producers; ++i)
+		threads[i] = std::thread(Sys_MpscBenchProducer, locked, perProducer);
+
+	start = std::chrono::steady_clock::now();
+	s_benchStart.store(true, std::memory_order_release);
+	received = 0;
+	attempt = 0;
+	while (received < perProducer * producers)
+	{
+		if (locked)
+			count = Sys_DrainLocked(batch, MPSC_BENCH_BATCH);
+		else
+			count = Sys_DrainMpsc(&s_benchQueue, batch, MPSC_BENCH_BATCH);
+		if (count)
+		{
+			received += count;
+			attempt = 0;
+		}
+		else
+		{
+			Sys_BackoffFull(&attempt);
+		}
+	}
+	for (i = 0; i < producers; ++i)
+		threads[i].join();
+	return received / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Sys_MpscBenchmark_f(void)
+{
+	static const int producerCounts[] = { 1, 2, 4, 8, 16 };
+	double lockedRate;
+	double queueRate;
+	int i;
+
+#ifdef _WIN32
+	InitializeCriticalSection(&s_benchLocked.lock);
+#endif
+	Com_Printf(CON_CHANNEL_SYSTEM, "%d messages, capacity %d, drain batch %d\n", MPSC_BENCH_MESSAGES, MPSC_BENCH_CAPACITY, MPSC_BENCH_BATCH);
+	Com_Printf(CON_CHANNEL_SYSTEM, "%9s %14s %14s %8s\n", "producers", "locked msg/s", "mpsc msg/s", "speedup");
+	for (i = 0; i < (int)(sizeof(producerCounts) / sizeof(producerCounts[0])); ++i)
+	{
+		lockedRate = Sys_RunMpscBench(true, producerCounts[i]);
+		queueRate = Sys_RunMpscBench(false, producerCounts[i]);
+		Com_Printf(CON_CHANNEL_SYSTEM, "%9d %14.0f %14.0f %7.2fx\n", producerCounts[i], lockedRate, queueRate, queueRate / lockedRate);
+	}
+#ifdef _WIN32
+	DeleteCriticalSection(&s_benchLocked.lock);
+#endif
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADS_QUEUE_H
+#define THREADS_QUEUE_H
+
+#include <atomic>
+
+#define SYS_QUEUE_CACHE_LINE 64
+
+typedef struct SysMpscCell
+{
+	std::atomic<unsigned int> sequence;
+	void* payload;
+} SysMpscCell;
+
+// Bounded multi-producer/single-consumer queue. Every cell carries a sequence
+// number: a producer may fill the cell once it equals the claimed position and
+// the consumer may take it once it equals position + 1. Producers only contend
+// on the head counter, never on a lock.
+typedef struct SysMpscQueue
+{
+	alignas(SYS_QUEUE_CACHE_LINE) std::atomic<unsigned int> head;
+	alignas(SYS_QUEUE_CACHE_LINE) unsigned int tail;
+	SysMpscCell* cells;
+	unsigned int mask;
+} SysMpscQueue;
+
+// capacity must be a power of two
+inline void Sys_InitMpscQueue(SysMpscQueue* queue, SysMpscCell* cells, unsigned int capacity)
+{
+	unsigned int i;
+
+	for (i = 0; i < capacity; ++i)
+	{
+		cells[i].sequence.store(i, std::memory_order_relaxed);
+		cells[i].payload = 0;
+	}
+	queue->cells = cells;
+	queue->mask = capacity - 1;
+	queue->tail = 0;
+	queue->head.store(0, std::memory_order_release);
+}
+
+// Returns false when the queue is full.
+inline bool Sys_TryPushMpsc(SysMpscQueue* queue, void* payload)
+{
+	SysMpscCell* cell;
+	unsigned int pos;
+	int diff;
+
+	pos = queue->head.load(std::memory_order_relaxed);
+	while (1)
+	{
+		cell = &queue->cells[pos & queue->mask];
+		diff = (int)(cell->sequence.load(std::memory_order_acquire) - pos);
+		if (!diff)
+		{
+			if (queue->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0)
+		{
+			// the consumer has not taken this lap's cell yet
+			return false;
+		}
+		else
+		{
+			pos = queue->head.load(std::memory_order_relaxed);
+		}
+	}
+	cell->payload = payload;
+	cell->sequence.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+// Consumer only. Takes up to maxCount payloads in push order and returns how
+// many were taken; stops early at a cell whose producer has not finished.
+inline int Sys_DrainMpsc(SysMpscQueue* queue, void** payloads, int maxCount)
+{
+	SysMpscCell* cell;
+	unsigned int tail;
+	int count;
+
+	tail = queue->tail;
+	for (count = 0; count < maxCount; ++count)
+	{
+		cell = &queue->cells[tail & queue->mask];
+		if (cell->sequence.load(std::memory_order_acquire) != tail + 1)
+			break;
+		payloads[count] = cell->payload;
+		cell->sequence.store(tail + queue->mask + 1, std::memory_order_release);
+		++tail;
+	}
+	queue->tail = tail;
+	return count;
+}
+
+void Sys_MpscBenchmark_f(void);
+
+#endif // THREADS_QUEUE_H
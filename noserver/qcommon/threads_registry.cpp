@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threads_registry.h"
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <stdlib.h>
+
+thread_local SysThreadBlock* g_threadBlock;
+
+// Blocks are handed out from chunks that are never moved or freed, so a
+// block's address and index stay valid while the registry grows.
+static SysThreadBlock* s_threadChunks[SYS_THREAD_CHUNK_COUNT];
+static std::atomic<int> s_threadBlockCount;
+static SysThreadBlock* s_freeThreadBlocks;
+static std::mutex s_threadRegistryMutex;
+
+static SysThreadBlock* Sys_AllocThreadChunk(void)
+{
+	void* chunk;
+
+#ifdef _WIN32
+	chunk = _aligned_malloc(sizeof(SysThreadBlock) * SYS_THREAD_CHUNK_SIZE, SYS_CACHE_LINE_SIZE);
+#else
+	chunk = aligned_alloc(SYS_CACHE_LINE_SIZE, sizeof(SysThreadBlock) * SYS_THREAD_CHUNK_SIZE);
+#endif
+	return (SysThreadBlock*)chunk;
+}
+
+static SysThreadBlock* Sys_AllocThreadBlock(void)
+{
+	SysThreadBlock* block;
+	int index;
+	int chunk;
+
+	std::lock_guard<std::mutex> lock(s_threadRegistryMutex);
+	block = s_freeThreadBlocks;
+	if (block)
+	{
+		s_freeThreadBlocks = block->nextFree;
+		index = block->index;
+	}
+	else
+	{
+		index = s_threadBlockCount.load(std::memory_order_relaxed);
+		chunk = index / SYS_THREAD_CHUNK_SIZE;
+		if (chunk >= SYS_THREAD_CHUNK_COUNT)
+			return 0;
+		if (!s_threadChunks[chunk])
+		{
+			s_threadChunks[chunk] = Sys_AllocThreadChunk();
+			if (!s_threadChunks[chunk])
+				return 0;
+		}
+		block = &s_threadChunks[chunk][index % SYS_THREAD_CHUNK_SIZE];
+		s_threadBlockCount.store(index + 1, std::memory_order_release);
+	}
+	new (block) SysThreadBlock();
+	block->index = index;
+	return block;
+}
+
+// Gives the calling thread its block, or retags the one it already has.
+SysThreadBlock* Sys_RegisterThread(int threadContext)
+{
+	SysThreadBlock* block;
+
+	block = g_threadBlock;
+	if (!block)
+	{
+		block = Sys_AllocThreadBlock();
+		if (!block)
+			return 0;
+		g_threadBlock = block;
+	}
+	block->threadContext = threadContext;
+	return block;
+}
+
+// Returns the calling thread's block to the registry for the next thread.
+void Sys_UnregisterThread(void)
+{
+	SysThreadBlock* block;
+
+	block = g_threadBlock;
+	if (!block)
+		return;
+	g_threadBlock = 0;
+
+	std::lock_guard<std::mutex> lock(s_threadRegistryMutex);
+	block->nextFree = s_freeThreadBlocks;
+	s_freeThreadBlocks = block;
+}
+
+SysThreadBlock* Sys_GetThreadBlock(int index)
+{
+	if (index < 0 || index >= s_threadBlockCount.load(std::memory_order_acquire))
+		return 0;
+	return &s_threadChunks[index / SYS_THREAD_CHUNK_SIZE][index % SYS_THREAD_CHUNK_SIZE];
+}
+
+int Sys_GetThreadBlockCount(void)
+{
+	return s_threadBlockCount.load(std::memory_order_acquire);
+}
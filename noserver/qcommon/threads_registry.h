@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADS_REGISTRY_H
+#define THREADS_REGISTRY_H
+
+#include <universal/q_shared.h>
+
+#define SYS_CACHE_LINE_SIZE 64
+#define SYS_THREAD_VALUE_COUNT 5
+#define SYS_THREAD_CHUNK_SIZE 64
+#define SYS_THREAD_CHUNK_COUNT 64
+
+// Per-thread storage behind Sys_GetValue. Blocks are cache line aligned and
+// padded to whole lines, so one thread's va buffers never share a line with
+// its neighbour's.
+typedef struct alignas(SYS_CACHE_LINE_SIZE) SysThreadBlock
+{
+	void* values[SYS_THREAD_VALUE_COUNT];
+	int index;
+	int threadContext;
+	struct SysThreadBlock* nextFree;
+	va_info_t vaInfo;
+	int comError[16];
+	TraceThreadInfo traceThreadInfo;
+} SysThreadBlock;
+
+// block of the calling thread, null until it registers
+extern thread_local SysThreadBlock* g_threadBlock;
+
+SysThreadBlock* Sys_RegisterThread(int threadContext);
+void Sys_UnregisterThread(void);
+SysThreadBlock* Sys_GetThreadBlock(int index);
+int Sys_GetThreadBlockCount(void);
+
+#endif // THREADS_REGISTRY_H
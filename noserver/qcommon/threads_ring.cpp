@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threads_ring.h"
+
+#include <qcommon/common.h>
+
+#include <chrono>
+
+static unsigned long long Sys_StallUsecSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Sys_InitFrameRing(SysFrameRing* ring, int depth)
+{
+	int i;
+
+	if (depth < SYS_FRAME_RING_MIN_DEPTH)
+		depth = SYS_FRAME_RING_MIN_DEPTH;
+	if (depth > SYS_FRAME_RING_MAX_DEPTH)
+		depth = SYS_FRAME_RING_MAX_DEPTH;
+
+	ring->depth = depth;
+	for (i = 0; i < SYS_FRAME_RING_MAX_DEPTH; ++i)
+	{
+		ring->packets[i] = 0;
+		Sys_InitEvent(&ring->slotFence[i], 1, 1);
+	}
+	Sys_InitEvent(&ring->frameQueued, 0, 0);
+	ring->head.store(0, std::memory_order_relaxed);
+	ring->tail.store(0, std::memory_order_relaxed);
+	ring->stats.framesPushed.store(0, std::memory_order_relaxed);
+	ring->stats.maxQueued.store(0, std::memory_order_relaxed);
+	ring->stats.producerStalls.store(0, std::memory_order_relaxed);
+	ring->stats.producerStallUsec.store(0, std::memory_order_relaxed);
+	ring->stats.consumerStalls.store(0, std::memory_order_relaxed);
+	ring->stats.consumerStallUsec.store(0, std::memory_order_release);
+}
+
+// Producer side: blocks until the slot the next frame goes into is released.
+void Sys_WaitFrameSlot(SysFrameRing* ring)
+{
+	SysEvent* fence;
+	std::chrono::steady_clock::time_point start;
+
+	fence = &ring->slotFence[ring->head.load(std::memory_order_relaxed) % ring->depth];
+	if (Sys_IsEventSignaled(fence))
+		return;
+	start = std::chrono::steady_clock::now();
+	Sys_WaitEvent(fence, SYS_WAIT_INFINITE);
+	ring->stats.producerStalls.fetch_add(1, std::memory_order_relaxed);
+	ring->stats.producerStallUsec.fetch_add(Sys_StallUsecSince(start), std::memory_order_relaxed);
+}
+
+unsigned int Sys_PushFrame(SysFrameRing* ring, void* packet)
+{
+	unsigned int frame;
+	unsigned int slot;
+	unsigned int queued;
+	unsigned int maxQueued;
+
+	Sys_WaitFrameSlot(ring);
+	frame = ring->head.load(std::memory_order_relaxed);
+	slot = frame % ring->depth;
+
+	// only the producer clears a fence, and the consumer can not signal it
+	// again until this slot has been pushed
+	Sys_ClearEvent(&ring->slotFence[slot]);
+	ring->packets[slot] = packet;
+	ring->head.store(frame + 1, std::memory_order_release);
+	Sys_SignalEvent(&ring->frameQueued);
+
+	ring->stats.framesPushed.fetch_add(1, std::memory_order_relaxed);
+	queued = frame + 1 - ring->tail.load(std::memory_order_relaxed);
+	maxQueued = ring->stats.maxQueued.load(std::memory_order_relaxed);
+	if (queued > maxQueued)
+		ring->stats.maxQueued.store(queued, std::memory_order_relaxed);
+	return frame;
+}
+
+// Consumer side: returns the oldest unreleased frame, or null on timeout.
+// The same packet is returned until Sys_ReleaseFrame retires it.
+void* Sys_AcquireFrame(SysFrameRing* ring, unsigned int msec)
+{
+	unsigned int tail;
+	bool stalled;
+	std::chrono::steady_clock::time_point start;
+
+	tail = ring->tail.load(std::memory_order_relaxed);
+	stalled = false;
+	while (ring->head.load(std::memory_order_acquire) == tail)
+	{
+		if (!stalled)
+		{
+			if (!msec)
+				return 0;
+			stalled = true;
+			start = std::chrono::steady_clock::now();
+		}
+		if (!Sys_WaitEvent(&ring->frameQueued, msec) && ring->head.load(std::memory_order_acquire) == tail)
+		{
+			ring->stats.consumerStallUsec.fetch_add(Sys_StallUsecSince(start), std::memory_order_relaxed);
+			return 0;
+		}
+	}
+	if (stalled)
+	{
+		ring->stats.consumerStalls.fetch_add(1, std::memory_order_relaxed);
+		ring->stats.consumerStallUsec.fetch_add(Sys_StallUsecSince(start), std::memory_order_relaxed);
+	}
+	return ring->packets[tail % ring->depth];
+}
+
+void Sys_ReleaseFrame(SysFrameRing* ring)
+{
+	unsigned int tail;
+	unsigned int slot;
+
+	tail = ring->tail.load(std::memory_order_relaxed);
+	// nothing acquired, don't let tail run past head
+	if (tail == ring->head.load(std::memory_order_acquire))
+		return;
+	slot = tail % ring->depth;
+	ring->packets[slot] = 0;
+	ring->tail.store(tail + 1, std::memory_order_release);
+	Sys_SignalEvent(&ring->slotFence[slot]);
+}
+
+bool Sys_IsFrameRetired(SysFrameRing* ring, unsigned int frame)
+{
+	return (int)(ring->tail.load(std::memory_order_acquire) - frame) > 0;
+}
+
+// Producer side: waits for the consumer to retire every queued frame.
+void Sys_FlushFrameRing(SysFrameRing* ring)
+{
+	unsigned int head;
+
+	head = ring->head.load(std::memory_order_relaxed);
+	if (head == ring->tail.load(std::memory_order_acquire))
+		return;
+	// frames retire in order, so the newest frame's fence covers the rest
+	Sys_WaitEvent(&ring->slotFence[(head - 1) % ring->depth], SYS_WAIT_INFINITE);
+}
+
+// Producer side: changes the depth once the consumer has gone idle. The
+// consumer may be parked in Sys_AcquireFrame meanwhile, so head, tail and the
+// events are left alone; only which slot each frame maps to changes.
+void Sys_ResizeFrameRing(SysFrameRing* ring, int depth)
+{
+	unsigned int head;
+
+	if (depth < SYS_FRAME_RING_MIN_DEPTH)
+		depth = SYS_FRAME_RING_MIN_DEPTH;
+	if (depth > SYS_FRAME_RING_MAX_DEPTH)
+		depth = SYS_FRAME_RING_MAX_DEPTH;
+	if ((unsigned int)depth == ring->depth)
+		return;
+
+	Sys_FlushFrameRing(ring);
+	// Sys_ReleaseFrame stores tail before it signals the fence, so wait for
+	// the fence too: once it is set the consumer is done with the old depth.
+	// Every other fence was set by an earlier release or never cleared.
+	head = ring->head.load(std::memory_order_relaxed);
+	if (head)
+		Sys_WaitEvent(&ring->slotFence[(head - 1) % ring->depth], SYS_WAIT_INFINITE);
+	ring->depth = depth;
+}
+
+unsigned int Sys_GetFramesQueued(SysFrameRing* ring)
+{
+	return ring->head.load(std::memory_order_acquire) - ring->tail.load(std::memory_order_acquire);
+}
+
+void Sys_PrintFrameRingStats(char const* name, SysFrameRing* ring)
+{
+	unsigned int frames;
+	unsigned long long producerUsec;
+	unsigned long long consumerUsec;
+
+	frames = ring->stats.framesPushed.load(std::memory_order_relaxed);
+	producerUsec = ring->stats.producerStallUsec.load(std::memory_order_relaxed);
+	consumerUsec = ring->stats.consumerStallUsec.load(std::memory_order_relaxed);
+	Com_Printf(CON_CHANNEL_SYSTEM, "%s: depth %u, %u queued (max %u), %u frames\n",
+		name, ring->depth, Sys_GetFramesQueued(ring), ring->stats.maxQueued.load(std::memory_order_relaxed), frames);
+	Com_Printf(CON_CHANNEL_SYSTEM, "  producer stalls %u, %.3f ms total, %.3f ms/frame\n",
+		ring->stats.producerStalls.load(std::memory_order_relaxed),
+		producerUsec / 1000.0, frames ? producerUsec / 1000.0 / frames : 0.0);
+	Com_Printf(CON_CHANNEL_SYSTEM, "  consumer stalls %u, %.3f ms total, %.3f ms/frame\n",
+		ring->stats.consumerStalls.load(std::memory_order_relaxed),
+		consumerUsec / 1000.0, frames ? consumerUsec / 1000.0 / frames : 0.0);
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADS_RING_H
+#define THREADS_RING_H
+
+#include <qcommon/threads_wait.h>
+
+#define SYS_FRAME_RING_MIN_DEPTH 1
+#define SYS_FRAME_RING_MAX_DEPTH 3
+
+typedef struct SysFrameRingStats
+{
+	std::atomic<unsigned int> framesPushed;
+	std::atomic<unsigned int> maxQueued;
+	std::atomic<unsigned int> producerStalls;
+	std::atomic<unsigned long long> producerStallUsec;
+	std::atomic<unsigned int> consumerStalls;
+	std::atomic<unsigned long long> consumerStallUsec;
+} SysFrameRingStats;
+
+// Bounded single-producer/single-consumer ring of frame packets. Each slot
+// has its own fence that the consumer signals once it has released the slot,
+// so the producer only blocks when it laps a frame still being consumed.
+typedef struct SysFrameRing
+{
+	void* packets[SYS_FRAME_RING_MAX_DEPTH];
+	SysEvent slotFence[SYS_FRAME_RING_MAX_DEPTH];
+	SysEvent frameQueued;
+	std::atomic<unsigned int> head;
+	std::atomic<unsigned int> tail;
+	unsigned int depth;
+	SysFrameRingStats stats;
+} SysFrameRing;
+
+void Sys_InitFrameRing(SysFrameRing* ring, int depth);
+void Sys_WaitFrameSlot(SysFrameRing* ring);
+unsigned int Sys_PushFrame(SysFrameRing* ring, void* packet);
+void* Sys_AcquireFrame(SysFrameRing* ring, unsigned int msec);
+void Sys_ReleaseFrame(SysFrameRing* ring);
+bool Sys_IsFrameRetired(SysFrameRing* ring, unsigned int frame);
+void Sys_FlushFrameRing(SysFrameRing* ring);
+void Sys_ResizeFrameRing(SysFrameRing* ring, int depth);
+unsigned int Sys_GetFramesQueued(SysFrameRing* ring);
+void Sys_PrintFrameRingStats(char const* name, SysFrameRing* ring);
+
+#endif // THREADS_RING_H
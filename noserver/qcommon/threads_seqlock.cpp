@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threads_seqlock.h"
+
+#include <universal/q_shared.h>
+#include <qcommon/common.h>
+
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+static void Seq_StoreWords(std::atomic<unsigned long long>* dest, void const* data, int size)
+{
+	unsigned char const* src;
+	unsigned long long word;
+	int offset;
+
+	src = (unsigned char const*)data;
+	for (offset = 0; offset < size; offset += sizeof(word))
+	{
+		word = 0;
+		memcpy(&word, src + offset, size - offset < (int)sizeof(word) ? size - offset : sizeof(word));
+		dest->store(word, std::memory_order_relaxed);
+		++dest;
+	}
+}
+
+static void Seq_LoadWords(std::atomic<unsigned long long> const* src, void* out, int size)
+{
+	unsigned char* dest;
+	unsigned long long word;
+	int offset;
+
+	dest = (unsigned char*)out;
+	for (offset = 0; offset < size; offset += sizeof(word))
+	{
+		word = src->load(std::memory_order_relaxed);
+		memcpy(dest + offset, &word, size - offset < (int)sizeof(word) ? size - offset : sizeof(word));
+		++src;
+	}
+}
+
+void Sys_InitSeqBuffer(SysSeqBuffer* buffer, int size, void const* initial)
+{
+	int i;
+	int word;
+
+	buffer->size = size;
+	buffer->words = (size + 7) / 8;
+	for (i = 0; i < 2; ++i)
+	{
+		buffer->copies[i] = new std::atomic<unsigned long long>[buffer->words];
+		if (initial)
+		{
+			Seq_StoreWords(buffer->copies[i], initial, size);
+			continue;
+		}
+		for (word = 0; word < buffer->words; ++word)
+			buffer->copies[i][word].store(0, std::memory_order_relaxed);
+	}
+	buffer->readRetries.store(0, std::memory_order_relaxed);
+	buffer->sequence.store(0, std::memory_order_release);
+}
+
+void Sys_FreeSeqBuffer(SysSeqBuffer* buffer)
+{
+	delete[] buffer->copies[0];
+	delete[] buffer->copies[1];
+	buffer->copies[0] = 0;
+	buffer->copies[1] = 0;
+}
+
+// Only one thread may write a given buffer. Returns the new version.
+unsigned int Sys_WriteSeqBuffer(SysSeqBuffer* buffer, void const* data)
+{
+	unsigned int sequence;
+
+	sequence = buffer->sequence.load(std::memory_order_relaxed);
+	assert(!(sequence & 1));
+
+	// odd: readers move to copy 1 while copy 0 is rewritten. The store must
+	// be a release, not just relaxed: a reader that acquires the odd value
+	// goes straight to copy 1, so the previous write's copy 1 stores have to
+	// be visible by then. x86 orders stores anyway, which is why the torture
+	// test can't show it; weakly ordered cpus don't. The fence after it keeps
+	// the copy 0 stores from moving up past it.
+	buffer->sequence.store(sequence + 1, std::memory_order_release);
+	std::atomic_thread_fence(std::memory_order_release);
+	Seq_StoreWords(buffer->copies[0], data, buffer->size);
+
+	// even again: readers take the new copy 0 while copy 1 catches up
+	buffer->sequence.store(sequence + 2, std::memory_order_release);
+	std::atomic_thread_fence(std::memory_order_release);
+	Seq_StoreWords(buffer->copies[1], data, buffer->size);
+	return (sequence + 2) >> 1;
+}
+
+// Copies the newest finished state into out and returns its version. Any
+// thread, any number at once.
+unsigned int Sys_ReadSeqBuffer(SysSeqBuffer* buffer, void* out)
+{
+	unsigned int sequence;
+
+	while (1)
+	{
+		sequence = buffer->sequence.load(std::memory_order_acquire);
+		Seq_LoadWords(buffer->copies[sequence & 1], out, buffer->size);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (buffer->sequence.load(std::memory_order_relaxed) == sequence)
+			return sequence >> 1;
+		buffer->readRetries.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+#define SEQ_TORTURE_READERS 3
+#define SEQ_TORTURE_WORDS 37
+#define SEQ_TORTURE_MSEC 1000
+
+// Every word is derived from the version, so a torn copy shows up as words
+// that disagree with each other. 37 words leaves a partial last word.
+typedef struct SeqTortureState
+{
+	unsigned int version;
+	unsigned int words[SEQ_TORTURE_WORDS];
+} SeqTortureState;
+
+typedef struct SeqTortureReader
+{
+	alignas(SYS_SEQ_CACHE_LINE) unsigned long long reads;
+	unsigned int torn;
+	unsigned int backwards;
+} SeqTortureReader;
+
+static SysSeqBuffer s_seqTortureBuffer;
+static SeqTortureState s_seqTortureLocked;
+static std::mutex s_seqTortureMutex;
+static std::atomic<bool> s_seqTortureStop;
+
+static void Seq_TortureFill(SeqTortureState* state, unsigned int version)
+{
+	int i;
+
+	state->version = version;
+	for (i = 0; i < SEQ_TORTURE_WORDS; ++i)
+		state->words[i] = version * 2654435761u + i;
+}
+
+static bool Seq_TortureCheck(SeqTortureState const* state)
+{
+	int i;
+
+	for (i = 0; i < SEQ_TORTURE_WORDS; ++i)
+	{
+		if (state->words[i] != state->version * 2654435761u + i)
+			return false;
+	}
+	return true;
+}
+
+static void Seq_TortureSeqReader(SeqTortureReader* reader)
+{
+	SeqTortureState state;
+	unsigned int version;
+	unsigned int last;
+
+	last = 0;
+	while (!s_seqTortureStop.load(std::memory_order_relaxed))
+	{
+		version = Sys_ReadSeqBuffer(&s_seqTortureBuffer, &state);
+		if (!Seq_TortureCheck(&state) || state.version != version)
+			++reader->torn;
+		if (version < last)
+			++reader->backwards;
+		last = version;
+		++reader->reads;
+	}
+}
+
+static void Seq_TortureMutexReader(SeqTortureReader* reader)
+{
+	SeqTortureState state;
+
+	while (!s_seqTortureStop.load(std::memory_order_relaxed))
+	{
+		{
+			std::lock_guard<std::mutex> lock(s_seqTortureMutex);
+			state = s_seqTortureLocked;
+		}
+		if (!Seq_TortureCheck(&state))
+			++reader->torn;
+		++reader->reads;
+	}
+}
+
+// Runs the writer flat out against SEQ_TORTURE_READERS readers and returns
+// the writes made; readers count their reads and any torn or stale copies.
+static unsigned int Seq_TortureRun(bool useMutex, SeqTortureReader* readers)
+{
+	std::thread threads[SEQ_TORTURE_READERS];
+	std::chrono::steady_clock::time_point end;
+	SeqTortureState state;
+	unsigned int version;
+	int i;
+
+	s_seqTortureStop.store(false);
+	for (i = 0; i < SEQ_TORTURE_READERS; ++i)
+	{
+		readers[i].reads = 0;
+		readers[i].torn = 0;
+		readers[i].backwards = 0;
+		threads[i] = std::thread(useMutex ? Seq_TortureMutexReader : Seq_TortureSeqReader, &readers[i]);
+	}
+
+	end = std::chrono::steady_clock::now() + std::chrono::milliseconds(SEQ_TORTURE_MSEC);
+	version = 0;
+	while (std::chrono::steady_clock::now() < end)
+	{
+		++version;
+		Seq_TortureFill(&state, version);
+		if (useMutex)
+		{
+			std::lock_guard<std::mutex> lock(s_seqTortureMutex);
+			s_seqTortureLocked = state;
+		}
+		else
+		{
+			Sys_WriteSeqBuffer(&s_seqTortureBuffer, &state);
+		}
+	}
+
+	s_seqTortureStop.store(true);
+	for (i = 0; i < SEQ_TORTURE_READERS; ++i)
+		threads[i].join();
+	return version;
+}
+
+static void Seq_TorturePrint(char const* name, unsigned int writes, SeqTortureReader const* readers)
+{
+	unsigned long long reads;
+	unsigned int torn;
+	unsigned int backwards;
+	int i;
+
+	reads = 0;
+	torn = 0;
+	backwards = 0;
+	for (i = 0; i < SEQ_TORTURE_READERS; ++i)
+	{
+		reads += readers[i].reads;
+		torn += readers[i].torn;
+		backwards += readers[i].backwards;
+	}
+	Com_Printf(CON_CHANNEL_SYSTEM, "%-8s %10u writes %12llu reads, %u torn, %u out of order\n", name, writes, reads, torn, backwards);
+}
+
+// One writer rewrites a versioned record as fast as it can while readers
+// copy and verify it, first through the seqlock and then through a mutex for
+// comparison. Any torn or out of order read is a bug.
+void Sys_SeqLockTorture_f(void)
+{
+	SeqTortureReader readers[SEQ_TORTURE_READERS];
+	SeqTortureState state;
+	unsigned int writes;
+
+	Seq_TortureFill(&state, 0);
+	Sys_InitSeqBuffer(&s_seqTortureBuffer, sizeof(state), &state);
+	writes = Seq_TortureRun(false, readers);
+	Seq_TorturePrint("seqlock", writes, readers);
+	Com_Printf(CON_CHANNEL_SYSTEM, "         %u reader retries\n", s_seqTortureBuffer.readRetries.load());
+	Sys_FreeSeqBuffer(&s_seqTortureBuffer);
+
+	s_seqTortureLocked = state;
+	writes = Seq_TortureRun(true, readers);
+	Seq_TorturePrint("mutex", writes, readers);
+}
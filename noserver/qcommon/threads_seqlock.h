@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADS_SEQLOCK_H
+#define THREADS_SEQLOCK_H
+
+#include <atomic>
+
+#define SYS_SEQ_CACHE_LINE 64
+
+// Double-buffered seqlock for small state that is read far more often than it
+// is written, by one writer and any number of readers. The writer updates the
+// copy readers are not using, flips the sequence, then updates the other one,
+// so a reader always finds a finished copy and never waits for the writer,
+// and the writer never waits for readers. A reader retries only if the writer
+// flipped while it was copying. The copies are kept as atomic words so a read
+// racing a write is a retry, not undefined behavior.
+typedef struct SysSeqBuffer
+{
+	alignas(SYS_SEQ_CACHE_LINE) std::atomic<unsigned int> sequence;
+	std::atomic<unsigned int> readRetries;
+	alignas(SYS_SEQ_CACHE_LINE) std::atomic<unsigned long long>* copies[2];
+	int size;
+	int words;
+} SysSeqBuffer;
+
+void Sys_InitSeqBuffer(SysSeqBuffer* buffer, int size, void const* initial);
+void Sys_FreeSeqBuffer(SysSeqBuffer* buffer);
+unsigned int Sys_WriteSeqBuffer(SysSeqBuffer* buffer, void const* data);
+unsigned int Sys_ReadSeqBuffer(SysSeqBuffer* buffer, void* out);
+void Sys_SeqLockTorture_f(void);
+
+// Counts writes, so a reader can tell whether anything changed since its last
+// read without copying.
+inline unsigned int Sys_GetSeqBufferVersion(SysSeqBuffer const* buffer)
+{
+	return buffer->sequence.load(std::memory_order_acquire) >> 1;
+}
+
+#endif // THREADS_SEQLOCK_H
@@ -0,0 +1,373 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threads_stream.h"
+
+#include <universal/q_shared.h>
+#include <qcommon/common.h>
+#include <qcommon/threads.h>
+#include <qcommon/threads_wait.h>
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+typedef struct StreamQueue
+{
+	std::mutex pendingMutex;
+	SysStreamRequest* pendingHead[SYS_LOAD_PRIORITY_COUNT];
+	SysStreamRequest* pendingTail[SYS_LOAD_PRIORITY_COUNT];
+	// auto-reset; a woken thread passes it on while requests remain, so one
+	// signal per enqueue wakes as many threads as there is work
+	SysEvent work;
+	std::atomic<bool> shutdown;
+	// on the heap like the job workers: nothing joins them at process exit,
+	// and a static std::thread destroyed while joinable calls std::terminate
+	std::thread* threads[SYS_MAX_STREAM_THREADS];
+	int threadCount;
+} StreamQueue;
+
+static StreamQueue s_streamQueue;
+static thread_local int s_streamThreadIndex;
+
+static void Stream_Finish(SysStreamRequest* request, int status)
+{
+	SysJobCounter* counter;
+
+	// the request may be freed as soon as either is visible
+	counter = request->counter;
+	request->status.store(status, std::memory_order_release);
+	if (counter)
+		counter->pending.fetch_sub(1, std::memory_order_release);
+}
+
+static SysStreamRequest* Stream_PopPending(bool* more)
+{
+	SysStreamRequest* request;
+	int priority;
+
+	std::lock_guard<std::mutex> lock(s_streamQueue.pendingMutex);
+	request = 0;
+	*more = false;
+	for (priority = SYS_LOAD_PRIORITY_COUNT - 1; priority >= 0; --priority)
+	{
+		if (!s_streamQueue.pendingHead[priority])
+			continue;
+		if (request)
+		{
+			*more = true;
+			break;
+		}
+		request = s_streamQueue.pendingHead[priority];
+		s_streamQueue.pendingHead[priority] = request->next;
+		if (!request->next)
+			s_streamQueue.pendingTail[priority] = 0;
+		request->next = 0;
+		if (s_streamQueue.pendingHead[priority])
+		{
+			*more = true;
+			break;
+		}
+	}
+	return request;
+}
+
+static void Stream_ThreadMain(int streamIndex)
+{
+	SysStreamRequest* request;
+	bool more;
+
+	s_streamThreadIndex = streamIndex;
+	Sys_InitStreamWorkerThread(streamIndex);
+	while (1)
+	{
+		request = Stream_PopPending(&more);
+		if (more)
+			Sys_SignalEvent(&s_streamQueue.work);
+		if (!request)
+		{
+			if (s_streamQueue.shutdown.load(std::memory_order_acquire))
+				break;
+			Sys_WaitEvent(&s_streamQueue.work, SYS_WAIT_INFINITE);
+			continue;
+		}
+		if (request->token && request->token->cancelled.load(std::memory_order_acquire))
+			Stream_Finish(request, SYS_LOAD_CANCELLED);
+		else
+			Stream_Finish(request, request->read(request) ? SYS_LOAD_DONE : SYS_LOAD_FAILED);
+	}
+	// hand the shutdown on to the next sleeping thread
+	Sys_SignalEvent(&s_streamQueue.work);
+	Sys_ShutdownStreamWorkerThread();
+}
+
+// Starts count stream I/O threads, replacing any already running. The queue
+// is static and starts out empty, so requests queued before this wait for it.
+void Sys_InitStreamThreads(int count)
+{
+	int i;
+
+	if (count < 1)
+		count = 1;
+	if (count > SYS_MAX_STREAM_THREADS)
+		count = SYS_MAX_STREAM_THREADS;
+	if (s_streamQueue.threadCount)
+		Sys_ShutdownStreamThreads();
+
+	s_streamQueue.shutdown.store(false, std::memory_order_relaxed);
+	for (i = 0; i < count; ++i)
+		s_streamQueue.threads[i] = new std::thread(Stream_ThreadMain, i + 1);
+	s_streamQueue.threadCount = count;
+	Sys_SignalEvent(&s_streamQueue.work);
+}
+
+// Finishes everything still queued, then joins the stream I/O threads.
+void Sys_ShutdownStreamThreads(void)
+{
+	int i;
+
+	if (!s_streamQueue.threadCount)
+		return;
+	s_streamQueue.shutdown.store(true, std::memory_order_release);
+	Sys_SignalEvent(&s_streamQueue.work);
+	for (i = 0; i < s_streamQueue.threadCount; ++i)
+	{
+		s_streamQueue.threads[i]->join();
+		delete s_streamQueue.threads[i];
+		s_streamQueue.threads[i] = 0;
+	}
+	s_streamQueue.threadCount = 0;
+	// the last thread out left the event signaled
+	Sys_ClearEvent(&s_streamQueue.work);
+}
+
+int Sys_GetStreamThreadCount(void)
+{
+	return s_streamQueue.threadCount;
+}
+
+// 1 to SYS_MAX_STREAM_THREADS on a stream I/O thread, 0 everywhere else.
+int Sys_GetStreamThreadIndex(void)
+{
+	return s_streamThreadIndex;
+}
+
+void Sys_EnqueueStream(SysStreamRequest* request)
+{
+	int priority;
+
+	priority = request->priority;
+	if (priority < 0)
+		priority = 0;
+	if (priority >= SYS_LOAD_PRIORITY_COUNT)
+		priority = SYS_LOAD_PRIORITY_COUNT - 1;
+
+	request->status.store(SYS_LOAD_PENDING, std::memory_order_relaxed);
+	request->next = 0;
+	if (request->counter)
+		request->counter->pending.fetch_add(1, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(s_streamQueue.pendingMutex);
+		if (s_streamQueue.pendingTail[priority])
+			s_streamQueue.pendingTail[priority]->next = request;
+		else
+			s_streamQueue.pendingHead[priority] = request;
+		s_streamQueue.pendingTail[priority] = request;
+	}
+	Sys_SignalEvent(&s_streamQueue.work);
+}
+
+// Finishes the token's queued requests as cancelled; ones already reading
+// run to completion.
+void Sys_CancelStreams(SysCancelToken* token)
+{
+	SysStreamRequest* cancelled;
+	SysStreamRequest* request;
+	SysStreamRequest** link;
+	int priority;
+
+	token->cancelled.store(1, std::memory_order_release);
+
+	cancelled = 0;
+	{
+		std::lock_guard<std::mutex> lock(s_streamQueue.pendingMutex);
+		for (priority = 0; priority < SYS_LOAD_PRIORITY_COUNT; ++priority)
+		{
+			s_streamQueue.pendingTail[priority] = 0;
+			for (link = &s_streamQueue.pendingHead[priority]; *link; )
+			{
+				request = *link;
+				if (request->token == token)
+				{
+					*link = request->next;
+					request->next = cancelled;
+					cancelled = request;
+				}
+				else
+				{
+					s_streamQueue.pendingTail[priority] = request;
+					link = &request->next;
+				}
+			}
+		}
+	}
+	while (cancelled)
+	{
+		request = cancelled;
+		cancelled = request->next;
+		Stream_Finish(request, SYS_LOAD_CANCELLED);
+	}
+}
+
+#define STREAM_BENCH_FILE "stream_bench.tmp"
+#define STREAM_BENCH_BLOCK (256 * 1024)
+#define STREAM_BENCH_BLOCKS 256
+
+typedef struct StreamBenchBlock
+{
+	long offset;
+	unsigned char* dest;
+} StreamBenchBlock;
+
+static FILE* s_streamBenchFiles[SYS_MAX_STREAM_THREADS + 1];
+
+static bool Stream_BenchRead(SysStreamRequest* request)
+{
+	StreamBenchBlock* block;
+	FILE* f;
+	int index;
+
+	// each stream thread reads through its own handle, the way
+	// FS_HandleForFile gives each its own pool
+	index = Sys_GetStreamThreadIndex();
+	f = s_streamBenchFiles[index];
+	if (!f)
+	{
+		f = fopen(STREAM_BENCH_FILE, "rb");
+		if (!f)
+			return false;
+		s_streamBenchFiles[index] = f;
+	}
+	block = (StreamBenchBlock*)request->data;
+	if (fseek(f, block->offset, SEEK_SET))
+		return false;
+	return fread(block->dest, 1, STREAM_BENCH_BLOCK, f) == STREAM_BENCH_BLOCK;
+}
+
+static bool Stream_BenchWriteFile(unsigned char* buffer)
+{
+	FILE* f;
+	int i;
+
+	for (i = 0; i < STREAM_BENCH_BLOCK; ++i)
+		buffer[i] = (unsigned char)(i * 131 + 7);
+	f = fopen(STREAM_BENCH_FILE, "wb");
+	if (!f)
+		return false;
+	for (i = 0; i < STREAM_BENCH_BLOCKS; ++i)
+	{
+		if (fwrite(buffer, 1, STREAM_BENCH_BLOCK, f) != STREAM_BENCH_BLOCK)
+		{
+			fclose(f);
+			return false;
+		}
+	}
+	fclose(f);
+	return true;
+}
+
+// Reads a scratch file in blocks spread over 1 to SYS_MAX_STREAM_THREADS
+// stream threads. The file was just written, so unless it has been evicted
+// this measures the page cache rather than the drive.
+void Sys_StreamBenchmark_f(void)
+{
+	SysStreamRequest* requests;
+	StreamBenchBlock* blocks;
+	unsigned char* buffer;
+	SysJobCounter counter;
+	std::chrono::steady_clock::time_point start;
+	double seconds;
+	double baseRate;
+	double rate;
+	int previousCount;
+	int threadCount;
+	int failed;
+	int i;
+
+	buffer = new unsigned char[(size_t)STREAM_BENCH_BLOCK * STREAM_BENCH_BLOCKS];
+	if (!Stream_BenchWriteFile(buffer))
+	{
+		Com_Printf(CON_CHANNEL_SYSTEM, "couldn't write %s\n", STREAM_BENCH_FILE);
+		delete[] buffer;
+		return;
+	}
+	requests = new SysStreamRequest[STREAM_BENCH_BLOCKS];
+	blocks = new StreamBenchBlock[STREAM_BENCH_BLOCKS];
+	previousCount = Sys_GetStreamThreadCount();
+
+	Com_Printf(CON_CHANNEL_SYSTEM, "streaming %d MB in %d KB blocks\n",
+		STREAM_BENCH_BLOCK / 1024 * STREAM_BENCH_BLOCKS / 1024, STREAM_BENCH_BLOCK / 1024);
+	baseRate = 0.0;
+	for (threadCount = 1; threadCount <= SYS_MAX_STREAM_THREADS; ++threadCount)
+	{
+		Sys_InitStreamThreads(threadCount);
+		counter.pending.store(0, std::memory_order_relaxed);
+		start = std::chrono::steady_clock::now();
+		for (i = 0; i < STREAM_BENCH_BLOCKS; ++i)
+		{
+			blocks[i].offset = (long)i * STREAM_BENCH_BLOCK;
+			blocks[i].dest = buffer + (size_t)i * STREAM_BENCH_BLOCK;
+			requests[i].name = STREAM_BENCH_FILE;
+			requests[i].priority = i % SYS_LOAD_PRIORITY_COUNT;
+			requests[i].token = 0;
+			requests[i].read = Stream_BenchRead;
+			requests[i].data = &blocks[i];
+			requests[i].counter = &counter;
+			Sys_EnqueueStream(&requests[i]);
+		}
+		Sys_WaitForCounter(&counter);
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		failed = 0;
+		for (i = 0; i < STREAM_BENCH_BLOCKS; ++i)
+		{
+			if (requests[i].status.load(std::memory_order_acquire) != SYS_LOAD_DONE)
+				++failed;
+		}
+		rate = (double)STREAM_BENCH_BLOCK * STREAM_BENCH_BLOCKS / (1024.0 * 1024.0) / seconds;
+		if (threadCount == 1)
+			baseRate = rate;
+		Com_Printf(CON_CHANNEL_SYSTEM, "%d stream thread%s: %8.1f MB/s (%.2fx)%s\n",
+			threadCount, threadCount == 1 ? " " : "s", rate, rate / baseRate, failed ? " READ ERRORS" : "");
+	}
+
+	Sys_ShutdownStreamThreads();
+	for (i = 0; i <= SYS_MAX_STREAM_THREADS; ++i)
+	{
+		if (s_streamBenchFiles[i])
+		{
+			fclose(s_streamBenchFiles[i]);
+			s_streamBenchFiles[i] = 0;
+		}
+	}
+	remove(STREAM_BENCH_FILE);
+	if (previousCount)
+		Sys_InitStreamThreads(previousCount);
+	delete[] blocks;
+	delete[] requests;
+	delete[] buffer;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADS_STREAM_H
+#define THREADS_STREAM_H
+
+#include <qcommon/threads_jobs.h>
+#include <qcommon/threads_load.h>
+
+#include <atomic>
+
+// Stream I/O threads run beside the stream thread spawned by
+// Sys_SpawnStreamThread. That one is stream index 0, the I/O threads are
+// 1 to SYS_MAX_STREAM_THREADS, and each index has its own file handles.
+#define SYS_MAX_STREAM_THREADS 4
+
+struct SysStreamRequest;
+
+typedef bool (*SysStreamReadFunc)(struct SysStreamRequest* request);
+
+// Owned by the caller and must stay alive until it is finished. read runs on
+// whichever stream thread takes the request, highest priority first. When
+// the request finishes, status leaves SYS_LOAD_PENDING and counter, if set,
+// is decremented, so Sys_WaitForCounter waits for a batch of requests.
+typedef struct SysStreamRequest
+{
+	char const* name;
+	int priority;
+	SysCancelToken* token;
+	SysStreamReadFunc read;
+	void* data;
+	SysJobCounter* counter;
+	std::atomic<int> status;
+	struct SysStreamRequest* next;
+} SysStreamRequest;
+
+void Sys_InitStreamThreads(int count);
+void Sys_ShutdownStreamThreads(void);
+int Sys_GetStreamThreadCount(void);
+int Sys_GetStreamThreadIndex(void);
+void Sys_EnqueueStream(SysStreamRequest* request);
+void Sys_CancelStreams(SysCancelToken* token);
+void Sys_StreamBenchmark_f(void);
+
+#endif // THREADS_STREAM_H
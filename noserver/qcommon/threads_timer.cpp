@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threads_timer.h"
+
+#include <universal/q_shared.h>
+#include <qcommon/common.h>
+
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#pragma comment (lib, "winmm.lib")
+// the scheduler tick is ~1 ms once timeBeginPeriod(1) is in effect
+#define SYS_SLEEP_SLACK_NSEC 2000000ull
+#else
+#define SYS_SLEEP_SLACK_NSEC 200000ull
+#endif
+
+static const unsigned int s_jitterBucketUsec[SYS_JITTER_BUCKETS] = { 10, 25, 50, 100, 250, 500, 1000, 2000, 5000, 0xFFFFFFFF };
+
+unsigned long long Sys_NanoTime(void)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void Sys_InitTimerResolution(void)
+{
+#ifdef _WIN32
+	static bool initialized = timeBeginPeriod(1) == TIMERR_NOERROR;
+	(void)initialized;
+#endif
+}
+
+// Spinning is only worth it while another cpu can run whoever we wait on.
+static void Sys_SpinTail(void)
+{
+	if (Sys_GetSpinCount())
+		Sys_Pause();
+	else
+		std::this_thread::yield();
+}
+
+// Sleeps coarsely until the deadline is within the scheduler's slack, then
+// spins the rest so the wakeup lands on the deadline instead of a timer tick.
+void Sys_SleepUntil(unsigned long long deadlineNsec)
+{
+	unsigned long long now;
+
+	Sys_InitTimerResolution();
+	now = Sys_NanoTime();
+	if (now + SYS_SLEEP_SLACK_NSEC < deadlineNsec)
+		std::this_thread::sleep_for(std::chrono::nanoseconds(deadlineNsec - now - SYS_SLEEP_SLACK_NSEC));
+	while (Sys_NanoTime() < deadlineNsec)
+		Sys_SpinTail();
+}
+
+bool Sys_WaitEventUntil(SysEvent* event, unsigned long long deadlineNsec)
+{
+	unsigned long long now;
+	unsigned long long msec;
+
+	Sys_InitTimerResolution();
+	while (1)
+	{
+		if (Sys_WaitEvent(event, 0))
+			return true;
+		now = Sys_NanoTime();
+		if (now >= deadlineNsec)
+			return false;
+		if (now + SYS_SLEEP_SLACK_NSEC < deadlineNsec)
+		{
+			msec = (deadlineNsec - now - SYS_SLEEP_SLACK_NSEC) / SYS_NSEC_PER_MSEC;
+			if (Sys_WaitEvent(event, msec ? (unsigned int)msec : 1))
+				return true;
+			continue;
+		}
+		Sys_SpinTail();
+	}
+}
+
+void Sys_InitJitterHistogram(SysJitterHistogram* histogram, unsigned int hz)
+{
+	int i;
+
+	histogram->periodNsec = 1000000000ull / hz;
+	histogram->lastTickNsec = 0;
+	histogram->sumUsec = 0;
+	histogram->maxUsec = 0;
+	histogram->ticks = 0;
+	for (i = 0; i < SYS_JITTER_BUCKETS; ++i)
+		histogram->buckets[i] = 0;
+}
+
+void Sys_RecordJitterTick(SysJitterHistogram* histogram, unsigned long long nowNsec)
+{
+	unsigned long long interval;
+	unsigned long long deviation;
+	unsigned long long usec;
+	int bucket;
+
+	interval = nowNsec - histogram->lastTickNsec;
+	if (!histogram->lastTickNsec)
+	{
+		histogram->lastTickNsec = nowNsec;
+		return;
+	}
+	histogram->lastTickNsec = nowNsec;
+
+	deviation = interval > histogram->periodNsec ? interval - histogram->periodNsec : histogram->periodNsec - interval;
+	usec = deviation / 1000;
+	for (bucket = 0; usec > s_jitterBucketUsec[bucket]; ++bucket)
+	{
+	}
+	++histogram->buckets[bucket];
+	++histogram->ticks;
+	histogram->sumUsec += usec;
+	if (usec > histogram->maxUsec)
+		histogram->maxUsec = usec;
+}
+
+void Sys_PrintJitterHistogram(char const* name, SysJitterHistogram const* histogram)
+{
+	int i;
+
+	if (!histogram->ticks)
+	{
+		Com_Printf(CON_CHANNEL_SYSTEM, "%s: no ticks\n", name);
+		return;
+	}
+	Com_Printf(CON_CHANNEL_SYSTEM, "%s: %u ticks at %.2f Hz, mean jitter %llu us, max %llu us\n",
+		name, histogram->ticks, 1000000000.0 / histogram->periodNsec, histogram->sumUsec / histogram->ticks, histogram->maxUsec);
+	for (i = 0; i < SYS_JITTER_BUCKETS; ++i)
+	{
+		if (!histogram->buckets[i])
+			continue;
+		if (i == SYS_JITTER_BUCKETS - 1)
+			Com_Printf(CON_CHANNEL_SYSTEM, "  >%5u us %6u (%5.1f%%)\n", s_jitterBucketUsec[i - 1], histogram->buckets[i], 100.0 * histogram->buckets[i] / histogram->ticks);
+		else
+			Com_Printf(CON_CHANNEL_SYSTEM, "  <=%4u us %6u (%5.1f%%)\n", s_jitterBucketUsec[i], histogram->buckets[i], 100.0 * histogram->buckets[i] / histogram->ticks);
+	}
+}
+
+#define PACING_BENCH_SECONDS 1
+
+void Sys_PacingBenchmark_f(void)
+{
+	static const unsigned int rates[] = { 20, 60, 120 };
+	SysJitterHistogram histogram;
+	unsigned long long deadline;
+	unsigned int tick;
+	unsigned int r;
+	char name[64];
+
+	for (r = 0; r < sizeof(rates) / sizeof(rates[0]); ++r)
+	{
+		// what a millisecond sleep loop gets, the old NET_Sleep pacing
+		Sys_InitJitterHistogram(&histogram, rates[r]);
+		for (tick = 0; tick <= rates[r] * PACING_BENCH_SECONDS; ++tick)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(histogram.periodNsec / SYS_NSEC_PER_MSEC));
+			Sys_RecordJitterTick(&histogram, Sys_NanoTime());
+		}
+		Com_sprintf(name, sizeof(name), "sleep %u Hz", rates[r]);
+		Sys_PrintJitterHistogram(name, &histogram);
+
+		Sys_InitJitterHistogram(&histogram, rates[r]);
+		deadline = Sys_NanoTime();
+		for (tick = 0; tick <= rates[r] * PACING_BENCH_SECONDS; ++tick)
+		{
+			deadline += histogram.periodNsec;
+			Sys_SleepUntil(deadline);
+			Sys_RecordJitterTick(&histogram, Sys_NanoTime());
+		}
+		Com_sprintf(name, sizeof(name), "paced %u Hz", rates[r]);
+		Sys_PrintJitterHistogram(name, &histogram);
+	}
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADS_TIMER_H
+#define THREADS_TIMER_H
+
+#include <qcommon/threads_wait.h>
+
+#define SYS_NSEC_PER_MSEC 1000000ull
+#define SYS_JITTER_BUCKETS 10
+
+// Deviation of each tick interval from the target period, bucketed by the
+// upper bounds in s_jitterBucketUsec.
+typedef struct SysJitterHistogram
+{
+	unsigned long long periodNsec;
+	unsigned long long lastTickNsec;
+	unsigned long long sumUsec;
+	unsigned long long maxUsec;
+	unsigned int ticks;
+	unsigned int buckets[SYS_JITTER_BUCKETS];
+} SysJitterHistogram;
+
+unsigned long long Sys_NanoTime(void);
+void Sys_SleepUntil(unsigned long long deadlineNsec);
+bool Sys_WaitEventUntil(SysEvent* event, unsigned long long deadlineNsec);
+
+void Sys_InitJitterHistogram(SysJitterHistogram* histogram, unsigned int hz);
+void Sys_RecordJitterTick(SysJitterHistogram* histogram, unsigned long long nowNsec);
+void Sys_PrintJitterHistogram(char const* name, SysJitterHistogram const* histogram);
+void Sys_PacingBenchmark_f(void);
+
+#endif // THREADS_TIMER_H
@@ -0,0 +1,458 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threads_topology.h"
+
+#include <universal/q_shared.h>
+#include <universal/dvar.h>
+#include <qcommon/common.h>
+#include <qcommon/threads.h>
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+typedef struct SysCpuEntry
+{
+	int cpu;
+	int coreKey;
+	int package;
+	int node;
+} SysCpuEntry;
+
+static SysCpuTopology s_topology;
+static SysCpuEntry s_entries[SYS_MAX_CPUS];
+
+static const char* s_affinityPolicyNames[] = { "none", "node", "core", NULL };
+
+static dvar_t* sys_affinityPolicy;
+static dvar_t* sys_affinityNode;
+static dvar_t* sys_affinityCoreOffset;
+
+static bool Sys_CompareCpuEntries(SysCpuEntry const& a, SysCpuEntry const& b)
+{
+	if (a.node != b.node)
+		return a.node < b.node;
+	if (a.package != b.package)
+		return a.package < b.package;
+	if (a.coreKey != b.coreKey)
+		return a.coreKey < b.coreKey;
+	return a.cpu < b.cpu;
+}
+
+static void Sys_CpuSetAdd(SysCpuSet* set, int cpu)
+{
+	set->bits[cpu >> 6] |= 1ull << (cpu & 63);
+}
+
+#ifdef _WIN32
+static int Sys_GatherCpus(void)
+{
+	SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX* info;
+	char* buffer;
+	DWORD length;
+	DWORD offset;
+	DWORD_PTR processMask;
+	DWORD_PTR systemMask;
+	bool singleGroup;
+	int cpuIndex[SYS_MAX_CPUS];
+	int count;
+	int cpu;
+	int coreKey;
+	int package;
+	int group;
+	int bit;
+	int i;
+
+	for (i = 0; i < SYS_MAX_CPUS; ++i)
+		cpuIndex[i] = -1;
+
+	length = 0;
+	GetLogicalProcessorInformationEx(RelationAll, 0, &length);
+	buffer = (char*)malloc(length);
+	if (!buffer || !GetLogicalProcessorInformationEx(RelationAll, (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)buffer, &length))
+	{
+		free(buffer);
+		return 0;
+	}
+
+	// a process confined to one group reports its mask, otherwise it may run anywhere
+	singleGroup = GetActiveProcessorGroupCount() == 1;
+	GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask);
+
+	count = 0;
+	coreKey = 0;
+	for (offset = 0; offset < length; offset += info->Size)
+	{
+		info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)(buffer + offset);
+		if (info->Relationship != RelationProcessorCore)
+			continue;
+		for (group = 0; group < info->Processor.GroupCount; ++group)
+		{
+			for (bit = 0; bit < 64; ++bit)
+			{
+				if (!(info->Processor.GroupMask[group].Mask & ((KAFFINITY)1 << bit)))
+					continue;
+				if (singleGroup && !(processMask & ((DWORD_PTR)1 << bit)))
+					continue;
+				cpu = info->Processor.GroupMask[group].Group * 64 + bit;
+				if (cpu >= SYS_MAX_CPUS || count == SYS_MAX_CPUS)
+					continue;
+				cpuIndex[cpu] = count;
+				s_entries[count].cpu = cpu;
+				s_entries[count].coreKey = coreKey;
+				s_entries[count].package = 0;
+				s_entries[count].node = 0;
+				++count;
+			}
+		}
+		++coreKey;
+	}
+
+	package = 0;
+	for (offset = 0; offset < length; offset += info->Size)
+	{
+		info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)(buffer + offset);
+		if (info->Relationship == RelationProcessorPackage)
+		{
+			for (group = 0; group < info->Processor.GroupCount; ++group)
+			{
+				for (bit = 0; bit < 64; ++bit)
+				{
+					cpu = info->Processor.GroupMask[group].Group * 64 + bit;
+					if ((info->Processor.GroupMask[group].Mask & ((KAFFINITY)1 << bit)) && cpu < SYS_MAX_CPUS && cpuIndex[cpu] >= 0)
+						s_entries[cpuIndex[cpu]].package = package;
+				}
+			}
+			++package;
+		}
+		else if (info->Relationship == RelationNumaNode)
+		{
+			for (bit = 0; bit < 64; ++bit)
+			{
+				cpu = info->NumaNode.GroupMask.Group * 64 + bit;
+				if ((info->NumaNode.GroupMask.Mask & ((KAFFINITY)1 << bit)) && cpu < SYS_MAX_CPUS && cpuIndex[cpu] >= 0)
+					s_entries[cpuIndex[cpu]].node = info->NumaNode.NodeNumber;
+			}
+		}
+	}
+	free(buffer);
+	return count;
+}
+#else
+static int Sys_ReadSysInt(char const* fmt, int cpu, int defaultValue)
+{
+	char path[128];
+	FILE* f;
+	int value;
+
+	snprintf(path, sizeof(path), fmt, cpu);
+	f = fopen(path, "r");
+	if (!f)
+		return defaultValue;
+	if (fscanf(f, "%d", &value) != 1)
+		value = defaultValue;
+	fclose(f);
+	return value;
+}
+
+// parses a /sys cpu list such as "0-7,16-23"
+static void Sys_ReadNodeCpuList(int node, int* cpuNode)
+{
+	char path[128];
+	FILE* f;
+	int first;
+	int last;
+	int cpu;
+	int c;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	f = fopen(path, "r");
+	if (!f)
+		return;
+	while (fscanf(f, "%d", &first) == 1)
+	{
+		last = first;
+		c = fgetc(f);
+		if (c == '-')
+		{
+			if (fscanf(f, "%d", &last) != 1)
+				break;
+			c = fgetc(f);
+		}
+		for (cpu = first; cpu <= last && cpu < SYS_MAX_CPUS; ++cpu)
+			cpuNode[cpu] = node;
+		if (c != ',')
+			break;
+	}
+	fclose(f);
+}
+
+static int Sys_GatherCpus(void)
+{
+	cpu_set_t allowed;
+	int cpuNode[SYS_MAX_CPUS];
+	int count;
+	int cpu;
+	int node;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed))
+		return 0;
+
+	for (cpu = 0; cpu < SYS_MAX_CPUS; ++cpu)
+		cpuNode[cpu] = 0;
+	for (node = 0; node < SYS_MAX_NUMA_NODES; ++node)
+		Sys_ReadNodeCpuList(node, cpuNode);
+
+	count = 0;
+	for (cpu = 0; cpu < CPU_SETSIZE && cpu < SYS_MAX_CPUS; ++cpu)
+	{
+		if (!CPU_ISSET(cpu, &allowed))
+			continue;
+		s_entries[count].cpu = cpu;
+		s_entries[count].package = Sys_ReadSysInt("/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu, 0);
+		// core ids are only unique within a package
+		s_entries[count].coreKey = (s_entries[count].package << 16)
+			| Sys_ReadSysInt("/sys/devices/system/cpu/cpu%d/topology/core_id", cpu, cpu);
+		s_entries[count].node = cpuNode[cpu];
+		++count;
+	}
+	return count;
+}
+#endif
+
+void Sys_InitCpuTopology(void)
+{
+	SysLogicalCpu* logical;
+	int count;
+	int i;
+
+	count = Sys_GatherCpus();
+	if (!count)
+	{
+		// no topology information, treat the first cpu as a lone core
+		s_entries[0].cpu = 0;
+		s_entries[0].coreKey = 0;
+		s_entries[0].package = 0;
+		s_entries[0].node = 0;
+		count = 1;
+	}
+	std::sort(s_entries, s_entries + count, Sys_CompareCpuEntries);
+
+	s_topology.cpuCount = count;
+	s_topology.coreCount = 0;
+	s_topology.packageCount = 0;
+	s_topology.nodeCount = 0;
+	for (i = 0; i < count; ++i)
+	{
+		if (!i || s_entries[i].package != s_entries[i - 1].package || s_entries[i].coreKey != s_entries[i - 1].coreKey)
+			++s_topology.coreCount;
+		if (!i || s_entries[i].package != s_entries[i - 1].package)
+			++s_topology.packageCount;
+		if (!i || s_entries[i].node != s_entries[i - 1].node)
+			++s_topology.nodeCount;
+
+		logical = &s_topology.cpus[i];
+		logical->cpu = s_entries[i].cpu;
+		logical->core = s_topology.coreCount - 1;
+		logical->package = s_entries[i].package;
+		logical->node = s_entries[i].node;
+	}
+}
+
+SysCpuTopology const* Sys_GetCpuTopology(void)
+{
+	return &s_topology;
+}
+
+int Sys_GetLogicalCpuCount(void)
+{
+	return s_topology.cpuCount;
+}
+
+int Sys_GetPhysicalCoreCount(void)
+{
+	return s_topology.coreCount;
+}
+
+void Sys_RegisterAffinityDvars(void)
+{
+	sys_affinityPolicy = _Dvar_RegisterEnum("sys_affinityPolicy", s_affinityPolicyNames, SYS_AFFINITY_NONE, 0,
+		"Pin engine threads: none leaves placement to the OS, node confines them to one NUMA node, core gives each its own physical core");
+	sys_affinityNode = _Dvar_RegisterInt("sys_affinityNode", -1, -1, SYS_MAX_NUMA_NODES - 1, 0,
+		"NUMA node to pin to, -1 uses the node of sys_affinityCoreOffset");
+	sys_affinityCoreOffset = _Dvar_RegisterInt("sys_affinityCoreOffset", 0, 0, SYS_MAX_CPUS - 1, 0,
+		"First physical core handed out by the pinning policy, to keep instances sharing a host apart");
+
+	// the registering thread is the main thread, the rest pin themselves as they start
+	Sys_ApplyThreadAffinity(THREAD_CONTEXT_MAIN, 0);
+}
+
+// Order in which threads get cores, latency sensitive threads first.
+static int Sys_GetAffinityOrdinal(int threadContext, int workerIndex)
+{
+	switch (threadContext)
+	{
+	case THREAD_CONTEXT_MAIN:
+		return 0;
+	case THREAD_CONTEXT_SERVER:
+		return 1;
+	case THREAD_CONTEXT_BACKEND:
+		return 2;
+	case THREAD_CONTEXT_DATABASE:
+		return 3;
+	case THREAD_CONTEXT_STREAM:
+		return 4;
+	default:
+		if (workerIndex > 0)
+			return 4 + workerIndex;
+		return -1;
+	}
+}
+
+static void Sys_SetCurrentThreadAffinity(SysCpuSet const* set)
+{
+#ifdef _WIN32
+	GROUP_AFFINITY affinity;
+	int word;
+
+	// a thread can only run in one processor group, use the first one in the set
+	memset(&affinity, 0, sizeof(affinity));
+	for (word = 0; word < SYS_MAX_CPUS / 64; ++word)
+	{
+		if (set->bits[word])
+		{
+			affinity.Group = (WORD)word;
+			affinity.Mask = (KAFFINITY)set->bits[word];
+			break;
+		}
+	}
+	if (affinity.Mask)
+		SetThreadGroupAffinity(GetCurrentThread(), &affinity, 0);
+#else
+	cpu_set_t mask;
+	int cpu;
+
+	CPU_ZERO(&mask);
+	for (cpu = 0; cpu < CPU_SETSIZE && cpu < SYS_MAX_CPUS; ++cpu)
+	{
+		if (set->bits[cpu >> 6] & (1ull << (cpu & 63)))
+			CPU_SET(cpu, &mask);
+	}
+	sched_setaffinity(0, sizeof(mask), &mask);
+#endif
+}
+
+void Sys_ApplyThreadAffinity(int threadContext, int workerIndex)
+{
+	SysCpuSet set;
+	int policy;
+	int ordinal;
+	int node;
+	int firstCore;
+	int lastCore;
+	int core;
+	int i;
+
+	if (!sys_affinityPolicy || !s_topology.cpuCount)
+		return;
+	policy = sys_affinityPolicy->current.integer;
+	if (policy == SYS_AFFINITY_NONE)
+		return;
+	ordinal = Sys_GetAffinityOrdinal(threadContext, workerIndex);
+	if (ordinal < 0)
+		return;
+
+	node = sys_affinityNode->current.integer;
+	if (node < 0)
+	{
+		core = sys_affinityCoreOffset->current.integer % s_topology.coreCount;
+		for (i = 0; s_topology.cpus[i].core != core; ++i)
+		{
+		}
+		node = s_topology.cpus[i].node;
+	}
+
+	// cpus are sorted by node, so the node's cores form one contiguous range
+	firstCore = -1;
+	lastCore = -1;
+	for (i = 0; i < s_topology.cpuCount; ++i)
+	{
+		if (s_topology.cpus[i].node != node)
+			continue;
+		if (firstCore < 0)
+			firstCore = s_topology.cpus[i].core;
+		lastCore = s_topology.cpus[i].core;
+	}
+	if (firstCore < 0)
+		return;
+
+	memset(&set, 0, sizeof(set));
+	if (policy == SYS_AFFINITY_NODE)
+	{
+		for (i = 0; i < s_topology.cpuCount; ++i)
+		{
+			if (s_topology.cpus[i].node == node)
+				Sys_CpuSetAdd(&set, s_topology.cpus[i].cpu);
+		}
+	}
+	else
+	{
+		// hand out the node's cores in order, wrapping once every core has a thread
+		core = firstCore + (sys_affinityCoreOffset->current.integer + ordinal) % (lastCore - firstCore + 1);
+		for (i = 0; i < s_topology.cpuCount; ++i)
+		{
+			if (s_topology.cpus[i].core == core)
+				Sys_CpuSetAdd(&set, s_topology.cpus[i].cpu);
+		}
+	}
+	Sys_SetCurrentThreadAffinity(&set);
+}
+
+void Sys_CpuTopology_f(void)
+{
+	char line[1024];
+	int length;
+	int node;
+	int i;
+
+	Com_Printf(CON_CHANNEL_SYSTEM, "%d logical cpus, %d cores, %d packages, %d numa nodes\n",
+		s_topology.cpuCount, s_topology.coreCount, s_topology.packageCount, s_topology.nodeCount);
+	for (i = 0; i < s_topology.cpuCount; i = length)
+	{
+		node = s_topology.cpus[i].node;
+		line[0] = 0;
+		for (length = i; length < s_topology.cpuCount && s_topology.cpus[length].node == node; ++length)
+		{
+			if (length == i || s_topology.cpus[length].core != s_topology.cpus[length - 1].core)
+				Com_sprintf(line + strlen(line), sizeof(line) - strlen(line), " %s%d", length == i ? "" : "| ", s_topology.cpus[length].cpu);
+			else
+				Com_sprintf(line + strlen(line), sizeof(line) - strlen(line), ",%d", s_topology.cpus[length].cpu);
+		}
+		Com_Printf(CON_CHANNEL_SYSTEM, "node %d:%s\n", node, line);
+	}
+	if (sys_affinityPolicy)
+		Com_Printf(CON_CHANNEL_SYSTEM, "policy %s, node %d, core offset %d\n",
+			s_affinityPolicyNames[sys_affinityPolicy->current.integer],
+			sys_affinityNode->current.integer, sys_affinityCoreOffset->current.integer);
+}
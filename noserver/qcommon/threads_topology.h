@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADS_TOPOLOGY_H
+#define THREADS_TOPOLOGY_H
+
+#define SYS_MAX_CPUS 1024
+#define SYS_MAX_NUMA_NODES 64
+
+enum SysAffinityPolicy
+{
+	SYS_AFFINITY_NONE = 0x0,
+	SYS_AFFINITY_NODE = 0x1,
+	SYS_AFFINITY_CORE = 0x2,
+	SYS_AFFINITY_COUNT = 0x3,
+};
+
+typedef struct SysCpuSet
+{
+	unsigned long long bits[SYS_MAX_CPUS / 64];
+} SysCpuSet;
+
+// cpu is the OS index of the logical processor, on Windows group * 64 + bit
+typedef struct SysLogicalCpu
+{
+	unsigned short cpu;
+	unsigned short core;
+	unsigned short package;
+	unsigned short node;
+} SysLogicalCpu;
+
+// Logical processors the process may run on, sorted by node, package and core
+// so SMT siblings are adjacent.
+typedef struct SysCpuTopology
+{
+	int cpuCount;
+	int coreCount;
+	int packageCount;
+	int nodeCount;
+	SysLogicalCpu cpus[SYS_MAX_CPUS];
+} SysCpuTopology;
+
+void Sys_InitCpuTopology(void);
+SysCpuTopology const* Sys_GetCpuTopology(void);
+int Sys_GetLogicalCpuCount(void);
+int Sys_GetPhysicalCoreCount(void);
+void Sys_RegisterAffinityDvars(void);
+void Sys_ApplyThreadAffinity(int threadContext, int workerIndex);
+void Sys_CpuTopology_f(void);
+
+#endif // THREADS_TOPOLOGY_H
@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threads_wait.h"
+
+#include <qcommon/common.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#pragma comment (lib, "Synchronization.lib")
+#else
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#define SYS_SPIN_COUNT 2000
+
+unsigned int Sys_GetSpinCount(void)
+{
+	static unsigned int spinCount = std::thread::hardware_concurrency() > 1 ? SYS_SPIN_COUNT : 0;
+
+	// spinning on a single cpu only delays the thread we are waiting for
+	return spinCount;
+}
+
+bool Sys_WaitOnAddress(std::atomic<int>* address, int compare, unsigned int msec)
+{
+#ifdef _WIN32
+	return WaitOnAddress(address, &compare, sizeof(compare), msec) != FALSE;
+#else
+	timespec timeout;
+
+	if (msec == SYS_WAIT_INFINITE)
+		return syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, compare, 0, 0, 0) == 0;
+	timeout.tv_sec = msec / 1000;
+	timeout.tv_nsec = (msec % 1000) * 1000000;
+	return syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, compare, &timeout, 0, 0) == 0;
+#endif
+}
+
+void Sys_WakeAddressSingle(std::atomic<int>* address)
+{
+#ifdef _WIN32
+	WakeByAddressSingle(address);
+#else
+	syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, 1, 0, 0, 0);
+#endif
+}
+
+void Sys_WakeAddressAll(std::atomic<int>* address)
+{
+#ifdef _WIN32
+	WakeByAddressAll(address);
+#else
+	syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, 0x7FFFFFFF, 0, 0, 0);
+#endif
+}
+
+void Sys_InitEvent(SysEvent* event, int manualReset, int initialState)
+{
+	event->manualReset = manualReset;
+	event->waiters.store(0, std::memory_order_relaxed);
+	event->signaled.store(initialState ? 1 : 0, std::memory_order_release);
+}
+
+void Sys_SignalEvent(SysEvent* event)
+{
+	if (event->signaled.exchange(1, std::memory_order_seq_cst))
+		return;
+	if (!event->waiters.load(std::memory_order_seq_cst))
+		return;
+	if (event->manualReset)
+		Sys_WakeAddressAll(&event->signaled);
+	else
+		Sys_WakeAddressSingle(&event->signaled);
+}
+
+void Sys_ClearEvent(SysEvent* event)
+{
+	event->signaled.store(0, std::memory_order_release);
+}
+
+bool Sys_IsEventSignaled(SysEvent* event)
+{
+	return event->signaled.load(std::memory_order_acquire) != 0;
+}
+
+static bool Sys_TryConsumeEvent(SysEvent* event)
+{
+	int expected;
+
+	if (event->manualReset)
+		return event->signaled.load(std::memory_order_acquire) != 0;
+	expected = 1;
+	return event->signaled.compare_exchange_strong(expected, 0, std::memory_order_acquire, std::memory_order_relaxed);
+}
+
+bool Sys_WaitEvent(SysEvent* event, unsigned int msec)
+{
+	unsigned int spinCount;
+	unsigned int i;
+	unsigned int remaining;
+	bool consumed;
+	std::chrono::steady_clock::time_point deadline;
+	long long left;
+
+	if (Sys_TryConsumeEvent(event))
+		return true;
+	if (!msec)
+		return false;
+
+	spinCount = Sys_GetSpinCount();
+	for (i = 0; i < spinCount; ++i)
+	{
+		Sys_Pause();
+		if (event->signaled.load(std::memory_order_relaxed) && Sys_TryConsumeEvent(event))
+			return true;
+	}
+
+	if (msec != SYS_WAIT_INFINITE)
+		deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(msec);
+	remaining = msec;
+	event->waiters.fetch_add(1, std::memory_order_seq_cst);
+	while (1)
+	{
+		consumed = Sys_TryConsumeEvent(event);
+		if (consumed)
+			break;
+		Sys_WaitOnAddress(&event->signaled, 0, remaining);
+		if (msec == SYS_WAIT_INFINITE)
+			continue;
+		left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+		if (left <= 0)
+		{
+			consumed = Sys_TryConsumeEvent(event);
+			break;
+		}
+		remaining = (unsigned int)left;
+	}
+	event->waiters.fetch_sub(1, std::memory_order_relaxed);
+	return consumed;
+}
+
+#define EVENT_BENCH_ROUNDS 20000
+
+static SysEvent s_benchWakeEvent;
+static SysEvent s_benchCompletedEvent;
+static std::atomic<bool> s_benchQuit;
+
+// Stands in for the server thread: wait to be woken, report completion.
+static void Sys_EventBenchServer(void)
+{
+	while (1)
+	{
+		Sys_WaitEvent(&s_benchWakeEvent, SYS_WAIT_INFINITE);
+		if (s_benchQuit.load(std::memory_order_relaxed))
+			return;
+		Sys_SignalEvent(&s_benchCompletedEvent);
+	}
+}
+
+#ifdef _WIN32
+static HANDLE s_benchWakeHandle;
+static HANDLE s_benchCompletedHandle;
+
+static void Sys_EventBenchServerWin32(void)
+{
+	while (1)
+	{
+		WaitForSingleObject(s_benchWakeHandle, INFINITE);
+		if (s_benchQuit.load(std::memory_order_relaxed))
+			return;
+		SetEvent(s_benchCompletedHandle);
+	}
+}
+#endif
+
+static void Sys_PrintLatency(char const* label, double* samples, int count)
+{
+	double total;
+	int i;
+
+	std::sort(samples, samples + count);
+	total = 0.0;
+	for (i = 0; i < count; ++i)
+		total += samples[i];
+	Com_Printf(CON_CHANNEL_SYSTEM, "%-8s avg %8.2f us  p50 %8.2f us  p99 %8.2f us  max %8.2f us\n",
+		label, total / count, samples[count / 2], samples[count * 99 / 100], samples[count - 1]);
+}
+
+void Sys_EventLatencyBenchmark_f(void)
+{
+	static double samples[EVENT_BENCH_ROUNDS];
+	std::chrono::steady_clock::time_point start;
+	int i;
+
+	Sys_InitEvent(&s_benchWakeEvent, 0, 0);
+	Sys_InitEvent(&s_benchCompletedEvent, 0, 0);
+	s_benchQuit.store(false);
+	{
+		std::thread server(Sys_EventBenchServer);
+		for (i = 0; i < EVENT_BENCH_ROUNDS; ++i)
+		{
+			start = std::chrono::steady_clock::now();
+			Sys_SignalEvent(&s_benchWakeEvent);
+			Sys_WaitEvent(&s_benchCompletedEvent, SYS_WAIT_INFINITE);
+			samples[i] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+		}
+		s_benchQuit.store(true);
+		Sys_SignalEvent(&s_benchWakeEvent);
+		server.join();
+	}
+	Com_Printf(CON_CHANNEL_SYSTEM, "event ping-pong round trip, %d rounds\n", EVENT_BENCH_ROUNDS);
+	Sys_PrintLatency("futex", samples, EVENT_BENCH_ROUNDS);
+
+#ifdef _WIN32
+	s_benchWakeHandle = CreateEventA(0, 0, 0, 0);
+	s_benchCompletedHandle = CreateEventA(0, 0, 0, 0);
+	s_benchQuit.store(false);
+	{
+		std::thread server(Sys_EventBenchServerWin32);
+		for (i = 0; i < EVENT_BENCH_ROUNDS; ++i)
+		{
+			start = std::chrono::steady_clock::now();
+			SetEvent(s_benchWakeHandle);
+			WaitForSingleObject(s_benchCompletedHandle, INFINITE);
+			samples[i] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+		}
+		s_benchQuit.store(true);
+		SetEvent(s_benchWakeHandle);
+		server.join();
+	}
+	CloseHandle(s_benchWakeHandle);
+	CloseHandle(s_benchCompletedHandle);
+	Sys_PrintLatency("win32", samples, EVENT_BENCH_ROUNDS);
+#endif
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADS_WAIT_H
+#define THREADS_WAIT_H
+
+#include <atomic>
+
+#include <immintrin.h>
+
+#define SYS_WAIT_INFINITE 0xFFFFFFFF
+
+// Same semantics as a Win32 event: a manual-reset event stays signaled until
+// it is reset, an auto-reset event releases a single waiter and clears itself.
+typedef struct SysEvent
+{
+	std::atomic<int> signaled;
+	std::atomic<int> waiters;
+	int manualReset;
+} SysEvent;
+
+inline void Sys_Pause(void)
+{
+	_mm_pause();
+}
+
+unsigned int Sys_GetSpinCount(void);
+bool Sys_WaitOnAddress(std::atomic<int>* address, int compare, unsigned int msec);
+void Sys_WakeAddressSingle(std::atomic<int>* address);
+void Sys_WakeAddressAll(std::atomic<int>* address);
+
+void Sys_InitEvent(SysEvent* event, int manualReset, int initialState);
+void Sys_SignalEvent(SysEvent* event);
+void Sys_ClearEvent(SysEvent* event);
+bool Sys_IsEventSignaled(SysEvent* event);
+bool Sys_WaitEvent(SysEvent* event, unsigned int msec);
+void Sys_EventLatencyBenchmark_f(void);
+
+#endif // THREADS_WAIT_H
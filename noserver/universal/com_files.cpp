@@ -25,6 +25,8 @@
 #include <universal/win_common.h>
 #include <qcommon/common.h>
 #include <qcommon/files.h>
+#include <qcommon/threads.h>
+#include <qcommon/threads_jobs.h>
 #include <stringed/stringed_hooks.h>
 
 #include <ShlObj.h>
@@ -220,6 +222,7 @@ int FS_HandleForFile(char const* name, FsThread thread)
 	int i;
 	int count;
 	int first;
+	int streamIndex;
 
 	switch (thread)
 	{
@@ -228,8 +231,9 @@ int FS_HandleForFile(char const* name, FsThread thread)
 			count = 49;
 			break;
 		case FS_THREAD_STREAM:
-			first = 50;
-			count = 11;
+			streamIndex = Sys_GetStreamThreadIndex();
+			first = streamIndex ? FS_STREAM_IO_HANDLE_FIRST + (streamIndex - 1) * FS_STREAM_HANDLES : 50;
+			count = FS_STREAM_HANDLES;
 			break;
 		case FS_THREAD_DATABASE:
 			first = 61;
@@ -260,7 +264,7 @@ int FS_HandleForFile(char const* name, FsThread thread)
 	Com_PrintWarning(CON_CHANNEL_FILES, "FILE %2i: '%s' 0x%x\n", first, fsh[first].name, fsh[first].handleFiles.file.o);
 	Com_PrintWarning(CON_CHANNEL_FILES, "FS_HandleForFile: none free (%d)\n", thread);
 
-	for (i = 1; i < 70; ++i)
+	for (i = 1; i < FS_MAX_FILE_HANDLES; ++i)
 	{
 		Com_Printf(CON_CHANNEL_FILES, "FILE %2i: '%s' 0x%x\n", i, fsh[i].name, fsh[i].handleFiles.file.o);
 	}
@@ -271,15 +275,19 @@ int FS_HandleForFile(char const* name, FsThread thread)
 
 int FS_HandleForFileCurrentThread(char const* filename)
 {
-	if (Sys_IsMainThread())
+	switch (Sys_GetThreadContext())
+	{
+	case THREAD_CONTEXT_MAIN:
 		return FS_HandleForFile(filename, FS_THREAD_MAIN);
-	if (Sys_IsDatabaseThread())
+	case THREAD_CONTEXT_DATABASE:
 		return FS_HandleForFile(filename, FS_THREAD_DATABASE);
-	if (Sys_IsStreamThread())
+	case THREAD_CONTEXT_STREAM:
 		return FS_HandleForFile(filename, FS_THREAD_STREAM);
-	if (Sys_IsRenderThread())
+	case THREAD_CONTEXT_BACKEND:
 		return FS_HandleForFile(filename, FS_THREAD_BACKEND);
-	return FS_HandleForFile(filename, FS_THREAD_SERVER);
+	default:
+		return FS_HandleForFile(filename, FS_THREAD_SERVER);
+	}
 }
 
 FILE* FS_FileForHandle(int f)
@@ -289,27 +297,21 @@ FILE* FS_FileForHandle(int f)
 
 FsThread FS_GetCurrentThread()
 {
-	if (Sys_IsMainThread())
+	switch (Sys_GetThreadContext())
 	{
+	case THREAD_CONTEXT_MAIN:
 		return FS_THREAD_MAIN;
-	}
-	if (Sys_IsDatabaseThread())
-	{
+	case THREAD_CONTEXT_DATABASE:
 		return FS_THREAD_DATABASE;
-	}
-	if (Sys_IsStreamThread())
-	{
+	case THREAD_CONTEXT_STREAM:
 		return FS_THREAD_STREAM;
-	}
-	if (Sys_IsRenderThread())
-	{
+	case THREAD_CONTEXT_BACKEND:
 		return FS_THREAD_COUNT;
-	}
-	if (Sys_IsServerThread())
-	{
+	case THREAD_CONTEXT_SERVER:
 		return FS_THREAD_SERVER;
+	default:
+		return FS_THREAD_INVALID;
 	}
-	return FS_THREAD_INVALID;
 }
 
 __int64 FS_filelength(int f)
@@ -867,7 +869,8 @@ int FS_Read(void* buffer, int len, int h)
 
 		if (read == -1)
 		{
-			if (h >= 50 && h < 61)
+			// stream handles, the stream thread's and each stream I/O thread's
+			if ((h >= 50 && h < 61) || (h >= FS_STREAM_IO_HANDLE_FIRST && h < FS_MAX_FILE_HANDLES))
 			{
 				return -1;
 			}
@@ -1206,6 +1209,75 @@ int FS_AddFileToList(HunkUser* user, char const* name, char const** list, int nf
 	return nfiles;
 }
 
+#define FS_IWD_SCAN_GRAIN 256
+
+typedef struct FsIwdScan
+{
+	char const* filter;
+	char const* sanitizedPath;
+	int pathLength;
+	int pathDepth;
+	char const* extension;
+	int extensionLength;
+	bool isDirSearch;
+	fileInIwd_s const* buildBuffer;
+	bool* matches;
+} FsIwdScan;
+
+static bool FS_IwdFileMatches(FsIwdScan const* scan, char const* name)
+{
+	char zpath[256];
+	int depth;
+	int zpathLen;
+	int length;
+
+	if (scan->filter)
+	{
+		return Com_FilterPath(scan->filter, name, 0);
+	}
+
+	// check for directory match
+	zpathLen = FS_ReturnPath(name, zpath, &depth);
+	if (depth != scan->pathDepth
+		|| scan->pathLength > zpathLen
+		|| (scan->pathLength > 0 && name[scan->pathLength] != '/')
+		|| I_strnicmp(name, scan->sanitizedPath, scan->pathLength))
+	{
+		return false;
+	}
+
+	length = strlen(name);
+	if (scan->isDirSearch)
+	{
+		assert(scan->extensionLength == 1);
+		assert(scan->extension[0] == '/' && scan->extension[1] == '\0');
+		return name[length - 1] == '/';
+	}
+
+	if (scan->extensionLength)
+	{
+		if (length <= scan->extensionLength
+			|| name[length - scan->extensionLength - 1] != '.'
+			|| I_stricmp(&name[length - scan->extensionLength], scan->extension))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static void FS_ScanIwdRange(int begin, int end, void* data)
+{
+	FsIwdScan* scan;
+	int i;
+
+	scan = (FsIwdScan*)data;
+	for (i = begin; i < end; ++i)
+	{
+		scan->matches[i] = FS_IwdFileMatches(scan, scan->buildBuffer[i].name);
+	}
+}
+
 char const** FS_ListFilteredFiles(searchpath_s* searchPath, char const* path, char const* extension, char const* filter, FsListBehavior_e behavior, int* numfiles, int allocTrackType)
 {
 	const char** result;
@@ -1213,9 +1285,7 @@ char const** FS_ListFilteredFiles(searchpath_s* searchPath, char const* path, ch
 	int numSysFiles;
 	char** sysFiles;
 	char szTrimmedName[64];
-	int depth;
 	char* name;
-	int zpathLen;
 	int pathDepth;
 	iwd_t* iwd;
 	char zpath[256];
@@ -1230,7 +1300,7 @@ char const** FS_ListFilteredFiles(searchpath_s* searchPath, char const* path, ch
 	char sanitizedPath[256];
 	searchpath_s* search;
 	int i;
-	int length;
+	FsIwdScan scan;
 
 	FS_CheckFileSystemStarted();
 	if (!path)
@@ -1265,6 +1335,14 @@ char const** FS_ListFilteredFiles(searchpath_s* searchPath, char const* path, ch
 		++pathDepth;
 	}
 
+	scan.filter = filter;
+	scan.sanitizedPath = sanitizedPath;
+	scan.pathLength = pathLength;
+	scan.pathDepth = pathDepth;
+	scan.extension = extension;
+	scan.extensionLength = extensionLength;
+	scan.isDirSearch = isDirSearch;
+
 	user = Hunk_UserCreate(0x20000, HU_SCHEME_DEFAULT, 0, NULL, "FS_ListFilteredFiles", 3);
 	list = (const char**)Hunk_UserAlloc(user, 65540, 4, NULL);
 	*list = (const char*)user;
@@ -1285,70 +1363,47 @@ char const** FS_ListFilteredFiles(searchpath_s* searchPath, char const* path, ch
 					continue;
 				}
 
-				// look through all the pak file elements
+				// look through all the pak file elements; matching is independent
+				// per file so it is split across the workers, and the matches
+				// are added here in order so the list is the same as before
 				iwd = search->iwd;
 				buildBuffer = iwd->buildBuffer;
+				scan.buildBuffer = buildBuffer;
+				scan.matches = (bool*)Z_Malloc(iwd->numFiles, "FS_ListFilteredFiles", 3);
+				Sys_ParallelFor(0, iwd->numFiles, FS_IWD_SCAN_GRAIN, FS_ScanIwdRange, &scan);
 				for (i = 0; i < iwd->numFiles; ++i)
 				{
-					// check for directory match
+					if (!scan.matches[i])
+					{
+						continue;
+					}
+
 					name = buildBuffer[i].name;
-					//
 					if (filter)
 					{
-						if (Com_FilterPath(filter, name, 0))
-						{
-							// unique the match
-							nfiles = FS_AddFileToList(user, name, list, nfiles);
-						}
+						// unique the match
+						nfiles = FS_AddFileToList(user, name, list, nfiles);
 						continue;
 					}
 
-					zpathLen = FS_ReturnPath(name, zpath, &depth);
-					if (depth == pathDepth
-						&& pathLength <= zpathLen
-						&& (pathLength <= 0 || name[pathLength] == 47)
-						&& !I_strnicmp(name, sanitizedPath, pathLength))
+					temp = pathLength;
+					if (pathLength)
 					{
-						if (!isDirSearch)
-						{
-							if (extensionLength)
-							{
-								length = strlen(name);
-								if (length <= extensionLength
-									|| name[length - extensionLength - 1] != 46
-									|| I_stricmp(&name[length - extensionLength], extension))
-								{
-									continue;
-								}
-							}
-						LABEL_46:
-							temp = pathLength;
-							if (pathLength)
-							{
-								++temp;
-							}
-
-							if (isDirSearch)
-							{
-								strcpy(szTrimmedName, name + temp);
-								szTrimmedName[strlen(szTrimmedName) - 1] = 0;
-								nfiles = FS_AddFileToList(user, szTrimmedName, list, nfiles);
-							}
-							else
-							{
-								nfiles = FS_AddFileToList(user, name + temp, list, nfiles);
-							}
-							continue;
-						}
+						++temp;
+					}
 
-						assert(extensionLength == 1);
-						assert(extension[0] == '/' && extension[1] == '\\0');
-						if (name[strlen(name) - 1] == 47)
-						{
-							goto LABEL_46;
-						}
+					if (isDirSearch)
+					{
+						strcpy(szTrimmedName, name + temp);
+						szTrimmedName[strlen(szTrimmedName) - 1] = 0;
+						nfiles = FS_AddFileToList(user, szTrimmedName, list, nfiles);
+					}
+					else
+					{
+						nfiles = FS_AddFileToList(user, name + temp, list, nfiles);
 					}
 				}
+				Z_Free(scan.matches, 3);
 			}
 			else if (search->dir && (!fs_restrict->current.enabled && !fs_numServerIwds || behavior))
 			{
@@ -1645,7 +1700,7 @@ void FS_DisplayPath(int bLanguageCull)
 	}
 
 	Com_Printf(CON_CHANNEL_FILES, "\nFile Handles:\n");
-	for (i = 1; i < 70; ++i)
+	for (i = 1; i < FS_MAX_FILE_HANDLES; ++i)
 	{
 		if (fsh[i].handleFiles.file.o)
 		{
@@ -1834,7 +1889,7 @@ void FS_Shutdown(void)
 	int i;
 
 	SEH_Shutdown_StringEd();
-	for (i = 1; i < 70; ++i)
+	for (i = 1; i < FS_MAX_FILE_HANDLES; ++i)
 	{
 		if (fsh[i].fileSize)
 		{
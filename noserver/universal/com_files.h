@@ -18,6 +18,7 @@
 #define COM_FILES_H
 
 #include <universal/dvar.h>
+#include <qcommon/threads_stream.h>
 
 union qfile_gus
 {
@@ -80,7 +81,13 @@ static dvar_t* fs_copyfiles;
 static dvar_t* fs_userDocuments;
 static dvar_t* fs_usermapDir;
 
-static fileHandleData_t fsh[70];
+// Handles 50-60 belong to the stream thread. Each stream I/O thread gets its
+// own block past the original 70 so they never race for the same slot.
+#define FS_STREAM_HANDLES 11
+#define FS_STREAM_IO_HANDLE_FIRST 70
+#define FS_MAX_FILE_HANDLES (FS_STREAM_IO_HANDLE_FIRST + SYS_MAX_STREAM_THREADS * FS_STREAM_HANDLES)
+
+static fileHandleData_t fsh[FS_MAX_FILE_HANDLES];
 
 void TRACK_com_files(void);
 int FS_Initialized(void);
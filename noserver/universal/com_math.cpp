@@ -18,6 +18,11 @@
 #include <universal/com_vector.h>
 #include <universal/com_math_anglevectors.h>
 #include <universal/q_shared.h>
+#include <qcommon/threads_jobs.h>
+
+// points per chunk for the batch kernels; below this the job overhead
+// outweighs the few flops per point
+#define MATH_BATCH_GRAIN 4096
 
 void TRACK_com_math(void)
 {
@@ -829,6 +834,33 @@ void MatrixTransformVector43Equals(vec3_t* out, vec3_t const* in)
 	out->y = (((in->y * out->x) + (in[1].y * out->y)) + (in[2].y * out->z)) + in[3].y;
 }
 
+typedef struct MathTransformBatch
+{
+	vec3_t const* in1;
+	vec3_t const* in2;
+	vec3_t* out;
+} MathTransformBatch;
+
+static void MatrixTransformVector43Range(int begin, int end, void* data)
+{
+	MathTransformBatch* batch;
+	int i;
+
+	batch = (MathTransformBatch*)data;
+	for (i = begin; i < end; ++i)
+		MatrixTransformVector43(&batch->in1[i], batch->in2, &batch->out[i]);
+}
+
+void MatrixTransformVector43Array(vec3_t const* in1, int count, vec3_t const* in2, vec3_t* out)
+{
+	MathTransformBatch batch;
+
+	batch.in1 = in1;
+	batch.in2 = in2;
+	batch.out = out;
+	Sys_ParallelFor(0, count, MATH_BATCH_GRAIN, MatrixTransformVector43Range, &batch);
+}
+
 void VectorAngleMultiply(vec2_t* vec, float angle)
 {
 	float x, y;
@@ -1049,6 +1081,50 @@ void AddPointToBounds(vec3_t const* v, vec3_t* mins, vec3_t* maxs)
 		maxs->z = v->z;
 }
 
+typedef struct MathBounds
+{
+	vec3_t mins;
+	vec3_t maxs;
+} MathBounds;
+
+static void BoundsFromPointsRange(int begin, int end, void* data, void* result)
+{
+	vec3_t const* points;
+	MathBounds* bounds;
+	int i;
+
+	points = (vec3_t const*)data;
+	bounds = (MathBounds*)result;
+	for (i = begin; i < end; ++i)
+		AddPointToBounds(&points[i], &bounds->mins, &bounds->maxs);
+}
+
+static void BoundsFromPointsJoin(void* result, void const* partial, void* data)
+{
+	MathBounds* bounds;
+	MathBounds const* other;
+	int i;
+
+	bounds = (MathBounds*)result;
+	other = (MathBounds const*)partial;
+	for (i = 0; i < 3; ++i)
+	{
+		bounds->mins.v[i] = I_fmin(bounds->mins.v[i], other->mins.v[i]);
+		bounds->maxs.v[i] = I_fmax(bounds->maxs.v[i], other->maxs.v[i]);
+	}
+}
+
+// Same as clearing the bounds and calling AddPointToBounds on every point.
+void BoundsFromPoints(int count, vec3_t const* points, vec3_t* mins, vec3_t* maxs)
+{
+	MathBounds bounds;
+
+	_ClearBounds(&bounds.mins, &bounds.maxs);
+	Sys_ParallelReduce(0, count, MATH_BATCH_GRAIN, BoundsFromPointsRange, BoundsFromPointsJoin, (void*)points, &bounds, sizeof(bounds));
+	*mins = bounds.mins;
+	*maxs = bounds.maxs;
+}
+
 void AddPointToBounds2D(vec2_t const* v, vec2_t* mins, vec2_t* maxs)
 {
 	if (mins->v[0] > v->v[0])
@@ -127,6 +127,7 @@ void MatrixTransformVector44(union vec4_t const*, union vec4_t const* const, uni
 void MatrixTransformVector43(union vec3_t const*, union vec3_t const* const, union vec3_t*);
 void MatrixTransposeTransformVector43(union vec3_t const*, union vec3_t const* const, union vec3_t*);
 void MatrixTransformVector43Equals(union vec3_t*, union vec3_t const* const);
+void MatrixTransformVector43Array(union vec3_t const*, int, union vec3_t const* const, union vec3_t*);
 void VectorAngleMultiply(union vec2_t*, float);
 void UnitQuatToAxis(union vec4_t const*, union vec3_t*);
 void UnitQuatToForward(union vec4_t const*, union vec3_t*);
@@ -146,6 +147,7 @@ void ExtendBounds(union vec3_t*, union vec3_t*, union vec3_t const*);
 void ExpandBoundsToWidth(union vec3_t*, union vec3_t*);
 void _ClearBounds(union vec3_t*, union vec3_t*);
 void AddPointToBounds(union vec3_t const*, union vec3_t*, union vec3_t*);
+void BoundsFromPoints(int, union vec3_t const*, union vec3_t*, union vec3_t*);
 void AddPointToBounds2D(union vec2_t const*, union vec2_t*, union vec2_t*);
 bool BoundsOverlap(union vec3_t const*, union vec3_t const*, union vec3_t const*, union vec3_t const*);
 void ExpandBounds(union vec3_t const*, union vec3_t const*, union vec3_t*, union vec3_t*);
@@ -15,9 +15,37 @@
  */
 
 #include "com_memory.h"
+#include <universal/mem_slab.h>
 #include <universal/q_shared.h>
+#include <qcommon/common.h>
+#include <qcommon/mem_track.h>
+#include <qcommon/threads.h>
 #include <win32/win_shared.h>
 
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+// address space reserved for the hunk; pages are committed as each end grows
+#define HUNK_SIZE (160 * 1024 * 1024)
+#define HUNK_COMMIT_SIZE (64 * 1024)
+#define HUNK_DEFAULT_ALIGN 32
+
+// threads other than the main one claim a temp stack the first time they need
+// temp memory; the stacks are reserved past the end of the hunk and committed
+// like it
+#define HUNK_TEMP_STACK_COUNT 16
+#define HUNK_TEMP_STACK_SIZE (8 * 1024 * 1024)
+#define HUNK_TEMP_ALIGN 16
+#define HUNK_TEMP_MAGIC 0x89537892
+#define HUNK_TEMP_FREE_MAGIC 0x89537893
+#define HUNK_TEMP_HEAP_MAGIC 0x89537894
+
 typedef struct hunkUsed_t
 {
 	int permanent;
@@ -28,26 +56,157 @@ hunkUsed_t hunk_low, hunk_high;
 
 static SIZE_T s_hunkTotal;
 static unsigned __int8* s_hunkData;
+static int s_hunkCommittedLow;
+static int s_hunkCommittedHigh;
+
+// Precedes each Hunk_AllocateTempMemory block. prevTop is where the stack top
+// was before the block, so a free restores it exactly. Heap blocks have no
+// stack top and link to the block allocated before them instead.
+typedef struct hunkTempHeader_t
+{
+	unsigned int magic;
+	int size;
+	int prevTop;
+	const char* name;
+	struct hunkTempHeader_t* prev;
+} hunkTempHeader_t;
+
+#define HUNK_TEMP_HEADER_SIZE ((int)(sizeof(hunkTempHeader_t) + HUNK_TEMP_ALIGN - 1) & ~(HUNK_TEMP_ALIGN - 1))
+
+// Two-ended like the hunk: Hunk_AllocateTempMemory grows low up from the
+// bottom, Hunk_AllocateTempMemoryHigh grows high down from the top. Only the
+// owning thread changes a stack; the counters are atomic so
+// Com_TempMeminfo_f can read them from the main thread.
+typedef struct hunkTempStack_t
+{
+	unsigned __int8* base;
+	std::atomic<int> low;
+	std::atomic<int> high;
+	std::atomic<int> peak;
+	std::atomic<int> committedLow;
+	std::atomic<int> committedHigh;
+	std::atomic<bool> inUse;
+	char name[32];
+} hunkTempStack_t;
+
+static void Hunk_FreeTempHeap(hunkTempHeader_t** blocks);
+
+// A thread's temp stack goes back to the pool when the thread exits. A thread
+// that found every stack taken gets its temp blocks from the heap instead,
+// newest first in heapLow and heapHigh; whatever it leaves there is freed
+// then too.
+typedef struct HunkTempThreadRef
+{
+	struct hunkTempStack_t* stack;
+	hunkTempHeader_t* heapLow;
+	hunkTempHeader_t* heapHigh;
+	~HunkTempThreadRef()
+	{
+		Hunk_FreeTempHeap(&heapLow);
+		Hunk_FreeTempHeap(&heapHigh);
+		if (stack)
+			stack->inUse.store(false, std::memory_order_release);
+	}
+} HunkTempThreadRef;
+
+// the main thread's temp memory is hunk_low.temp and hunk_high.temp
+static int s_hunkTempPeak;
+static hunkTempStack_t s_hunkTempStacks[HUNK_TEMP_STACK_COUNT];
+// Stands in for a stack on threads using the heap; it never holds anything.
+static hunkTempStack_t s_hunkTempHeap;
+static thread_local HunkTempThreadRef s_hunkTempThread;
+
+// Null on the main thread. Other threads claim a free stack on first use and
+// keep it until they exit; with none free they get s_hunkTempHeap, and try
+// again on their next call.
+static hunkTempStack_t* Hunk_GetTempStack(void)
+{
+	hunkTempStack_t* stack;
+	int i;
+
+	if (Sys_IsMainThread())
+		return 0;
+	if (s_hunkTempThread.stack)
+		return s_hunkTempThread.stack;
+	if (!s_hunkData)
+		return &s_hunkTempHeap;
+	for (i = 0; i < HUNK_TEMP_STACK_COUNT; ++i)
+	{
+		stack = &s_hunkTempStacks[i];
+		if (stack->inUse.load(std::memory_order_relaxed) || stack->inUse.exchange(true, std::memory_order_acquire))
+			continue;
+		stack->low.store(0, std::memory_order_relaxed);
+		stack->high.store(0, std::memory_order_relaxed);
+		Com_sprintf(stack->name, sizeof(stack->name), "%s (%i)", Sys_GetCurrentThreadName(), i);
+		s_hunkTempThread.stack = stack;
+		return stack;
+	}
+	return &s_hunkTempHeap;
+}
+
+static LPVOID Hunk_AllocateTempHeap(hunkTempHeader_t** blocks, int size, const char* name)
+{
+	hunkTempHeader_t* hdr;
+
+	if (size < 0)
+		Com_Error(ERR_DROP, "Hunk_AllocateTempMemory: failed on %i bytes for '%s'", size, name);
+	hdr = (hunkTempHeader_t*)Z_MallocGarbage(HUNK_TEMP_HEADER_SIZE + size, name, TRACK_TEMP);
+	hdr->magic = HUNK_TEMP_HEAP_MAGIC;
+	hdr->size = size;
+	hdr->prevTop = 0;
+	hdr->name = name;
+	hdr->prev = *blocks;
+	*blocks = hdr;
+	return (unsigned __int8*)hdr + HUNK_TEMP_HEADER_SIZE;
+}
+
+static void Hunk_FreeTempHeap(hunkTempHeader_t** blocks)
+{
+	hunkTempHeader_t* hdr;
+
+	while (*blocks)
+	{
+		hdr = *blocks;
+		*blocks = hdr->prev;
+		hdr->magic = HUNK_TEMP_FREE_MAGIC;
+		Z_Free(hdr, TRACK_TEMP);
+	}
+}
 
 void TRACK_com_memory(void)
 {
 }
 
+// Reserved address space is inaccessible until committed. On POSIX the
+// reservation is a PROT_NONE mapping and committing makes it read/write; the
+// kernel still only backs the pages once they are touched.
 LPVOID Z_VirtualReserve(int size)
 {
+#ifdef _WIN32
 	return VirtualAlloc(0, size, (size > 0x20000 ? 0 : 0x100000) | 0x2000, 4u);
+#else
+	void* ptr;
+
+	ptr = mmap(0, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return ptr == MAP_FAILED ? 0 : ptr;
+#endif
 }
 
 int Z_TryVirtualCommitInternal(LPVOID ptr, int size)
 {
+#ifdef _WIN32
 	return VirtualAlloc(ptr, size, (size > 0x20000 ? 0 : 0x100000) | 0x1000, 4u) != 0;
+#else
+	return mprotect(ptr, size, PROT_READ | PROT_WRITE) == 0;
+#endif
 }
 
 void Z_VirtualCommitInternal(LPVOID ptr, int size)
 {
-	if (!VirtualAlloc(ptr, size, (size > 0x20000 ? 0 : 0x100000) | 0x1000, 4u))
+	if (!Z_TryVirtualCommitInternal(ptr, size))
 	{
 		//Sys_OutOfMemErrorInternal(__FILE__, __LINE__);
+		Com_Error(ERR_FATAL, "Z_VirtualCommitInternal: couldn't commit %i bytes", size);
 	}
 }
 
@@ -71,8 +230,9 @@ void Com_TouchMemory()
 		sum += ((int*)s_hunkData)[i];
 	}
 
+	// the high end runs from its permanent mark up to the end of the hunk
 	i = (s_hunkTotal - hunk_high.permanent) >> 2;
-	j = hunk_high.permanent >> 2;
+	j = s_hunkTotal >> 2;
 	for (; i < j; i += 64)         // only need to touch each page
 	{
 		sum += ((int*)s_hunkData)[i];
@@ -83,8 +243,14 @@ void Com_TouchMemory()
 	Com_Printf(CON_CHANNEL_SYSTEM, "Com_TouchMemory: %i msec. Using sum: %d\n", end - start, sum);
 }
 
+// Both check the calling thread's temp memory.
 int Hunk_CheckTempMemoryClear()
 {
+	hunkTempStack_t* stack;
+
+	stack = Hunk_GetTempStack();
+	if (stack)
+		return stack->low.load(std::memory_order_relaxed) == 0 && !s_hunkTempThread.heapLow;
 	if (hunk_low.temp != hunk_low.permanent)
 		return 0;
 	return 1;
@@ -92,6 +258,11 @@ int Hunk_CheckTempMemoryClear()
 
 int Hunk_CheckTempMemoryHighClear()
 {
+	hunkTempStack_t* stack;
+
+	stack = Hunk_GetTempStack();
+	if (stack)
+		return stack->high.load(std::memory_order_relaxed) == 0 && !s_hunkTempThread.heapHigh;
 	if (hunk_high.temp != hunk_high.permanent)
 		return 0;
 	return 1;
@@ -117,7 +288,7 @@ void Hunk_FindDataForFile(int type, const char* name)
 
 bool Hunk_DataOnHunk(LPVOID data)
 {
-	return false;
+	return (unsigned __int8*)data >= s_hunkData && (unsigned __int8*)data < s_hunkData + s_hunkTotal;
 }
 
 char* Hunk_SetDataForFile(int type, const char* name, LPVOID data, LPVOID(__cdecl* alloc)(int))
@@ -156,42 +327,91 @@ bool DB_EnumXAssetsTimeout()
 
 int Hunk_SetMark()
 {
-	return 0;
+	return hunk_high.permanent;
+}
+
+int Hunk_SetMarkLow()
+{
+	return hunk_low.permanent;
 }
 
 int Hunk_Used()
 {
-	return 0;
+	return hunk_low.permanent + hunk_high.permanent;
 }
 
+// Current and peak temp memory of the main thread and of every thread that
+// has used a temp stack.
 void Com_TempMeminfo_f(void)
 {
+	hunkTempStack_t* stack;
+	int i;
+
+	Com_Printf(CON_CHANNEL_SYSTEM, "temp memory                low KB   high KB   peak KB   committed KB\n");
+	Com_Printf(CON_CHANNEL_SYSTEM, "%-24s %8.1f  %8.1f  %8.1f  (hunk)\n", "Main",
+		(hunk_low.temp - hunk_low.permanent) / 1024.0, (hunk_high.temp - hunk_high.permanent) / 1024.0, s_hunkTempPeak / 1024.0);
+	for (i = 0; i < HUNK_TEMP_STACK_COUNT; ++i)
+	{
+		stack = &s_hunkTempStacks[i];
+		if (!stack->peak.load(std::memory_order_relaxed))
+			continue;
+		Com_Printf(CON_CHANNEL_SYSTEM, "%-24s %8.1f  %8.1f  %8.1f  %8.1f\n", stack->name,
+			stack->low.load(std::memory_order_relaxed) / 1024.0, stack->high.load(std::memory_order_relaxed) / 1024.0,
+			stack->peak.load(std::memory_order_relaxed) / 1024.0,
+			(stack->committedLow.load(std::memory_order_relaxed) + stack->committedHigh.load(std::memory_order_relaxed)) / 1024.0);
+	}
 }
 
 void Z_VirtualCommit(LPVOID ptr, int size)
 {
+	Z_VirtualCommitInternal(ptr, size);
 }
 
 void Z_VirtualFree(LPVOID ptr)
 {
 }
 
+// Returns the pages to the system but keeps the range reserved.
 void Z_VirtualDecommit(LPVOID ptr, int size)
 {
+#ifdef _WIN32
+	VirtualFree(ptr, size, 0x4000u);
+#else
+	madvise(ptr, size, MADV_DONTNEED);
+	mprotect(ptr, size, PROT_NONE);
+#endif
 }
 
+// The slab records who allocated each block, so type is only checked.
 void Z_Free(LPVOID ptr, int type)
 {
+	SlabTrack track;
+
+	if (!ptr)
+		return;
+	Slab_GetTrack(ptr, &track);
+	assert(track.type == type);
+	track_z_free(track.size, track.name, track.type, ptr, Slab_BlockSize(ptr) - track.size);
+	Slab_Free(ptr);
 }
 
 LPVOID Z_Malloc(int size, const char* name, int type)
 {
-	return LPVOID();
+	LPVOID buf;
+
+	buf = Z_MallocGarbage(size, name, type);
+	memset(buf, 0, size);
+	return buf;
 }
 
 LPVOID Z_MallocGarbage(int size, const char* name, int type)
 {
-	return LPVOID();
+	LPVOID buf;
+
+	buf = Slab_Alloc(size);
+	Slab_SetTrack(buf, name, size, type);
+	track_z_alloc(size, name, type, buf, 0, Slab_BlockSize(buf) - size);
+	return buf;
 }
 
 const char* CopyString(const char* in)
@@ -208,48 +428,303 @@ int DB_GetAllXAssetOfType()
 	return 0;
 }
 
+// Clearing only moves an end back; committed pages are kept for the next
+// level to reuse.
 void Hunk_ClearToMark(int mark)
 {
+	assert(mark <= hunk_high.permanent);
+	hunk_high.permanent = mark;
+	hunk_high.temp = mark;
+	track_hunk_ClearToMarkHigh(mark);
+	Hunk_ClearData();
 }
 
 void Hunk_ClearToMarkLow(int mark)
 {
+	assert(mark <= hunk_low.permanent);
+	hunk_low.permanent = mark;
+	hunk_low.temp = mark;
+	track_hunk_ClearToMarkLow(mark);
+	Hunk_ClearData();
 }
 
 void Hunk_Clear()
 {
+	hunk_low.permanent = 0;
+	hunk_low.temp = 0;
+	hunk_high.permanent = 0;
+	hunk_high.temp = 0;
+	track_hunk_ClearToStart();
+	Hunk_ClearData();
 }
 
+// Each end commits in HUNK_COMMIT_SIZE steps, stopping where the other end's
+// committed pages begin so nothing is committed or tracked twice.
+static void Hunk_CommitLow(int used)
+{
+	int committed;
+
+	committed = (used + HUNK_COMMIT_SIZE - 1) & ~(HUNK_COMMIT_SIZE - 1);
+	if (committed > (int)s_hunkTotal - s_hunkCommittedHigh)
+		committed = (int)s_hunkTotal - s_hunkCommittedHigh;
+	if (committed <= s_hunkCommittedLow)
+		return;
+	Z_VirtualCommitInternal(s_hunkData + s_hunkCommittedLow, committed - s_hunkCommittedLow);
+	track_physical_alloc(committed - s_hunkCommittedLow, "hunk", TRACK_HUNK, 0);
+	s_hunkCommittedLow = committed;
+}
+
+static void Hunk_CommitHigh(int used)
+{
+	int committed;
+
+	committed = (used + HUNK_COMMIT_SIZE - 1) & ~(HUNK_COMMIT_SIZE - 1);
+	if (committed > (int)s_hunkTotal - s_hunkCommittedLow)
+		committed = (int)s_hunkTotal - s_hunkCommittedLow;
+	if (committed <= s_hunkCommittedHigh)
+		return;
+	Z_VirtualCommitInternal(s_hunkData + s_hunkTotal - committed, committed - s_hunkCommittedHigh);
+	track_physical_alloc(committed - s_hunkCommittedHigh, "hunk", TRACK_HUNK, 0);
+	s_hunkCommittedHigh = committed;
+}
+
+// Allocates from the top of the hunk, growing down. The offset from the top
+// is aligned, which aligns the address since the hunk ends on a page.
 LPVOID Hunk_AllocAlign(int size, int alignment, char const* name, int type)
 {
-	return LPVOID();
+	unsigned __int8* buf;
+	int permanent;
+
+	assert(s_hunkData);
+	assert(!(alignment & (alignment - 1)));
+	assert(hunk_high.temp == hunk_high.permanent);
+	permanent = (hunk_high.permanent + size + alignment - 1) & ~(alignment - 1);
+	if (size < 0 || hunk_low.temp + permanent > (int)s_hunkTotal)
+	{
+		Com_Error(ERR_DROP, "Hunk_AllocAlign failed on %i bytes (total %i MB, low %i MB, high %i MB)", size,
+			(int)s_hunkTotal / (1024 * 1024), hunk_low.temp / (1024 * 1024), hunk_high.temp / (1024 * 1024));
+	}
+	Hunk_CommitHigh(permanent);
+	track_hunk_alloc(size, hunk_high.permanent, name, type);
+	hunk_high.permanent = permanent;
+	hunk_high.temp = permanent;
+	buf = &s_hunkData[s_hunkTotal - permanent];
+	memset(buf, 0, size);
+	return buf;
+}
+
+// Commits a temp stack the same way the hunk commits its two ends.
+static void Hunk_CommitTempStack(hunkTempStack_t* stack, int low, int high)
+{
+	int committedLow;
+	int committedHigh;
+	int committed;
+
+	committedLow = stack->committedLow.load(std::memory_order_relaxed);
+	committedHigh = stack->committedHigh.load(std::memory_order_relaxed);
+	committed = (low + HUNK_COMMIT_SIZE - 1) & ~(HUNK_COMMIT_SIZE - 1);
+	if (committed > HUNK_TEMP_STACK_SIZE - committedHigh)
+		committed = HUNK_TEMP_STACK_SIZE - committedHigh;
+	if (committed > committedLow)
+	{
+		Z_VirtualCommitInternal(stack->base + committedLow, committed - committedLow);
+		track_physical_alloc(committed - committedLow, "temp stack", TRACK_TEMP, 0);
+		stack->committedLow.store(committed, std::memory_order_relaxed);
+		committedLow = committed;
+	}
+	committed = (high + HUNK_COMMIT_SIZE - 1) & ~(HUNK_COMMIT_SIZE - 1);
+	if (committed > HUNK_TEMP_STACK_SIZE - committedLow)
+		committed = HUNK_TEMP_STACK_SIZE - committedLow;
+	if (committed > committedHigh)
+	{
+		Z_VirtualCommitInternal(stack->base + HUNK_TEMP_STACK_SIZE - committed, committed - committedHigh);
+		track_physical_alloc(committed - committedHigh, "temp stack", TRACK_TEMP, 0);
+		stack->committedHigh.store(committed, std::memory_order_relaxed);
+	}
 }
 
-unsigned int Hunk_AllocateTempMemoryHigh(int size, const char* name)
+static void Hunk_SetTempStack(hunkTempStack_t* stack, int low, int high)
 {
-	return 0;
+	Hunk_CommitTempStack(stack, low, high);
+	stack->low.store(low, std::memory_order_relaxed);
+	stack->high.store(high, std::memory_order_relaxed);
+	if (low + high > stack->peak.load(std::memory_order_relaxed))
+		stack->peak.store(low + high, std::memory_order_relaxed);
+}
+
+static void Hunk_UpdateTempPeak(void)
+{
+	int used;
+
+	used = hunk_low.temp - hunk_low.permanent + hunk_high.temp - hunk_high.permanent;
+	if (used > s_hunkTempPeak)
+		s_hunkTempPeak = used;
+}
+
+// Not freed on its own, only all at once by Hunk_ClearTempMemoryHigh.
+LPVOID Hunk_AllocateTempMemoryHigh(int size, const char* name)
+{
+	hunkTempStack_t* stack;
+	int high;
+	int low;
+
+	assert(s_hunkData);
+	stack = Hunk_GetTempStack();
+	if (stack == &s_hunkTempHeap)
+		return Hunk_AllocateTempHeap(&s_hunkTempThread.heapHigh, size, name);
+	if (stack)
+	{
+		low = stack->low.load(std::memory_order_relaxed);
+		high = (stack->high.load(std::memory_order_relaxed) + size + HUNK_TEMP_ALIGN - 1) & ~(HUNK_TEMP_ALIGN - 1);
+		if (size < 0 || low + high > HUNK_TEMP_STACK_SIZE)
+			Com_Error(ERR_DROP, "Hunk_AllocateTempMemoryHigh: %s failed on %i bytes (low %i, high %i)", stack->name, size, low, high - size);
+		Hunk_SetTempStack(stack, low, high);
+		return stack->base + HUNK_TEMP_STACK_SIZE - high;
+	}
+
+	high = (hunk_high.temp + size + HUNK_TEMP_ALIGN - 1) & ~(HUNK_TEMP_ALIGN - 1);
+	if (size < 0 || hunk_low.temp + high > (int)s_hunkTotal)
+	{
+		Com_Error(ERR_DROP, "Hunk_AllocateTempMemoryHigh failed on %i bytes (total %i MB, low %i MB, high %i MB)", size,
+			(int)s_hunkTotal / (1024 * 1024), hunk_low.temp / (1024 * 1024), hunk_high.temp / (1024 * 1024));
+	}
+	Hunk_CommitHigh(high);
+	hunk_high.temp = high;
+	Hunk_UpdateTempPeak();
+	return &s_hunkData[s_hunkTotal - high];
 }
 
 void Hunk_ClearTempMemoryHigh()
 {
+	hunkTempStack_t* stack;
+
+	stack = Hunk_GetTempStack();
+	if (stack)
+	{
+		Hunk_FreeTempHeap(&s_hunkTempThread.heapHigh);
+		stack->high.store(0, std::memory_order_relaxed);
+		return;
+	}
+	hunk_high.temp = hunk_high.permanent;
 }
 
+// Allocates from the bottom of the hunk, growing up.
 LPVOID Hunk_AllocLowAlign(int size, int alignment, char const* name, int type)
 {
-	return LPVOID();
+	unsigned __int8* buf;
+	int start;
+
+	assert(s_hunkData);
+	assert(!(alignment & (alignment - 1)));
+	assert(hunk_low.temp == hunk_low.permanent);
+	start = (hunk_low.permanent + alignment - 1) & ~(alignment - 1);
+	if (size < 0 || start + size + hunk_high.temp > (int)s_hunkTotal)
+	{
+		Com_Error(ERR_DROP, "Hunk_AllocLowAlign failed on %i bytes (total %i MB, low %i MB, high %i MB)", size,
+			(int)s_hunkTotal / (1024 * 1024), hunk_low.temp / (1024 * 1024), hunk_high.temp / (1024 * 1024));
+	}
+	Hunk_CommitLow(start + size);
+	track_hunk_allocLow(size, hunk_low.permanent, name, type);
+	hunk_low.permanent = start + size;
+	hunk_low.temp = hunk_low.permanent;
+	buf = &s_hunkData[start];
+	memset(buf, 0, size);
+	return buf;
 }
 
+// Temp blocks are a stack per thread and must be freed in reverse order of
+// allocation. Before the hunk exists they come from the heap.
 LPVOID Hunk_AllocateTempMemory(int size, const char* name)
 {
-	return LPVOID();
+	hunkTempStack_t* stack;
+	hunkTempHeader_t* hdr;
+	int prevTop;
+	int start;
+	int high;
+
+	if (!s_hunkData)
+		return Z_Malloc(size, name, TRACK_TEMP);
+	stack = Hunk_GetTempStack();
+	if (stack == &s_hunkTempHeap)
+		return Hunk_AllocateTempHeap(&s_hunkTempThread.heapLow, size, name);
+	if (stack)
+	{
+		start = (stack->low.load(std::memory_order_relaxed) + HUNK_TEMP_ALIGN - 1) & ~(HUNK_TEMP_ALIGN - 1);
+		high = stack->high.load(std::memory_order_relaxed);
+		if (size < 0 || start + HUNK_TEMP_HEADER_SIZE + size + high > HUNK_TEMP_STACK_SIZE)
+			Com_Error(ERR_DROP, "Hunk_AllocateTempMemory: %s failed on %i bytes for '%s' (low %i, high %i)", stack->name, size, name, start, high);
+		prevTop = stack->low.load(std::memory_order_relaxed);
+		Hunk_SetTempStack(stack, start + HUNK_TEMP_HEADER_SIZE + size, high);
+		hdr = (hunkTempHeader_t*)(stack->base + start);
+	}
+	else
+	{
+		start = (hunk_low.temp + HUNK_TEMP_ALIGN - 1) & ~(HUNK_TEMP_ALIGN - 1);
+		if (size < 0 || start + HUNK_TEMP_HEADER_SIZE + size + hunk_high.temp > (int)s_hunkTotal)
+		{
+			Com_Error(ERR_DROP, "Hunk_AllocateTempMemory failed on %i bytes for '%s' (total %i MB, low %i MB, high %i MB)", size, name,
+				(int)s_hunkTotal / (1024 * 1024), hunk_low.temp / (1024 * 1024), hunk_high.temp / (1024 * 1024));
+		}
+		Hunk_CommitLow(start + HUNK_TEMP_HEADER_SIZE + size);
+		prevTop = hunk_low.temp;
+		hunk_low.temp = start + HUNK_TEMP_HEADER_SIZE + size;
+		hdr = (hunkTempHeader_t*)&s_hunkData[start];
+		Hunk_UpdateTempPeak();
+	}
+	hdr->magic = HUNK_TEMP_MAGIC;
+	hdr->size = size;
+	hdr->prevTop = prevTop;
+	hdr->name = name;
+	hdr->prev = 0;
+	return (unsigned __int8*)hdr + HUNK_TEMP_HEADER_SIZE;
 }
 
 void Hunk_FreeTempMemory(LPVOID buf)
 {
+	hunkTempStack_t* stack;
+	hunkTempHeader_t* hdr;
+	unsigned __int8* top;
+
+	if (!s_hunkData)
+	{
+		Z_Free(buf, TRACK_TEMP);
+		return;
+	}
+	hdr = (hunkTempHeader_t*)((unsigned __int8*)buf - HUNK_TEMP_HEADER_SIZE);
+	if (hdr->magic == HUNK_TEMP_HEAP_MAGIC)
+	{
+		if (hdr != s_hunkTempThread.heapLow)
+			Com_Error(ERR_FATAL, "Hunk_FreeTempMemory: '%s' is not the last temp block allocated on the heap by %s", hdr->name, Sys_GetCurrentThreadName());
+		s_hunkTempThread.heapLow = hdr->prev;
+		hdr->magic = HUNK_TEMP_FREE_MAGIC;
+		Z_Free(hdr, TRACK_TEMP);
+		return;
+	}
+	if (hdr->magic != HUNK_TEMP_MAGIC)
+		Com_Error(ERR_FATAL, "Hunk_FreeTempMemory: bad magic%s", hdr->magic == HUNK_TEMP_FREE_MAGIC ? ", freed twice" : "");
+	stack = Hunk_GetTempStack();
+	top = stack ? stack->base + stack->low.load(std::memory_order_relaxed) : &s_hunkData[hunk_low.temp];
+	if ((unsigned __int8*)buf + hdr->size != top)
+		Com_Error(ERR_FATAL, "Hunk_FreeTempMemory: '%s' is not the last temp block allocated on %s", hdr->name, stack ? stack->name : "Main");
+	hdr->magic = HUNK_TEMP_FREE_MAGIC;
+	if (stack)
+		stack->low.store(hdr->prevTop, std::memory_order_relaxed);
+	else
+		hunk_low.temp = hdr->prevTop;
 }
 
 void Hunk_ClearTempMemory()
 {
+	hunkTempStack_t* stack;
+
+	stack = Hunk_GetTempStack();
+	if (stack)
+	{
+		Hunk_FreeTempHeap(&s_hunkTempThread.heapLow);
+		stack->low.store(0, std::memory_order_relaxed);
+		return;
+	}
+	hunk_low.temp = hunk_low.permanent;
 }
 
 LPVOID Z_TryVirtualAlloc(int size, const char* name, int type)
@@ -266,18 +741,110 @@ void ReplaceString(const char** str, const char* in)
 {
 }
 
+// Only reserves the address range; nothing is committed until one of the
+// ends grows into it, and level loads never fall back to the heap.
 void Com_InitHunkMemory()
 {
+	int i;
+
+	if (s_hunkData)
+		Com_Error(ERR_FATAL, "Com_InitHunkMemory: hunk already initialized");
+	s_hunkTotal = HUNK_SIZE;
+	s_hunkData = (unsigned __int8*)Z_VirtualReserve(s_hunkTotal + HUNK_TEMP_STACK_COUNT * HUNK_TEMP_STACK_SIZE);
+	if (!s_hunkData)
+		Com_Error(ERR_FATAL, "Hunk data failed to reserve %i megs", (int)s_hunkTotal / (1024 * 1024));
+	s_hunkCommittedLow = 0;
+	s_hunkCommittedHigh = 0;
+	for (i = 0; i < HUNK_TEMP_STACK_COUNT; ++i)
+		s_hunkTempStacks[i].base = s_hunkData + s_hunkTotal + i * HUNK_TEMP_STACK_SIZE;
+	Hunk_Clear();
 }
 
 LPVOID Hunk_Alloc(int size, char const* name, int type)
 {
-	return LPVOID();
+	return Hunk_AllocAlign(size, HUNK_DEFAULT_ALIGN, name, type);
 }
 
 LPVOID Hunk_AllocLow(int size, char const* name, int type)
 {
-	return LPVOID();
+	return Hunk_AllocLowAlign(size, HUNK_DEFAULT_ALIGN, name, type);
+}
+
+#define HUNK_BENCH_LEVELS 20
+#define HUNK_BENCH_ALLOCS 20000
+
+// Mock level load: many small to mid sized blocks, zeroed like the hunk
+// zeroes them, then all released at once.
+static double Hunk_BenchLevels(bool useHunk, double* resetSeconds)
+{
+	static void* blocks[HUNK_BENCH_ALLOCS];
+	std::chrono::steady_clock::time_point start;
+	std::chrono::steady_clock::time_point reset;
+	double allocSeconds;
+	unsigned int seed;
+	int markLow;
+	int mark;
+	int size;
+	int level;
+	int i;
+
+	allocSeconds = 0;
+	*resetSeconds = 0;
+	markLow = Hunk_SetMarkLow();
+	mark = Hunk_SetMark();
+	for (level = 0; level < HUNK_BENCH_LEVELS; ++level)
+	{
+		seed = 12345;
+		start = std::chrono::steady_clock::now();
+		for (i = 0; i < HUNK_BENCH_ALLOCS; ++i)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			size = 16 + (seed >> 16) % 2048;
+			if (useHunk)
+			{
+				blocks[i] = (i & 1) ? Hunk_AllocLow(size, "Hunk_Benchmark_f", TRACK_DEBUG) : Hunk_Alloc(size, "Hunk_Benchmark_f", TRACK_DEBUG);
+			}
+			else
+			{
+				blocks[i] = malloc(size);
+				memset(blocks[i], 0, size);
+			}
+		}
+		reset = std::chrono::steady_clock::now();
+		if (useHunk)
+		{
+			Hunk_ClearToMarkLow(markLow);
+			Hunk_ClearToMark(mark);
+		}
+		else
+		{
+			for (i = 0; i < HUNK_BENCH_ALLOCS; ++i)
+				free(blocks[i]);
+		}
+		allocSeconds += std::chrono::duration<double>(reset - start).count();
+		*resetSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - reset).count();
+	}
+	return allocSeconds;
+}
+
+// Allocation rate and level reset time of the hunk against the heap. Runs on
+// top of whatever is already on the hunk and clears back to it.
+void Hunk_Benchmark_f(void)
+{
+	double hunkSeconds;
+	double hunkResetSeconds;
+	double heapSeconds;
+	double heapResetSeconds;
+	double allocs;
+
+	hunkSeconds = Hunk_BenchLevels(true, &hunkResetSeconds);
+	heapSeconds = Hunk_BenchLevels(false, &heapResetSeconds);
+	allocs = (double)HUNK_BENCH_LEVELS * HUNK_BENCH_ALLOCS;
+	Com_Printf(CON_CHANNEL_SYSTEM, "alloc: hunk %6.1f M allocs/s, heap %6.1f M allocs/s\n", allocs / hunkSeconds / 1e6, allocs / heapSeconds / 1e6);
+	Com_Printf(CON_CHANNEL_SYSTEM, "level reset: hunk %.4f ms, heap %.4f ms\n",
+		hunkResetSeconds * 1000.0 / HUNK_BENCH_LEVELS, heapResetSeconds * 1000.0 / HUNK_BENCH_LEVELS);
+	Com_Printf(CON_CHANNEL_SYSTEM, "hunk: %i KB used, %i KB committed low, %i KB committed high\n",
+		Hunk_Used() / 1024, s_hunkCommittedLow / 1024, s_hunkCommittedHigh / 1024);
 }
 
 int DB_GetAllXAssetOfType_LoadObj(XAssetType type, XAssetHeader* assets, int maxCount)
@@ -51,6 +51,7 @@ void Hunk_AddAsset(union XAssetHeader type, LPVOID data);
 void DB_EnumXAssets();
 bool DB_EnumXAssetsTimeout();
 int Hunk_SetMark();
+int Hunk_SetMarkLow();
 int Hunk_Used();
 void Com_TempMeminfo_f(void);
 void Z_VirtualCommit(LPVOID ptr, int size);
@@ -67,7 +68,7 @@ void Hunk_ClearToMark(int mark);
 void Hunk_ClearToMarkLow(int mark);
 void Hunk_Clear();
 LPVOID Hunk_AllocAlign(int size, int alignment, char const* name, int type);
-unsigned int Hunk_AllocateTempMemoryHigh(int size, const char* name);
+LPVOID Hunk_AllocateTempMemoryHigh(int size, const char* name);
 void Hunk_ClearTempMemoryHigh();
 LPVOID Hunk_AllocLowAlign(int size, int alignment, char const* name, int type);
 LPVOID Hunk_AllocateTempMemory(int size, const char* name);
@@ -79,5 +80,6 @@ void ReplaceString(const char** str, const char* in);
 void Com_InitHunkMemory();
 LPVOID Hunk_Alloc(int size, char const* name, int type);
 LPVOID Hunk_AllocLow(int size, char const* name, int type);
+void Hunk_Benchmark_f(void);
 
 #endif
\ No newline at end of file
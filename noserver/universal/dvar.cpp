@@ -43,6 +43,7 @@ static bool s_areDvarsSorted, s_canSetConfigDvars, s_isLoadingAutoExecGlobalFlag
 static dvarCallBack_t s_dvarCallbackPool[64];
 
 extern FastCriticalSection g_dvarCritSect;
+static FastCriticalSectionStats s_dvarCritSectStats;
 
 static dvar_t* s_dvarHashTable[1080], *s_sortedDvars[4320];
 static dvar_t s_dvarPool[4320];
@@ -918,11 +919,7 @@ dvar_t* Dvar_FindMalleableVar(int dvarHash)
 {
 	dvar_t* var;
 
-	_InterlockedExchangeAdd(&g_dvarCritSect.readCount, 1u);
-	while (g_dvarCritSect.writeCount)
-	{
-		//NET_Sleep(0);
-	}
+	Sys_LockRead(&g_dvarCritSect);
 
 	for (var = s_dvarHashTable[dvarHash & 0x3FF]; var; var = var->hashNext)
 	{
@@ -2502,6 +2499,17 @@ void Dvar_SetCommand(char const* dvarName, char const* string)
 	}
 }
 
+void Dvar_LockStats_f(void)
+{
+	if (!g_dvarCritSect.stats)
+	{
+		g_dvarCritSect.stats = &s_dvarCritSectStats;
+		Com_Printf(CON_CHANNEL_SYSTEM, "dvar lock contention tracking enabled\n");
+		return;
+	}
+	Sys_PrintLockStats("g_dvarCritSect", &s_dvarCritSectStats);
+}
+
 void Dvar_Reset(dvar_t* dvar, DvarSetSource source)
 {
 	Dvar_SetVariant(dvar, dvar->reset, source);
@@ -2512,11 +2520,7 @@ void Dvar_SetCheatState(void)
 	int dvarIter;
 	dvar_t* dvar;
 
-	_InterlockedExchangeAdd(&g_dvarCritSect.readCount, 1u);
-	while (g_dvarCritSect.writeCount)
-	{
-		NET_Sleep(0);
-	}
+	Sys_LockRead(&g_dvarCritSect);
 
 	for (dvarIter = 0; dvarIter < g_dvarCount; ++dvarIter)
 	{
@@ -2549,15 +2553,14 @@ void Dvar_LoadScriptInfo(MemoryFile*)
 	//TODO
 }
 
+// Serial on purpose: the per-dvar work is trivial, and a parallel loop would
+// help-run other jobs while this thread holds the dvar read lock, deadlocking
+// against any of them that sets a dvar.
 void Dvar_ResetDvars(unsigned int filter, DvarSetSource setSource)
 {
 	int dvarIter;
 
-	_InterlockedExchangeAdd(&g_dvarCritSect.readCount, 1u);
-	while (g_dvarCritSect.writeCount)
-	{
-		NET_Sleep(0);
-	}
+	Sys_LockRead(&g_dvarCritSect);
 	for (dvarIter = 0; dvarIter < g_dvarCount; ++dvarIter)
 	{
 		if (filter & s_dvarPool[dvarIter].flags)
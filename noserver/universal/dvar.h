@@ -130,6 +130,7 @@ bool Dvar_HasLatchedValue(struct dvar_t const*);
 struct dvarCallBack_t* findCallBackForDvar(struct dvar_t const*);
 struct dvar_t* Dvar_FindMalleableVar(int);
 struct dvar_t* Dvar_FindMalleableVar(char const*);
+void Dvar_LockStats_f(void);
 struct dvar_t* Dvar_FindVar(char const*);
 struct dvar_t* Dvar_FindVar(int);
 void Dvar_ClearModified(struct dvar_t*);
@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mem_scratch.h"
+
+#include <universal/com_memory.h>
+#include <universal/q_shared.h>
+#include <qcommon/common.h>
+#include <qcommon/mem_track.h>
+#include <qcommon/threads.h>
+#include <qcommon/threads_registry.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+// one slot per registry block the registry can ever hand out
+#define SCRATCH_MAX_ARENAS (SYS_THREAD_CHUNK_SIZE * SYS_THREAD_CHUNK_COUNT)
+
+static std::atomic<ScratchArena*> s_scratchArenas[SCRATCH_MAX_ARENAS];
+static thread_local ScratchArena* s_scratchArena;
+static thread_local SysThreadBlock* s_scratchBlock;
+
+static ScratchArena* Scratch_CreateArena(int index)
+{
+	ScratchArena* arena;
+
+	arena = new ScratchArena;
+	arena->base = (unsigned char*)Z_VirtualReserve(SCRATCH_ARENA_SIZE);
+	if (!arena->base)
+		Com_Error(ERR_FATAL, "Scratch_CreateArena: couldn't reserve %i bytes", SCRATCH_ARENA_SIZE);
+	arena->committed = 0;
+	arena->used.store(0, std::memory_order_relaxed);
+	arena->high.store(0, std::memory_order_relaxed);
+	arena->index = index;
+	Com_sprintf(arena->name, sizeof(arena->name), "thread scratch %d", index);
+	s_scratchArenas[index].store(arena, std::memory_order_release);
+	return arena;
+}
+
+// Binds the calling thread to the arena of its registry block. Anything the
+// block's previous thread left in it is dead, so it starts out empty.
+static ScratchArena* Scratch_BindArena(void)
+{
+	SysThreadBlock* block;
+	ScratchArena* arena;
+
+	block = g_threadBlock;
+	if (!block)
+		Com_Error(ERR_FATAL, "Scratch_Alloc: called from a thread that never registered");
+	arena = s_scratchArenas[block->index].load(std::memory_order_acquire);
+	if (!arena)
+		arena = Scratch_CreateArena(block->index);
+	arena->used.store(0, std::memory_order_relaxed);
+	s_scratchArena = arena;
+	s_scratchBlock = block;
+	return arena;
+}
+
+static ScratchArena* Scratch_GetArena(void)
+{
+	if (s_scratchArena && s_scratchBlock == g_threadBlock)
+		return s_scratchArena;
+	return Scratch_BindArena();
+}
+
+// Commits whole SCRATCH_COMMIT_SIZE steps up to end and reports them to
+// mem_track, so TRACK_THREAD_LOCAL shows each arena's committed high water.
+static void Scratch_Commit(ScratchArena* arena, int end)
+{
+	int committed;
+
+	committed = (end + SCRATCH_COMMIT_SIZE - 1) & ~(SCRATCH_COMMIT_SIZE - 1);
+	if (!Z_TryVirtualCommitInternal(arena->base + arena->committed, committed - arena->committed))
+		Com_Error(ERR_FATAL, "Scratch_Alloc: %s couldn't commit %i bytes", arena->name, committed - arena->committed);
+	track_physical_alloc(committed - arena->committed, arena->name, TRACK_THREAD_LOCAL, 0);
+	arena->committed = committed;
+}
+
+// Lock-free: allocates from the calling thread's arena. Freed only by
+// clearing back to an earlier mark or by Scratch_ClearFrame.
+void* Scratch_Alloc(int size, int alignment)
+{
+	ScratchArena* arena;
+	int start;
+	int end;
+
+	arena = Scratch_GetArena();
+	if (!alignment)
+		alignment = SCRATCH_DEFAULT_ALIGN;
+	assert(!(alignment & (alignment - 1)));
+	start = (arena->used.load(std::memory_order_relaxed) + alignment - 1) & ~(alignment - 1);
+	if (size < 0 || size > SCRATCH_ARENA_SIZE - start)
+		Com_Error(ERR_DROP, "Scratch_Alloc: %s can't fit %i bytes, %i in use", arena->name, size, start);
+	end = start + size;
+	if (end > arena->committed)
+		Scratch_Commit(arena, end);
+	arena->used.store(end, std::memory_order_relaxed);
+	if (end > arena->high.load(std::memory_order_relaxed))
+		arena->high.store(end, std::memory_order_relaxed);
+	return arena->base + start;
+}
+
+int Scratch_SetMark(void)
+{
+	return Scratch_GetArena()->used.load(std::memory_order_relaxed);
+}
+
+// Marks must be cleared innermost first; clearing to a mark above the top
+// means an outer scope was already cleared under this one.
+void Scratch_ClearToMark(int mark)
+{
+	ScratchArena* arena;
+
+	arena = Scratch_GetArena();
+	if (mark > arena->used.load(std::memory_order_relaxed))
+		Com_Error(ERR_DROP, "Scratch_ClearToMark: %s mark %i is past the top %i", arena->name, mark, arena->used.load(std::memory_order_relaxed));
+	arena->used.store(mark, std::memory_order_relaxed);
+}
+
+void Scratch_ClearFrame(void)
+{
+	Scratch_GetArena()->used.store(0, std::memory_order_relaxed);
+}
+
+int Scratch_Used(void)
+{
+	return Scratch_GetArena()->used.load(std::memory_order_relaxed);
+}
+
+void Scratch_Meminfo_f(void)
+{
+	ScratchArena* arena;
+	int count;
+	int committed;
+	int i;
+
+	Com_Printf(CON_CHANNEL_SYSTEM, "arena                    used KB   high KB   committed KB\n");
+	count = Sys_GetThreadBlockCount();
+	committed = 0;
+	for (i = 0; i < count; ++i)
+	{
+		arena = s_scratchArenas[i].load(std::memory_order_acquire);
+		if (!arena)
+			continue;
+		Com_Printf(CON_CHANNEL_SYSTEM, "%-24s %8.1f  %8.1f  %8.1f\n", arena->name,
+			arena->used.load(std::memory_order_relaxed) / 1024.0, arena->high.load(std::memory_order_relaxed) / 1024.0,
+			arena->committed / 1024.0);
+		committed += arena->committed;
+	}
+	Com_Printf(CON_CHANNEL_SYSTEM, "%.1f KB committed to thread scratch\n", committed / 1024.0);
+}
+
+#define SCRATCH_BENCH_THREADS 4
+#define SCRATCH_BENCH_FRAMES 2000
+#define SCRATCH_BENCH_ALLOCS 64
+
+static std::atomic<unsigned int> s_scratchBenchSink;
+
+// A frame's worth of short-lived buffers, from the arena or from the heap.
+static void Scratch_BenchThread(bool useScratch)
+{
+	void* buffers[SCRATCH_BENCH_ALLOCS];
+	unsigned int seed;
+	unsigned int sink;
+	int frame;
+	int mark;
+	int size;
+	int i;
+
+	if (useScratch)
+		Sys_RegisterThread(THREAD_CONTEXT_COUNT);
+	seed = 12345;
+	sink = 0;
+	mark = 0;
+	for (frame = 0; frame < SCRATCH_BENCH_FRAMES; ++frame)
+	{
+		if (useScratch)
+			mark = Scratch_SetMark();
+		for (i = 0; i < SCRATCH_BENCH_ALLOCS; ++i)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			size = 16 + (seed >> 16) % 1024;
+			buffers[i] = useScratch ? Scratch_Alloc(size, 0) : malloc(size);
+			((unsigned char*)buffers[i])[0] = (unsigned char)i;
+		}
+		for (i = 0; i < SCRATCH_BENCH_ALLOCS; ++i)
+		{
+			sink += ((unsigned char*)buffers[i])[0];
+			if (!useScratch)
+				free(buffers[i]);
+		}
+		if (useScratch)
+			Scratch_ClearToMark(mark);
+	}
+	s_scratchBenchSink.fetch_add(sink, std::memory_order_relaxed);
+	if (useScratch)
+		Sys_UnregisterThread();
+}
+
+static double Scratch_BenchRun(int threadCount, bool useScratch)
+{
+	std::thread threads[SCRATCH_BENCH_THREADS];
+	std::chrono::steady_clock::time_point start;
+	int i;
+
+	start = std::chrono::steady_clock::now();
+	for (i = 0; i < threadCount; ++i)
+		threads[i] = std::thread(Scratch_BenchThread, useScratch);
+	for (i = 0; i < threadCount; ++i)
+		threads[i].join();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Transient allocations per second through the scratch arenas against the
+// heap, on one thread and on several at once.
+void Scratch_Benchmark_f(void)
+{
+	double allocs;
+	double scratchSeconds;
+	double heapSeconds;
+	int threadCount;
+
+	for (threadCount = 1; threadCount <= SCRATCH_BENCH_THREADS; threadCount *= 2)
+	{
+		allocs = (double)threadCount * SCRATCH_BENCH_FRAMES * SCRATCH_BENCH_ALLOCS;
+		scratchSeconds = Scratch_BenchRun(threadCount, true);
+		heapSeconds = Scratch_BenchRun(threadCount, false);
+		Com_Printf(CON_CHANNEL_SYSTEM, "%d thread%s: scratch %6.1f M allocs/s, heap %6.1f M allocs/s (%.1fx)\n",
+			threadCount, threadCount == 1 ? " " : "s", allocs / scratchSeconds / 1e6, allocs / heapSeconds / 1e6, heapSeconds / scratchSeconds);
+	}
+	Scratch_Meminfo_f();
+}
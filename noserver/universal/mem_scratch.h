@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEM_SCRATCH_H
+#define MEM_SCRATCH_H
+
+#include <atomic>
+
+// address space reserved per thread, committed as it is first used
+#define SCRATCH_ARENA_SIZE (4 * 1024 * 1024)
+#define SCRATCH_COMMIT_SIZE (16 * 1024)
+#define SCRATCH_DEFAULT_ALIGN 16
+
+// Bump arena owned by one registered thread. It lives in the slot of the
+// thread's registry block, so a block reused by a new thread reuses its
+// arena, already committed. Only the owner touches base and committed; used
+// and high are atomics so Scratch_Meminfo_f can read them from elsewhere.
+typedef struct ScratchArena
+{
+	unsigned char* base;
+	int committed;
+	std::atomic<int> used;
+	std::atomic<int> high;
+	int index;
+	char name[32];
+} ScratchArena;
+
+void* Scratch_Alloc(int size, int alignment);
+int Scratch_SetMark(void);
+void Scratch_ClearToMark(int mark);
+void Scratch_ClearFrame(void);
+int Scratch_Used(void);
+void Scratch_Meminfo_f(void);
+void Scratch_Benchmark_f(void);
+
+// Frees everything allocated through Scratch_Alloc in its scope.
+struct ScratchScope
+{
+	int mark;
+
+	ScratchScope() : mark(Scratch_SetMark())
+	{
+	}
+	~ScratchScope()
+	{
+		Scratch_ClearToMark(mark);
+	}
+};
+
+#endif // MEM_SCRATCH_H
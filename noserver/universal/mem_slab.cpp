@@ -0,0 +1,510 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mem_slab.h"
+
+#include <universal/com_memory.h>
+#include <universal/q_shared.h>
+#include <qcommon/common.h>
+#include <qcommon/mem_track.h>
+#include <qcommon/threads.h>
+#include <qcommon/threads_registry.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+
+// Free blocks are chained through their first word.
+typedef struct SlabFreeList
+{
+	void* head;
+	int count;
+} SlabFreeList;
+
+// Free blocks of one class shared by every thread. Caches take and return
+// them a magazine at a time, so the lock is held once per magazine rather
+// than once per block.
+typedef struct SlabDepot
+{
+	std::mutex lock;
+	void* head;
+	int count;
+	int spanCount;
+} SlabDepot;
+
+// Per registry block, like the scratch arenas: a thread that takes over a
+// block inherits whatever its predecessor had cached.
+typedef struct SlabCache
+{
+	SlabFreeList lists[SLAB_CLASS_COUNT];
+} SlabCache;
+
+// In front of every large block. They aren't packed by size class, so the
+// header costs nothing a lookup table wouldn't.
+typedef struct SlabLarge
+{
+	unsigned int magic;
+	int size;
+	SlabTrack track;
+} SlabLarge;
+
+#define SLAB_LARGE_HEADER_SIZE ((int)(sizeof(SlabLarge) + SLAB_LARGE_ALIGN - 1) & ~(SLAB_LARGE_ALIGN - 1))
+
+static std::once_flag s_slabInitOnce;
+static unsigned char* s_slabRegion;
+static std::atomic<int> s_slabSpanCount;
+static unsigned char s_slabSpanClass[SLAB_SPAN_COUNT];
+static SlabTrack* s_slabSpanTrack[SLAB_SPAN_COUNT];
+static unsigned char s_slabClassLookup[SLAB_MAX_SIZE / SLAB_MIN_SIZE + 1];
+static int s_slabClassSize[SLAB_CLASS_COUNT];
+static int s_slabMagazine[SLAB_CLASS_COUNT];
+static SlabDepot s_slabDepots[SLAB_CLASS_COUNT];
+static std::atomic<SlabCache*> s_slabCaches[SYS_THREAD_CHUNK_SIZE * SYS_THREAD_CHUNK_COUNT];
+static thread_local SlabCache* s_slabCache;
+static thread_local SysThreadBlock* s_slabCacheBlock;
+static std::atomic<int> s_slabLargeCount;
+
+static void Slab_Init(void)
+{
+	int sizeClass;
+	int size;
+	int i;
+
+	for (sizeClass = 0; sizeClass < SLAB_CLASS_COUNT; ++sizeClass)
+	{
+		if (sizeClass < 8)
+			size = (sizeClass + 1) * SLAB_MIN_SIZE;
+		else
+			size = (5 + (sizeClass - 8) % 4) << (5 + (sizeClass - 8) / 4);
+		s_slabClassSize[sizeClass] = size;
+		s_slabMagazine[sizeClass] = SLAB_MAGAZINE_BYTES / size;
+		if (s_slabMagazine[sizeClass] > SLAB_MAGAZINE_MAX)
+			s_slabMagazine[sizeClass] = SLAB_MAGAZINE_MAX;
+		if (s_slabMagazine[sizeClass] < 2)
+			s_slabMagazine[sizeClass] = 2;
+	}
+	assert(s_slabClassSize[SLAB_CLASS_COUNT - 1] == SLAB_MAX_SIZE);
+
+	sizeClass = 0;
+	for (i = 0; i <= SLAB_MAX_SIZE / SLAB_MIN_SIZE; ++i)
+	{
+		while (s_slabClassSize[sizeClass] < i * SLAB_MIN_SIZE)
+			++sizeClass;
+		s_slabClassLookup[i] = sizeClass;
+	}
+
+	s_slabRegion = (unsigned char*)Z_VirtualReserve(SLAB_REGION_SIZE);
+	if (!s_slabRegion)
+		Com_Error(ERR_FATAL, "Slab_Init: couldn't reserve %i megs", SLAB_REGION_SIZE / (1024 * 1024));
+}
+
+static bool Slab_InRegion(void* ptr)
+{
+	return (unsigned char*)ptr >= s_slabRegion && (unsigned char*)ptr < s_slabRegion + SLAB_REGION_SIZE;
+}
+
+static int Slab_SpanIndex(void* ptr)
+{
+	return (int)(((unsigned char*)ptr - s_slabRegion) / SLAB_SPAN_SIZE);
+}
+
+static SlabCache* Slab_GetCache(void)
+{
+	SysThreadBlock* block;
+	SlabCache* cache;
+
+	block = g_threadBlock;
+	if (s_slabCache && s_slabCacheBlock == block)
+		return s_slabCache;
+	if (!block)
+		return 0;
+	cache = s_slabCaches[block->index].load(std::memory_order_acquire);
+	if (!cache)
+	{
+		cache = new SlabCache();
+		s_slabCaches[block->index].store(cache, std::memory_order_release);
+	}
+	s_slabCache = cache;
+	s_slabCacheBlock = block;
+	return cache;
+}
+
+// Commits a new span and chains all of its blocks onto the depot. Called
+// with the depot locked.
+static void Slab_NewSpan(SlabDepot* depot, int sizeClass)
+{
+	unsigned char* span;
+	int blockSize;
+	int count;
+	int index;
+	int i;
+
+	index = s_slabSpanCount.fetch_add(1, std::memory_order_relaxed);
+	if (index >= SLAB_SPAN_COUNT)
+		Com_Error(ERR_FATAL, "Slab_Alloc: out of spans, %i megs of small blocks in use", SLAB_REGION_SIZE / (1024 * 1024));
+	span = s_slabRegion + index * SLAB_SPAN_SIZE;
+	Z_VirtualCommitInternal(span, SLAB_SPAN_SIZE);
+
+	blockSize = s_slabClassSize[sizeClass];
+	count = SLAB_SPAN_SIZE / blockSize;
+	s_slabSpanClass[index] = sizeClass;
+	s_slabSpanTrack[index] = new SlabTrack[count]();
+	for (i = 0; i < count - 1; ++i)
+		*(void**)(span + i * blockSize) = span + (i + 1) * blockSize;
+	*(void**)(span + i * blockSize) = depot->head;
+	depot->head = span;
+	depot->count += count;
+	++depot->spanCount;
+}
+
+// Moves up to a magazine from the depot into an empty cache list.
+static void Slab_Refill(SlabFreeList* list, int sizeClass)
+{
+	SlabDepot* depot;
+	void* tail;
+	int count;
+	int i;
+
+	assert(!list->count);
+	depot = &s_slabDepots[sizeClass];
+	std::lock_guard<std::mutex> lock(depot->lock);
+	if (!depot->count)
+		Slab_NewSpan(depot, sizeClass);
+	count = depot->count < s_slabMagazine[sizeClass] ? depot->count : s_slabMagazine[sizeClass];
+	tail = depot->head;
+	for (i = 1; i < count; ++i)
+		tail = *(void**)tail;
+	list->head = depot->head;
+	list->count = count;
+	depot->head = *(void**)tail;
+	depot->count -= count;
+	*(void**)tail = 0;
+}
+
+// Hands a magazine from the front of a full cache list back to the depot.
+static void Slab_Flush(SlabFreeList* list, int sizeClass)
+{
+	SlabDepot* depot;
+	void* head;
+	void* tail;
+	int count;
+	int i;
+
+	count = s_slabMagazine[sizeClass];
+	head = list->head;
+	tail = head;
+	for (i = 1; i < count; ++i)
+		tail = *(void**)tail;
+	list->head = *(void**)tail;
+	list->count -= count;
+
+	depot = &s_slabDepots[sizeClass];
+	std::lock_guard<std::mutex> lock(depot->lock);
+	*(void**)tail = depot->head;
+	depot->head = head;
+	depot->count += count;
+}
+
+// threads that never registered have no cache and go to the depot directly
+static void* Slab_AllocShared(int sizeClass)
+{
+	SlabDepot* depot;
+	void* ptr;
+
+	depot = &s_slabDepots[sizeClass];
+	std::lock_guard<std::mutex> lock(depot->lock);
+	if (!depot->count)
+		Slab_NewSpan(depot, sizeClass);
+	ptr = depot->head;
+	depot->head = *(void**)ptr;
+	--depot->count;
+	return ptr;
+}
+
+static void Slab_FreeShared(void* ptr, int sizeClass)
+{
+	SlabDepot* depot;
+
+	depot = &s_slabDepots[sizeClass];
+	std::lock_guard<std::mutex> lock(depot->lock);
+	*(void**)ptr = depot->head;
+	depot->head = ptr;
+	++depot->count;
+}
+
+static SlabLarge* Slab_FindLarge(void* ptr)
+{
+	SlabLarge* entry;
+
+	entry = (SlabLarge*)((unsigned char*)ptr - SLAB_LARGE_HEADER_SIZE);
+	if (entry->magic != SLAB_LARGE_MAGIC)
+		Com_Error(ERR_FATAL, "Slab_Free: %p was not allocated by Slab_Alloc%s", ptr, entry->magic == SLAB_LARGE_FREE_MAGIC ? " or was freed twice" : "");
+	return entry;
+}
+
+static void* Slab_AllocLarge(int size)
+{
+	SlabLarge* entry;
+
+	entry = (SlabLarge*)malloc(SLAB_LARGE_HEADER_SIZE + size);
+	if (!entry)
+		Com_Error(ERR_FATAL, "Slab_Alloc: couldn't allocate %i bytes", size);
+	entry->magic = SLAB_LARGE_MAGIC;
+	entry->size = size;
+	entry->track.name = 0;
+	entry->track.size = size;
+	entry->track.type = 0;
+	s_slabLargeCount.fetch_add(1, std::memory_order_relaxed);
+	return (unsigned char*)entry + SLAB_LARGE_HEADER_SIZE;
+}
+
+static void Slab_FreeLarge(void* ptr)
+{
+	SlabLarge* entry;
+
+	entry = Slab_FindLarge(ptr);
+	entry->magic = SLAB_LARGE_FREE_MAGIC;
+	s_slabLargeCount.fetch_sub(1, std::memory_order_relaxed);
+	free(entry);
+}
+
+// Lock-free unless the calling thread's cache for the class runs dry.
+void* Slab_Alloc(int size)
+{
+	SlabFreeList* list;
+	SlabCache* cache;
+	void* ptr;
+	int sizeClass;
+
+	std::call_once(s_slabInitOnce, Slab_Init);
+	if (size < 0)
+		Com_Error(ERR_FATAL, "Slab_Alloc: bad size %i", size);
+	if (size > SLAB_MAX_SIZE)
+		return Slab_AllocLarge(size);
+	sizeClass = s_slabClassLookup[(size + SLAB_MIN_SIZE - 1) / SLAB_MIN_SIZE];
+	cache = Slab_GetCache();
+	if (!cache)
+		return Slab_AllocShared(sizeClass);
+	list = &cache->lists[sizeClass];
+	if (!list->count)
+		Slab_Refill(list, sizeClass);
+	ptr = list->head;
+	list->head = *(void**)ptr;
+	--list->count;
+	return ptr;
+}
+
+void Slab_Free(void* ptr)
+{
+	SlabFreeList* list;
+	SlabCache* cache;
+	int sizeClass;
+
+	if (!ptr)
+		return;
+	if (!Slab_InRegion(ptr))
+	{
+		Slab_FreeLarge(ptr);
+		return;
+	}
+	sizeClass = s_slabSpanClass[Slab_SpanIndex(ptr)];
+	cache = Slab_GetCache();
+	if (!cache)
+	{
+		Slab_FreeShared(ptr, sizeClass);
+		return;
+	}
+	list = &cache->lists[sizeClass];
+	*(void**)ptr = list->head;
+	list->head = ptr;
+	++list->count;
+	if (list->count >= 2 * s_slabMagazine[sizeClass])
+		Slab_Flush(list, sizeClass);
+}
+
+int Slab_BlockSize(void* ptr)
+{
+	if (Slab_InRegion(ptr))
+		return s_slabClassSize[s_slabSpanClass[Slab_SpanIndex(ptr)]];
+	return Slab_FindLarge(ptr)->size;
+}
+
+static SlabTrack* Slab_SpanTrack(void* ptr)
+{
+	int index;
+	int offset;
+
+	index = Slab_SpanIndex(ptr);
+	offset = (int)((unsigned char*)ptr - s_slabRegion) - index * SLAB_SPAN_SIZE;
+	return &s_slabSpanTrack[index][offset / s_slabClassSize[s_slabSpanClass[index]]];
+}
+
+// Only the thread that owns the block may set its track; any thread may read
+// it once the block has been handed over.
+void Slab_SetTrack(void* ptr, const char* name, int size, int type)
+{
+	SlabTrack* track;
+
+	if (!Slab_InRegion(ptr))
+		track = &Slab_FindLarge(ptr)->track;
+	else
+		track = Slab_SpanTrack(ptr);
+	track->name = name;
+	track->size = size;
+	track->type = type;
+}
+
+void Slab_GetTrack(void* ptr, SlabTrack* track)
+{
+	if (!Slab_InRegion(ptr))
+		*track = Slab_FindLarge(ptr)->track;
+	else
+		*track = *Slab_SpanTrack(ptr);
+}
+
+void Slab_Meminfo_f(void)
+{
+	SlabDepot* depot;
+	int sizeClass;
+	int spans;
+
+	std::call_once(s_slabInitOnce, Slab_Init);
+	Com_Printf(CON_CHANNEL_SYSTEM, "class    spans   committed KB   depot blocks\n");
+	for (sizeClass = 0; sizeClass < SLAB_CLASS_COUNT; ++sizeClass)
+	{
+		depot = &s_slabDepots[sizeClass];
+		std::lock_guard<std::mutex> lock(depot->lock);
+		if (!depot->spanCount)
+			continue;
+		Com_Printf(CON_CHANNEL_SYSTEM, "%5i  %7i  %13i  %13i\n", s_slabClassSize[sizeClass], depot->spanCount,
+			depot->spanCount * (SLAB_SPAN_SIZE / 1024), depot->count);
+	}
+	spans = s_slabSpanCount.load(std::memory_order_relaxed);
+	Com_Printf(CON_CHANNEL_SYSTEM, "%i spans, %i KB committed to small blocks\n", spans, spans * (SLAB_SPAN_SIZE / 1024));
+	Com_Printf(CON_CHANNEL_SYSTEM, "%i blocks over %i bytes from the system heap\n", s_slabLargeCount.load(std::memory_order_relaxed), SLAB_MAX_SIZE);
+}
+
+#define SLAB_BENCH_THREADS 4
+#define SLAB_BENCH_LIVE 1024
+#define SLAB_BENCH_OPS 200000
+
+enum SlabBenchMode
+{
+	SLAB_BENCH_HEAP,
+	SLAB_BENCH_SLAB,
+	SLAB_BENCH_ZMALLOC,
+	SLAB_BENCH_MODE_COUNT
+};
+
+static const char* s_slabBenchModeNames[SLAB_BENCH_MODE_COUNT] = { "heap", "slab", "Z_Malloc" };
+
+// Keeps SLAB_BENCH_LIVE blocks alive and replaces a random one per step,
+// mostly small with the occasional large one, like general game churn.
+static void Slab_BenchThread(int mode)
+{
+	void* live[SLAB_BENCH_LIVE];
+	unsigned int seed;
+	int slot;
+	int size;
+	int i;
+
+	if (mode != SLAB_BENCH_HEAP)
+		Sys_RegisterThread(THREAD_CONTEXT_COUNT);
+	for (i = 0; i < SLAB_BENCH_LIVE; ++i)
+		live[i] = 0;
+	seed = 12345;
+	for (i = 0; i < SLAB_BENCH_OPS; ++i)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		slot = (seed >> 8) % SLAB_BENCH_LIVE;
+		if ((seed >> 24) < 205)
+			size = 16 + (seed >> 4) % 240;
+		else if ((seed >> 24) < 250)
+			size = 256 + (seed >> 4) % 3840;
+		else
+			size = 4096 + (seed >> 4) % 12288;
+		switch (mode)
+		{
+		case SLAB_BENCH_HEAP:
+			free(live[slot]);
+			live[slot] = malloc(size);
+			break;
+		case SLAB_BENCH_SLAB:
+			Slab_Free(live[slot]);
+			live[slot] = Slab_Alloc(size);
+			break;
+		default:
+			if (live[slot])
+				Z_Free(live[slot], TRACK_DEBUG);
+			live[slot] = Z_MallocGarbage(size, "Slab_Benchmark_f", TRACK_DEBUG);
+			break;
+		}
+		*(unsigned char*)live[slot] = (unsigned char)i;
+	}
+	for (i = 0; i < SLAB_BENCH_LIVE; ++i)
+	{
+		if (!live[i])
+			continue;
+		switch (mode)
+		{
+		case SLAB_BENCH_HEAP:
+			free(live[i]);
+			break;
+		case SLAB_BENCH_SLAB:
+			Slab_Free(live[i]);
+			break;
+		default:
+			Z_Free(live[i], TRACK_DEBUG);
+			break;
+		}
+	}
+	if (mode != SLAB_BENCH_HEAP)
+		Sys_UnregisterThread();
+}
+
+// Alloc/free pairs per second for the system heap, the bare slab allocator
+// and Z_Malloc with tracking, on 1, 2 and 4 threads.
+void Slab_Benchmark_f(void)
+{
+	std::thread threads[SLAB_BENCH_THREADS];
+	std::chrono::steady_clock::time_point start;
+	double seconds;
+	double ops;
+	int threadCount;
+	int mode;
+	int i;
+
+	for (threadCount = 1; threadCount <= SLAB_BENCH_THREADS; threadCount *= 2)
+	{
+		ops = (double)threadCount * SLAB_BENCH_OPS;
+		Com_Printf(CON_CHANNEL_SYSTEM, "%d thread%s:", threadCount, threadCount == 1 ? " " : "s");
+		for (mode = 0; mode < SLAB_BENCH_MODE_COUNT; ++mode)
+		{
+			start = std::chrono::steady_clock::now();
+			for (i = 0; i < threadCount; ++i)
+				threads[i] = std::thread(Slab_BenchThread, mode);
+			for (i = 0; i < threadCount; ++i)
+				threads[i].join();
+			seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			Com_Printf(CON_CHANNEL_SYSTEM, "  %s %6.1f M/s", s_slabBenchModeNames[mode], ops / seconds / 1e6);
+		}
+		Com_Printf(CON_CHANNEL_SYSTEM, "\n");
+	}
+	Slab_Meminfo_f();
+}
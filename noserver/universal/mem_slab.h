@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2020-2021 OpenIW
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEM_SLAB_H
+#define MEM_SLAB_H
+
+// 8 classes 16 bytes apart up to 128, then 4 per power of two up to 16 KB
+#define SLAB_CLASS_COUNT 36
+#define SLAB_MIN_SIZE 16
+#define SLAB_MAX_SIZE (16 * 1024)
+
+// spans are carved out of one reserved region and never given back
+#define SLAB_SPAN_SIZE (64 * 1024)
+#define SLAB_REGION_SIZE (256 * 1024 * 1024)
+#define SLAB_SPAN_COUNT (SLAB_REGION_SIZE / SLAB_SPAN_SIZE)
+
+// a thread caches up to two magazines of this many bytes per class
+#define SLAB_MAGAZINE_BYTES (16 * 1024)
+#define SLAB_MAGAZINE_MAX 64
+
+// larger blocks come from the system heap, each behind a header that holds
+// its size and track
+#define SLAB_LARGE_ALIGN 16
+#define SLAB_LARGE_MAGIC 0x51AB1A26
+#define SLAB_LARGE_FREE_MAGIC 0x51AB1A27
+
+// Who asked for a block, kept beside the slab instead of in front of the
+// block so the block sizes stay exact powers and steps.
+typedef struct SlabTrack
+{
+	const char* name;
+	int size;
+	int type;
+} SlabTrack;
+
+void* Slab_Alloc(int size);
+void Slab_Free(void* ptr);
+int Slab_BlockSize(void* ptr);
+void Slab_SetTrack(void* ptr, const char* name, int size, int type);
+void Slab_GetTrack(void* ptr, SlabTrack* track);
+void Slab_Meminfo_f(void);
+void Slab_Benchmark_f(void);
+
+#endif // MEM_SLAB_H
@@ -19,6 +19,9 @@
 #include "com_vector.h"
 #include "com_math_anglevectors.h"
 
+#include <qcommon/common.h>
+#include <qcommon/threads_registry.h>
+
 unsigned char ColorIndex(unsigned char c)
 {
 	if ((c - 48) >= 0xA)
@@ -548,9 +551,14 @@ char* va(char const* format, ...)
 
 void Com_InitThreadData(int threadContext)
 {
-    Sys_SetValue(1, &va_info[threadContext]);
-    Sys_SetValue(2, g_com_error[threadContext]);
-    Sys_SetValue(3, &g_traceThreadInfo[threadContext]);
+    SysThreadBlock* block;
+
+    block = Sys_RegisterThread(threadContext);
+    if (!block)
+        Com_Error(ERR_FATAL, "Com_InitThreadData: no thread blocks left for context %i (%i threads registered)", threadContext, Sys_GetThreadBlockCount());
+    Sys_SetValue(1, &block->vaInfo);
+    Sys_SetValue(2, block->comError);
+    Sys_SetValue(3, &block->traceThreadInfo);
     if (threadContext == 1)
         Sys_SetValue(4, &unknownThreadValue);
     else
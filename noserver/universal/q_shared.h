@@ -82,9 +82,6 @@ int(__cdecl* _LittleLong)(int);
 float(__cdecl* _LittleFloatRead)(int);
 int(__cdecl* _LittleFloatWrite)(float);
 
-extern va_info_t va_info[17];
-extern int g_com_error[17][16];
-extern TraceThreadInfo g_traceThreadInfo[17];
 extern int unknownThreadValue;
 extern struct CmdArgs g_cmd_args[2];
 
@@ -20,9 +20,12 @@
 #include <universal/com_shared.h>
 #include <universal/mem_userhunk.h>
 #include <universal/q_shared.h>
+#include <qcommon/common.h>
 #include <win32/win_main.h>
 #include <direct.h>
 #include <io.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 char exePath[256];
 char cwd[256];
@@ -34,6 +37,52 @@ static _RTL_CRITICAL_SECTION s_criticalSection[77];
 
 static unsigned int s_threadAffinityMask;
 
+// Contention counters for the CRITSECT table. Each thread only writes its own
+// block; Sys_CritSectProfile_f sums the blocks when asked.
+typedef struct CritSectCounters
+{
+	unsigned int acquires;
+	unsigned int contended;
+	unsigned long long waitTicks;
+	unsigned long long maxHoldTicks;
+} CritSectCounters;
+
+typedef struct CritSectThreadProfile
+{
+	CritSectCounters counters[CRITSECT_COUNT];
+	unsigned long long enterTicks[CRITSECT_COUNT];
+	int depth[CRITSECT_COUNT];
+	CritSectThreadProfile* next;
+} CritSectThreadProfile;
+
+static const char* s_criticalSectionNames[CRITSECT_COUNT] =
+{
+	"CRITSECT_ALLOC_MARK", "CRITSECT_FX_VIS", "CRITSECT_OCCLUSION_QUERY", "CRITSECT_PHYSICS",
+	"CRITSECT_PHYSICS_UPDATE", "CRITSECT_PHYSICS_DESTRUCTIBLE_HIT", "CRITSECT_FX_UNIQUE_HANDLE", "CRITSECT_SOUND_COMMAND_ALLOC",
+	"CRITSECT_SOUND_COMMAND_PUSH", "CRITSECT_SOUND_NOTIFY_ALLOC", "CRITSECT_SOUND_NOTIFY_PUSH", "CRITSECT_SOUND_BANK",
+	"CRITSECT_SOUND_LOOKUP_CACHE", "CRITSECT_CAREER_STATS", "CRITSECT_CONSOLE", "CRITSECT_DEBUG_SOCKET",
+	"CRITSECT_COM_ERROR", "CRITSECT_STATMON", "CRITSECT_MEM_ALLOC0", "CRITSECT_MEM_ALLOC1",
+	"CRITSECT_DEBUG_LINE", "CRITSECT_DEBUG_BRUSHES_AND_PATCHES", "CRITSECT_CLIENT_MESSAGE", "CRITSECT_CLIENT_CMD",
+	"CRITSECT_DOBJ_ALLOC", "CRITSECT_XANIM_ALLOC", "CRITSECT_KEY_BINDINGS", "CRITSECT_SERVER_MESSAGE",
+	"CRITSECT_SERVER_PLAYERINFO", "CRITSECT_SCRIPT_STRING", "CRITSECT_MEMORY_TREE", "CRITSECT_ASSERT",
+	"CRITSECT_RD_BUFFER", "CRITSECT_SYS_EVENT_QUEUE", "CRITSECT_FATAL_ERROR", "CRITSECT_DXDEVICE",
+	"CRITSECT_DXDEVICE_GLOB", "CRITSECT_DXCONTEXT", "CRITSECT_SCRIPT_DEBUGGER_ALLOC", "CRITSECT_SCRIPT_DEBUGGER",
+	"CRITSECT_REMOTE", "CRITSECT_MISSING_ASSET", "CRITSECT_LIVE", "CRITSECT_AUDIO_PHYSICS",
+	"CRITSECT_LUI", "CRITSECT_VCS", "CRITSECT_CINEMATIC", "CRITSECT_CINEMATIC_TARGET_CHANGE",
+	"CRITSECT_CINEMATIC_UPDATEFRAME", "CRITSECT_RB_TRANSFER", "CRITSECT_NETTHREAD_OVERRIDE", "CRITSECT_DEMONWARE",
+	"CRITSECT_IK", "CRITSECT_TL_MEMALLOC", "CRITSECT_VA_ALLOC", "CRITSECT_MEMTRACK",
+	"CRITSECT_CBUF", "CRITSECT_CURVEALLOC", "CRITSECT_NETQUEUE", "CRITSECT_ZLIB",
+	"CRITSECT_BLACKBOX", "CRITSECT_GDT_COMMAND", "CRITSECT_STRINGED_COMMAND", "CRITSECT_RADIANT_SERVER_COMMAND",
+	"CRITSECT_RADIANT_CLIENT_COMMAND", "CRITSECT_RECORDER", "CRITSECT_SERVERDEMO", "CRITSECT_IO_SCHEDULER",
+	"CRITSECT_FILE_ID_ARRAY", "CRITSECT_MEMFIRSTFIT", "CRITSECT_FXBEAM", "CRITSECT_GLASS_ACTIONS",
+	"CRITSECT_DBHASH", "CRITSECT_CLUMP", "CRITSECT_SNAPSHOT_PROFILE", "CRITSEC_WEBM_STREAM_ACCESS",
+	"CRITSEC_SV_LEADERBOARDS"
+};
+
+static volatile bool s_critSectProfiling;
+static CritSectThreadProfile* volatile s_critSectProfiles;
+__declspec(thread) CritSectThreadProfile* s_critSectThreadProfile;
+
 void TRACK_win_common(void)
 {
 }
@@ -314,7 +363,208 @@ void Sys_InitializeCriticalSections(void)
 	if (!inited_1)
 	{
 		inited_1 = 1;
-		for (critSect = s_criticalSection; (int)critSect < (int)&s_threadAffinityMask;)
+		for (critSect = s_criticalSection; critSect < &s_criticalSection[CRITSECT_COUNT];)
 			InitializeCriticalSection(critSect++);
 	}
 }
+
+static unsigned long long Sys_CritSectTicks(void)
+{
+	LARGE_INTEGER ticks;
+
+	QueryPerformanceCounter(&ticks);
+	return ticks.QuadPart;
+}
+
+static CritSectThreadProfile* Sys_GetCritSectThreadProfile(void)
+{
+	CritSectThreadProfile* profile;
+
+	profile = s_critSectThreadProfile;
+	if (profile)
+		return profile;
+	// not Z_Malloc, the allocator takes critical sections of its own
+	profile = (CritSectThreadProfile*)calloc(1, sizeof(CritSectThreadProfile));
+	if (!profile)
+		return NULL;
+	do
+	{
+		profile->next = s_critSectProfiles;
+	} while (InterlockedCompareExchangePointer((PVOID volatile*)&s_critSectProfiles, profile, profile->next) != profile->next);
+	s_critSectThreadProfile = profile;
+	return profile;
+}
+
+static void Sys_ProfileCritSectAcquired(CriticalSection critSect, bool contended, unsigned long long waitStart)
+{
+	CritSectThreadProfile* profile;
+	CritSectCounters* counters;
+	unsigned long long now;
+
+	profile = Sys_GetCritSectThreadProfile();
+	if (!profile)
+		return;
+	now = Sys_CritSectTicks();
+	counters = &profile->counters[critSect];
+	++counters->acquires;
+	if (contended)
+	{
+		++counters->contended;
+		counters->waitTicks += now - waitStart;
+	}
+	// the sections are recursive, hold time runs from the outermost enter
+	if (!profile->depth[critSect]++)
+		profile->enterTicks[critSect] = now;
+}
+
+void Sys_EnterCriticalSection(CriticalSection critSect)
+{
+	unsigned long long waitStart;
+
+	if (!s_critSectProfiling)
+	{
+		EnterCriticalSection(&s_criticalSection[critSect]);
+		return;
+	}
+	if (TryEnterCriticalSection(&s_criticalSection[critSect]))
+	{
+		Sys_ProfileCritSectAcquired(critSect, false, 0);
+		return;
+	}
+	waitStart = Sys_CritSectTicks();
+	EnterCriticalSection(&s_criticalSection[critSect]);
+	Sys_ProfileCritSectAcquired(critSect, true, waitStart);
+}
+
+bool Sys_TryEnterCriticalSection(CriticalSection critSect)
+{
+	if (!TryEnterCriticalSection(&s_criticalSection[critSect]))
+		return false;
+	if (s_critSectProfiling)
+		Sys_ProfileCritSectAcquired(critSect, false, 0);
+	return true;
+}
+
+void Sys_LeaveCriticalSection(CriticalSection critSect)
+{
+	CritSectThreadProfile* profile;
+	CritSectCounters* counters;
+	unsigned long long held;
+
+	profile = s_critSectThreadProfile;
+	// depth is zero for sections entered before profiling was switched on
+	if (profile && profile->depth[critSect] && !--profile->depth[critSect])
+	{
+		counters = &profile->counters[critSect];
+		held = Sys_CritSectTicks() - profile->enterTicks[critSect];
+		if (held > counters->maxHoldTicks)
+			counters->maxHoldTicks = held;
+	}
+	LeaveCriticalSection(&s_criticalSection[critSect]);
+}
+
+static void Sys_MergeCritSectProfiles(CritSectCounters* merged)
+{
+	CritSectThreadProfile* profile;
+	int i;
+
+	memset(merged, 0, sizeof(CritSectCounters) * CRITSECT_COUNT);
+	for (profile = s_critSectProfiles; profile; profile = profile->next)
+	{
+		for (i = 0; i < CRITSECT_COUNT; ++i)
+		{
+			merged[i].acquires += profile->counters[i].acquires;
+			merged[i].contended += profile->counters[i].contended;
+			merged[i].waitTicks += profile->counters[i].waitTicks;
+			if (profile->counters[i].maxHoldTicks > merged[i].maxHoldTicks)
+				merged[i].maxHoldTicks = profile->counters[i].maxHoldTicks;
+		}
+	}
+}
+
+static double Sys_CritSectTicksToUsec(unsigned long long ticks)
+{
+	LARGE_INTEGER frequency;
+
+	QueryPerformanceFrequency(&frequency);
+	return ticks * 1000000.0 / frequency.QuadPart;
+}
+
+// First call switches profiling on, later calls print the busiest sections.
+void Sys_CritSectProfile_f(void)
+{
+	CritSectCounters merged[CRITSECT_COUNT];
+	int order[CRITSECT_COUNT];
+	int count;
+	int i;
+	int j;
+	int swap;
+
+	if (!s_critSectProfiling)
+	{
+		s_critSectProfiling = true;
+		Com_Printf(CON_CHANNEL_SYSTEM, "critical section profiling enabled\n");
+		return;
+	}
+
+	Sys_MergeCritSectProfiles(merged);
+	count = 0;
+	for (i = 0; i < CRITSECT_COUNT; ++i)
+	{
+		if (merged[i].acquires)
+			order[count++] = i;
+	}
+	// most total wait first
+	for (i = 1; i < count; ++i)
+	{
+		for (j = i; j > 0 && merged[order[j]].waitTicks > merged[order[j - 1]].waitTicks; --j)
+		{
+			swap = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = swap;
+		}
+	}
+
+	Com_Printf(CON_CHANNEL_SYSTEM, "%-36s %10s %10s %12s %12s\n", "section", "acquires", "contended", "wait ms", "max hold us");
+	for (i = 0; i < count; ++i)
+	{
+		Com_Printf(CON_CHANNEL_SYSTEM, "%-36s %10u %10u %12.3f %12.1f\n",
+			s_criticalSectionNames[order[i]],
+			merged[order[i]].acquires,
+			merged[order[i]].contended,
+			Sys_CritSectTicksToUsec(merged[order[i]].waitTicks) / 1000.0,
+			Sys_CritSectTicksToUsec(merged[order[i]].maxHoldTicks));
+	}
+}
+
+void Sys_WriteCritSectProfile(char const* filename)
+{
+	CritSectCounters merged[CRITSECT_COUNT];
+	FILE* f;
+	int i;
+
+	f = fopen(filename, "w");
+	if (!f)
+	{
+		Com_Printf(CON_CHANNEL_SYSTEM, "couldn't open %s for writing\n", filename);
+		return;
+	}
+	Sys_MergeCritSectProfiles(merged);
+	fprintf(f, "section,acquires,contended,wait_us,max_hold_us\n");
+	for (i = 0; i < CRITSECT_COUNT; ++i)
+	{
+		fprintf(f, "%s,%u,%u,%.1f,%.1f\n",
+			s_criticalSectionNames[i],
+			merged[i].acquires,
+			merged[i].contended,
+			Sys_CritSectTicksToUsec(merged[i].waitTicks),
+			Sys_CritSectTicksToUsec(merged[i].maxHoldTicks));
+	}
+	fclose(f);
+	Com_Printf(CON_CHANNEL_SYSTEM, "wrote %s\n", filename);
+}
+
+void Sys_CritSectProfileDump_f(void)
+{
+	Sys_WriteCritSectProfile("critsect_profile.csv");
+}
@@ -115,5 +115,8 @@ void Sys_InitializeCriticalSections(void);
 void Sys_EnterCriticalSection(enum CriticalSection);
 bool Sys_TryEnterCriticalSection(enum CriticalSection);
 void Sys_LeaveCriticalSection(enum CriticalSection);
+void Sys_CritSectProfile_f(void);
+void Sys_WriteCritSectProfile(char const*);
+void Sys_CritSectProfileDump_f(void);
 
 #endif
\ No newline at end of file